@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "graph.h"
+
+/**
+ * 图算法性能测试，仿照 Graph500 的做法：
+ *
+ * 1.使用 R-MAT (Kronecker) 生成器生成 2^scale 个顶点、edgefactor * 2^scale 条无向边的图，
+ *   顶点编号经过随机置换，避免度数大的顶点集中在编号较小的位置；
+ * 2.计时构建图的过程；
+ * 3.从若干个随机选取的（度数不为 0 的）源点执行 graph_bfs，校验搜索树并统计每秒遍历的
+ *   边数 (TEPS)；
+ * 4.重复执行 graph_dfs 遍历整个图，校验访问顺序并统计 TEPS；
+ * 5.输出 TEPS 的最小值、四分位数、最大值和调和平均值。
+ *
+ * 用法：./bench [scale] [edgefactor] [roots] [seed]
+ *
+ * 注意 graph_dfs 是递归实现，递归深度可能接近顶点数量，scale 较大时需要先 ulimit -s 放开
+ * 栈空间限制。
+ */
+
+#define BENCH_DEFAULT_SCALE 14
+#define BENCH_DEFAULT_EDGEFACTOR 16
+#define BENCH_DEFAULT_ROOTS 64
+#define BENCH_DFS_ROUNDS 8
+
+/* R-MAT 生成器的象限概率，取 Graph500 的参数，D = 1 - A - B - C */
+#define RMAT_A 0.57
+#define RMAT_B 0.19
+#define RMAT_C 0.19
+
+/* 深度优先搜索校验状态 */
+typedef struct bench_dfs_check_st
+{
+    /* 顶点的发现次数 */
+    int *found;
+
+    /* 已发现但尚未结束的顶点栈 */
+    int *stack;
+    int top;
+
+    /* 发现的顶点数量 */
+    int count;
+
+    /* 是否出现错误 */
+    int error;
+} BENCH_DFS_CHECK;
+
+static unsigned long long bench_seed = 1;
+
+/* splitmix64 伪随机数，保证同一个种子生成同样的图 */
+static unsigned long long bench_random()
+{
+    unsigned long long z = (bench_seed += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* 返回 [0, 1) 之间的随机数 */
+static double bench_random_real()
+{
+    return (bench_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double bench_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench_compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* 生成 R-MAT 边表，edges 至少能容纳 num 条边 */
+static void bench_generate_rmat(int scale, GRAPH_EDGE *edges, int num)
+{
+    int n = 1 << scale;
+    int *perm = malloc(n * sizeof(int));
+    int i = 0;
+
+    for (; i < n; i++) {
+        perm[i] = i;
+    }
+
+    /* 随机置换顶点编号 */
+    for (i = n - 1; i > 0; i--) {
+        int j = (int)(bench_random() % (unsigned long long)(i + 1));
+        int tmp = perm[i];
+
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+
+    for (i = 0; i < num; i++) {
+        int u = 0;
+        int v = 0;
+        int bit = 0;
+
+        /* 每一位依次按照概率选择邻接矩阵的四个象限之一 */
+        for (; bit < scale; bit++) {
+            double r = bench_random_real();
+
+            if (r < RMAT_A) {
+                continue;
+            } else if (r < RMAT_A + RMAT_B) {
+                v |= 1 << bit;
+            } else if (r < RMAT_A + RMAT_B + RMAT_C) {
+                u |= 1 << bit;
+            } else {
+                u |= 1 << bit;
+                v |= 1 << bit;
+            }
+        }
+
+        edges[i].from = perm[u];
+        edges[i].to = perm[v];
+    }
+
+    free(perm);
+}
+
+/* 构建无向图，每条边插入两个方向 */
+static GRAPH *bench_build_graph(int scale, const GRAPH_EDGE *edges, int num)
+{
+    int n = 1 << scale;
+    GRAPH *graph = graph_create(n);
+    int i = 0;
+
+    for (; i < n; i++) {
+        graph_push_data(graph, NULL);
+    }
+
+    for (i = 0; i < num; i++) {
+        graph_set_adjacent(graph, edges[i].from, edges[i].to);
+        graph_set_adjacent(graph, edges[i].to, edges[i].from);
+    }
+
+    return graph;
+}
+
+/**
+ * 校验广度优先搜索树，返回遍历的边数，校验失败返回 -1
+ *
+ * 1.源点的距离为 0；
+ * 2.对每条边 (u, v)，如果 u 可达，那么 v 也可达，并且 d(v) <= d(u) + 1；
+ * 3.除源点外每个可达顶点都有父结点 p，边 (p, v) 存在并且 d(v) = d(p) + 1。
+ */
+static long long bench_validate_bfs(const GRAPH *graph, const GRAPH_BFS_TREE *tree, int root, char *marks)
+{
+    long long edges = 0;
+    int n = graph->number;
+    int u = 0;
+
+    if (graph_bfs_distance(tree, root) != 0 || graph_bfs_parent(tree, root) != -1) {
+        return -1;
+    }
+
+    memset(marks, 0, n);
+
+    for (; u < n; u++) {
+        int du = graph_bfs_distance(tree, u);
+        GRAPH_ADJTEX *adj = graph->vex_list[u].head;
+
+        if (du < 0) {
+            continue;
+        }
+
+        for (; adj; adj = adj->next) {
+            int v = adj->index;
+            int dv = graph_bfs_distance(tree, v);
+
+            if (dv < 0 || dv > du + 1) {
+                return -1;
+            }
+
+            if (graph_bfs_parent(tree, v) == u && dv == du + 1) {
+                marks[v] = 1;
+            }
+            edges++;
+        }
+    }
+
+    for (u = 0; u < n; u++) {
+        if (u != root && graph_bfs_distance(tree, u) >= 0 && !marks[u]) {
+            return -1;
+        }
+    }
+
+    /* 无向边在邻接表中出现两次 */
+    return edges / 2;
+}
+
+static void bench_dfs_before(void *args, int index)
+{
+    BENCH_DFS_CHECK *check = args;
+
+    if (check->found[index]++) {
+        check->error = 1;
+    }
+
+    check->stack[check->top++] = index;
+    check->count++;
+}
+
+static void bench_dfs_after(void *args, int index)
+{
+    BENCH_DFS_CHECK *check = args;
+
+    /* 结束的顺序必须与发现的顺序嵌套 */
+    if (check->top <= 0 || check->stack[--check->top] != index) {
+        check->error = 1;
+    }
+}
+
+/* 打印 TEPS 统计信息 */
+static void bench_report(const char *name, double *teps, int num)
+{
+    double hmean = 0;
+    int i = 0;
+
+    if (num <= 0) {
+        return;
+    }
+
+    qsort(teps, num, sizeof(double), bench_compare_double);
+
+    for (; i < num; i++) {
+        hmean += 1.0 / teps[i];
+    }
+    hmean = num / hmean;
+
+    printf("%s TEPS (%d 次):\n", name, num);
+    printf("    min             %.4e\n", teps[0]);
+    printf("    firstquartile   %.4e\n", teps[num / 4]);
+    printf("    median          %.4e\n", teps[num / 2]);
+    printf("    thirdquartile   %.4e\n", teps[(3 * num) / 4]);
+    printf("    max             %.4e\n", teps[num - 1]);
+    printf("    harmonic_mean   %.4e\n", hmean);
+}
+
+int main(int argc, char *argv[])
+{
+    int scale = BENCH_DEFAULT_SCALE;
+    int edgefactor = BENCH_DEFAULT_EDGEFACTOR;
+    int roots = BENCH_DEFAULT_ROOTS;
+
+    GRAPH *graph = NULL;
+    GRAPH_EDGE *edges = NULL;
+    GRAPH_BFS_TREE *tree = NULL;
+    GRAPH_DFS_FOREST *forest = NULL;
+    BENCH_DFS_CHECK check;
+
+    double *teps = NULL;
+    char *marks = NULL;
+    double start = 0;
+    double elapsed = 0;
+    long long adjacency = 0;
+
+    int num = 0;
+    int n = 0;
+    int i = 0;
+    int done = 0;
+
+    if (argc > 1) {
+        scale = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        edgefactor = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        roots = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        bench_seed = strtoull(argv[4], NULL, 10);
+    }
+
+    if (scale <= 0 || scale > 26 || edgefactor <= 0 || roots <= 0) {
+        fprintf(stderr, "用法：%s [scale] [edgefactor] [roots] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    n = 1 << scale;
+    num = n * edgefactor;
+
+    printf("scale = %d, edgefactor = %d, 顶点 %d 个, 边 %d 条\n", scale, edgefactor, n, num);
+
+    edges = malloc(num * sizeof(GRAPH_EDGE));
+    bench_generate_rmat(scale, edges, num);
+
+    /* 构建图 */
+    start = bench_now();
+    graph = bench_build_graph(scale, edges, num);
+    elapsed = bench_now() - start;
+
+    free(edges);
+
+    for (i = 0; i < n; i++) {
+        adjacency += graph->vex_list[i].count;
+    }
+
+    printf("构建用时 %.6f 秒, 邻接点 %lld 个 (去重后)\n", elapsed, adjacency);
+
+    teps = malloc((roots > BENCH_DFS_ROUNDS ? roots : BENCH_DFS_ROUNDS) * sizeof(double));
+    marks = malloc(n);
+    tree = graph_bfs_tree_create(graph);
+
+    /* 从随机源点执行广度优先搜索 */
+    for (i = 0; done < roots && i < roots * 16; i++) {
+        int root = (int)(bench_random() % (unsigned long long)n);
+        long long traversed = 0;
+
+        if (!graph->vex_list[root].count) {
+            continue;
+        }
+
+        start = bench_now();
+        graph_bfs(graph, tree, root);
+        elapsed = bench_now() - start;
+
+        traversed = bench_validate_bfs(graph, tree, root, marks);
+        if (traversed < 0) {
+            fprintf(stderr, "广度优先搜索校验失败，源点 %d\n", root);
+            return 1;
+        }
+
+        teps[done++] = traversed / elapsed;
+    }
+
+    bench_report("graph_bfs", teps, done);
+
+    /* 深度优先搜索遍历整个图 */
+    check.found = malloc(n * sizeof(int));
+    check.stack = malloc(n * sizeof(int));
+    forest = graph_dfs_forest_create(graph);
+
+    for (i = 0; i < BENCH_DFS_ROUNDS; i++) {
+        memset(check.found, 0, n * sizeof(int));
+        check.top = 0;
+        check.count = 0;
+        check.error = 0;
+
+        start = bench_now();
+        graph_dfs(graph, forest, bench_dfs_before, bench_dfs_after, &check);
+        elapsed = bench_now() - start;
+
+        if (check.error || check.top || check.count != n) {
+            fprintf(stderr, "深度优先搜索校验失败\n");
+            return 1;
+        }
+
+        teps[i] = (adjacency / 2) / elapsed;
+    }
+
+    bench_report("graph_dfs", teps, BENCH_DFS_ROUNDS);
+
+    free(check.found);
+    free(check.stack);
+    free(marks);
+    free(teps);
+
+    graph_dfs_forest_destroy(forest);
+    graph_bfs_tree_destroy(tree);
+    graph_clear_adjacent(graph);
+    graph_destroy(graph);
+    return 0;
+}
@@ -7,11 +7,37 @@
 
 #define GRAPH_DEFAULT_SIZE 512
 
+/* 失效邻接点达到该数量之前不做清理 */
+#define GRAPH_COMPACT_MIN 64
+
+/* 判断顶点是否已被删除 */
+#define GRAPH_VERTEX_IS_REMOVED(vertex) ((vertex)->flag & GRAPH_VERTEX_REMOVED)
+
 /* 搜索树的节点颜色 */
 #define GRAPH_BFS_COLOR_WHITE 0
 #define GRAPH_BFS_COLOR_GRAY 1
 #define GRAPH_BFS_COLOR_BLACK 2
 
+/* 散列索引的空槽和已删除槽 */
+#define GRAPH_INDEX_EMPTY -1
+#define GRAPH_INDEX_DELETED -2
+
+/* 散列索引，开放定址并线性探测 */
+struct graph_index_st
+{
+    /* 槽中存放顶点索引 */
+    int *slots;
+
+    /* 对应顶点数据的散列值，探测时先比较散列值 */
+    unsigned int *hashes;
+
+    /* 槽数量减一，槽数量为 2 的幂 */
+    unsigned int mask;
+
+    unsigned int (*hash)(const void *data);
+    int (*compare)(const void *a, const void *b);
+};
+
 struct graph_bfs_node_st
 {
     int index;
@@ -48,6 +74,15 @@ struct graph_dfs_forest_st
 /* 定义顶点队列 */
 QUEUE_DEFINE(graph, GRAPH, int);
 
+/* 在索引中查找数据，找到返回槽位置，否则返回 -1 */
+static int graph_index_lookup(const GRAPH *graph, const void *data, unsigned int hash);
+
+/* 将顶点插入索引 */
+static void graph_index_insert(GRAPH *graph, int index, unsigned int hash);
+
+/* 将顶点从索引中移除 */
+static void graph_index_erase(GRAPH *graph, int index);
+
 /* 为图顶点插入邻接顶点 */
 
 GRAPH *graph_create(int size)
@@ -63,7 +98,7 @@ GRAPH *graph_create(int size)
     memset(graph, 0, sizeof(GRAPH));
 
     list = malloc(size * sizeof(GRAPH_VERTEX));
-    memset(graph, 0, sizeof(GRAPH));
+    memset(list, 0, size * sizeof(GRAPH_VERTEX));
 
     graph->number = 0;
     graph->max_num = size;
@@ -85,12 +120,19 @@ void graph_destroy(GRAPH *graph)
         free(graph->vex_list);
     }
 
+    if (graph->index) {
+        free(graph->index->slots);
+        free(graph->index->hashes);
+        free(graph->index);
+    }
+
     free(graph);
 }
 
 int graph_push_data(GRAPH *graph, void *data)
 {
     GRAPH_VERTEX *list = NULL;
+    unsigned int hash = 0;
     int count = 0;
 
     if (!graph) {
@@ -104,11 +146,99 @@ int graph_push_data(GRAPH *graph, void *data)
         return -1;
     }
 
+    if (graph->index) {
+        hash = graph->index->hash(data);
+        if (graph_index_lookup(graph, data, hash) >= 0) {
+            return -1;
+        }
+    }
+
+    list[count].head = NULL;
+    list[count].tail = NULL;
+    list[count].count = 0;
+    list[count].in_count = 0;
+    list[count].flag = 0;
     list[count].data = data;
     graph->number++;
+
+    if (graph->index) {
+        graph_index_insert(graph, count, hash);
+    }
     return count;
 }
 
+int graph_create_index(
+    GRAPH *graph,
+    unsigned int (*hash)(const void *data),
+    int (*compare)(const void *a, const void *b))
+{
+    GRAPH_INDEX *index = NULL;
+    unsigned int size = 16;
+    int i = 0;
+
+    if (!graph || !hash || !compare || graph->index) {
+        return -1;
+    }
+
+    /**
+     * 顶点索引不会被复用，插入索引的顶点总数不超过 max_num，槽数量取其两倍以上，即使算上
+     * 已删除的槽，负载因子也不会超过 0.5，因此索引无需扩容
+     */
+    while (size < (unsigned int)graph->max_num * 2) {
+        size <<= 1;
+    }
+
+    index = malloc(sizeof(GRAPH_INDEX));
+    memset(index, 0, sizeof(GRAPH_INDEX));
+
+    index->slots = malloc(size * sizeof(int));
+    index->hashes = malloc(size * sizeof(unsigned int));
+    memset(index->slots, 0xFF, size * sizeof(int));
+
+    index->mask = size - 1;
+    index->hash = hash;
+    index->compare = compare;
+    graph->index = index;
+
+    for (; i < graph->number; i++) {
+        GRAPH_VERTEX *vertex = graph->vex_list + i;
+        unsigned int value = 0;
+
+        if (GRAPH_VERTEX_IS_REMOVED(vertex)) {
+            continue;
+        }
+
+        value = hash(vertex->data);
+        if (graph_index_lookup(graph, vertex->data, value) >= 0) {
+            free(index->slots);
+            free(index->hashes);
+            free(index);
+            graph->index = NULL;
+            return -1;
+        }
+
+        graph_index_insert(graph, i, value);
+    }
+
+    return 0;
+}
+
+int graph_find_index(const GRAPH *graph, const void *data)
+{
+    int pos = 0;
+
+    if (!graph || !graph->index) {
+        return -1;
+    }
+
+    pos = graph_index_lookup(graph, data, graph->index->hash(data));
+    if (pos < 0) {
+        return -1;
+    }
+
+    return graph->index->slots[pos];
+}
+
 int graph_set_adjacent(GRAPH *graph, int cur, int dest)
 {
     GRAPH_VERTEX *list = NULL;
@@ -119,12 +249,17 @@ int graph_set_adjacent(GRAPH *graph, int cur, int dest)
         return -1;
     }
 
-    if (cur >= graph->number || dest >= graph->number) {
+    if (cur < 0 || dest < 0 || cur >= graph->number || dest >= graph->number) {
         return -1;
     }
 
     list = graph->vex_list;
     vertex = list + cur;
+
+    if (GRAPH_VERTEX_IS_REMOVED(vertex) || GRAPH_VERTEX_IS_REMOVED(list + dest)) {
+        return -1;
+    }
+
     node = vertex->head;
 
     for (; node != NULL && node != vertex->tail; node = node->next) {
@@ -154,6 +289,8 @@ int graph_set_adjacent(GRAPH *graph, int cur, int dest)
     }
 
     vertex->count++;
+    list[dest].in_count++;
+    graph->edges++;
     return 0;
 }
 
@@ -182,8 +319,177 @@ void graph_clear_adjacent(GRAPH *graph)
             node = tmp;
         }
 
+        list[index].head = NULL;
+        list[index].tail = NULL;
         list[index].count = 0;
+        list[index].in_count = 0;
     }
+
+    graph->edges = 0;
+    graph->stale = 0;
+}
+
+/**
+ * 从顶点 vertex 的邻接表中摘除 node，prev 为 node 的前驱，node 为头结点时 prev 为 NULL，
+ * 返回 node 的后继
+ */
+static GRAPH_ADJTEX *graph_unlink_adjacent(
+    GRAPH *graph, GRAPH_VERTEX *vertex, GRAPH_ADJTEX *prev, GRAPH_ADJTEX *node)
+{
+    GRAPH_ADJTEX *next = node->next;
+
+    if (prev) {
+        prev->next = next;
+    } else {
+        vertex->head = next;
+    }
+
+    if (vertex->tail == node) {
+        vertex->tail = prev;
+    }
+
+    vertex->count--;
+    graph->edges--;
+
+    free(node);
+    return next;
+}
+
+int graph_remove_adjacent(GRAPH *graph, int cur, int dest)
+{
+    GRAPH_VERTEX *list = NULL;
+    GRAPH_VERTEX *vertex = NULL;
+    GRAPH_ADJTEX *prev = NULL;
+    GRAPH_ADJTEX *node = NULL;
+
+    if (!graph) {
+        return -1;
+    }
+
+    if (cur < 0 || dest < 0 || cur >= graph->number || dest >= graph->number) {
+        return -1;
+    }
+
+    list = graph->vex_list;
+    vertex = list + cur;
+
+    if (GRAPH_VERTEX_IS_REMOVED(vertex) || GRAPH_VERTEX_IS_REMOVED(list + dest)) {
+        return -1;
+    }
+
+    node = vertex->head;
+
+    /* 查找目标邻接点，顺便摘除途经的失效邻接点 */
+    while (node) {
+        if (node->index == dest) {
+            graph_unlink_adjacent(graph, vertex, prev, node);
+            list[dest].in_count--;
+            return 0;
+        }
+
+        if (GRAPH_VERTEX_IS_REMOVED(list + node->index)) {
+            node = graph_unlink_adjacent(graph, vertex, prev, node);
+            graph->stale--;
+        } else {
+            prev = node;
+            node = node->next;
+        }
+    }
+
+    return -1;
+}
+
+int graph_remove_vertex(GRAPH *graph, int index, void **data)
+{
+    GRAPH_VERTEX *list = NULL;
+    GRAPH_VERTEX *vertex = NULL;
+    GRAPH_ADJTEX *node = NULL;
+
+    if (!graph) {
+        return -1;
+    }
+
+    if (index < 0 || index >= graph->number) {
+        return -1;
+    }
+
+    list = graph->vex_list;
+    vertex = list + index;
+
+    if (GRAPH_VERTEX_IS_REMOVED(vertex)) {
+        return -1;
+    }
+
+    /* 释放顶点自身的邻接表，同时维护邻接点的入度 */
+    node = vertex->head;
+    while (node) {
+        GRAPH_VERTEX *adj = list + node->index;
+
+        if (GRAPH_VERTEX_IS_REMOVED(adj)) {
+            graph->stale--;
+        } else {
+            adj->in_count--;
+        }
+        node = graph_unlink_adjacent(graph, vertex, NULL, node);
+    }
+
+    /**
+     * 指向该顶点的邻接点分散在其他顶点的邻接表中，这里只记录数量而不去查找，遍历时跳过；
+     * 当失效邻接点在整个图中占比足够大时才统一清理，这样每次清理的开销都能分摊到之前的
+     * 删除操作上。
+     */
+    graph->stale += vertex->in_count;
+    graph->removed++;
+
+    if (graph->index) {
+        graph_index_erase(graph, index);
+    }
+
+    vertex->in_count = 0;
+    vertex->flag |= GRAPH_VERTEX_REMOVED;
+
+    if (data) {
+        *data = vertex->data;
+    }
+    vertex->data = NULL;
+
+    if (graph->stale >= GRAPH_COMPACT_MIN &&
+        graph->stale * 4 >= graph->number + graph->edges) {
+        graph_compact(graph);
+    }
+
+    return 0;
+}
+
+void graph_compact(GRAPH *graph)
+{
+    GRAPH_VERTEX *list = NULL;
+
+    int index = 0;
+    int count = 0;
+
+    if (!graph || !graph->stale) {
+        return;
+    }
+
+    list = graph->vex_list;
+
+    for (count = graph->number; index < count; index++) {
+        GRAPH_VERTEX *vertex = list + index;
+        GRAPH_ADJTEX *prev = NULL;
+        GRAPH_ADJTEX *node = vertex->head;
+
+        while (node) {
+            if (GRAPH_VERTEX_IS_REMOVED(list + node->index)) {
+                node = graph_unlink_adjacent(graph, vertex, prev, node);
+            } else {
+                prev = node;
+                node = node->next;
+            }
+        }
+    }
+
+    graph->stale = 0;
 }
 
 /**
@@ -218,6 +524,10 @@ void graph_print(GRAPH *graph, const char *(*get_print_content)(void *))
     for (count = graph->number; index < count; index++) {
         int i = 1;
 
+        if (GRAPH_VERTEX_IS_REMOVED(list + index)) {
+            continue;
+        }
+
         node = list[index].head;
 
         printf("第 %d 个节点，地址 %p \n", index + 1, list + index);
@@ -231,12 +541,16 @@ void graph_print(GRAPH *graph, const char *(*get_print_content)(void *))
 
         if (!get_print_content) {
             while (node) {
-                printf("        (%d) index = %d, %p\n", i++, node->index, node);
+                if (!GRAPH_VERTEX_IS_REMOVED(list + node->index)) {
+                    printf("        (%d) index = %d, %p\n", i++, node->index, node);
+                }
                 node = node->next;
             }
         } else {    
             while (node) {
-                printf("        (%d) index = %d, %s, %p\n", i++, node->index, get_print_content(list[node->index].data), node);
+                if (!GRAPH_VERTEX_IS_REMOVED(list + node->index)) {
+                    printf("        (%d) index = %d, %s, %p\n", i++, node->index, get_print_content(list[node->index].data), node);
+                }
                 node = node->next;
             }
         }
@@ -287,6 +601,37 @@ void graph_bfs_tree_destroy(GRAPH_BFS_TREE *tree)
     }
 }
 
+/**
+ * 使搜索树的节点数量与图的顶点数量一致，图在建树之后插入的顶点会被追加为未发现的节点；
+ * reset 不为 0 时重置所有节点
+ */
+static int graph_bfs_tree_fit(const GRAPH *graph, GRAPH_BFS_TREE *tree, int reset)
+{
+    GRAPH_BFS_NODE *nodes = tree->nodes;
+    int i = reset ? 0 : tree->count;
+    int j = graph->number;
+
+    if (j > tree->count) {
+        nodes = realloc(nodes, j * sizeof(GRAPH_BFS_NODE));
+        if (!nodes) {
+            return -1;
+        }
+        tree->nodes = nodes;
+    }
+
+    for (; i < j; i++) {
+        nodes[i].index = i;
+        nodes[i].parent = -1;
+        nodes[i].distances = -1;
+        nodes[i].color = GRAPH_BFS_COLOR_WHITE;
+    }
+
+    if (j > tree->count) {
+        tree->count = j;
+    }
+    return 0;
+}
+
 int graph_bfs(const GRAPH *graph, GRAPH_BFS_TREE *tree, int src)
 {
     GRAPH_BFS_NODE *nodes = NULL;
@@ -303,6 +648,15 @@ int graph_bfs(const GRAPH *graph, GRAPH_BFS_TREE *tree, int src)
         return -1;
     }
 
+    if (src < 0 || src >= graph->number || GRAPH_VERTEX_IS_REMOVED(graph->vex_list + src)) {
+        return -1;
+    }
+
+    /* 每次都从头搜索，先重置搜索树 */
+    if (graph_bfs_tree_fit(graph, tree, 1)) {
+        return -1;
+    }
+
     vlist = graph->vex_list;
     nodes = tree->nodes;
     nodes[src].color = GRAPH_BFS_COLOR_GRAY;
@@ -340,7 +694,8 @@ int graph_bfs(const GRAPH *graph, GRAPH_BFS_TREE *tree, int src)
             int index = adj->index;
             GRAPH_BFS_NODE *node = nodes + index;
 
-            if (node->color == GRAPH_BFS_COLOR_WHITE) {
+            /* 跳过指向已删除顶点的失效邻接点 */
+            if (node->color == GRAPH_BFS_COLOR_WHITE && !GRAPH_VERTEX_IS_REMOVED(vlist + index)) {
                 node->color = GRAPH_BFS_COLOR_GRAY;
                 node->distances = nodes[u].distances + 1;
                 node->parent = u;
@@ -358,6 +713,227 @@ int graph_bfs(const GRAPH *graph, GRAPH_BFS_TREE *tree, int src)
     return 0;
 }
 
+/* 增量搜索的起点，记录入列时的距离 */
+typedef struct graph_bfs_seed_st
+{
+    int index;
+    int distances;
+} GRAPH_BFS_SEED;
+
+static int graph_bfs_seed_compare(const void *a, const void *b)
+{
+    return ((const GRAPH_BFS_SEED *)a)->distances - ((const GRAPH_BFS_SEED *)b)->distances;
+}
+
+int graph_bfs_update(const GRAPH *graph, GRAPH_BFS_TREE *tree, const GRAPH_EDGE *edges, int num)
+{
+    GRAPH_BFS_NODE *nodes = NULL;
+    GRAPH_VERTEX *vlist = NULL;
+    GRAPH_BFS_SEED *seeds = NULL;
+
+    int *buf = NULL;
+    int seed_num = 0;
+    int spos = 0;
+    int i = 0;
+
+    GRAPH_QUEUE queue = {
+        NULL, 0, 0, 0
+    };
+
+    if (!graph || !tree || (num > 0 && !edges)) {
+        return -1;
+    }
+
+    if (num <= 0) {
+        return 0;
+    }
+
+    /* 建树之后插入的顶点一定未被发现 */
+    if (graph_bfs_tree_fit(graph, tree, 0)) {
+        return -1;
+    }
+
+    vlist = graph->vex_list;
+    nodes = tree->nodes;
+
+    seeds = malloc(num * sizeof(GRAPH_BFS_SEED));
+    if (!seeds) {
+        return -1;
+    }
+
+    /* 只有新边使终点距离变短时，终点才作为起点继续向外传播 */
+    for (; i < num; i++) {
+        int u = edges[i].from;
+        int v = edges[i].to;
+
+        if (u < 0 || v < 0 || u >= graph->number || v >= graph->number) {
+            continue;
+        }
+
+        if (GRAPH_VERTEX_IS_REMOVED(vlist + u) || GRAPH_VERTEX_IS_REMOVED(vlist + v)) {
+            continue;
+        }
+
+        if (nodes[u].distances < 0) {
+            continue;
+        }
+
+        if (nodes[v].distances < 0 || nodes[u].distances + 1 < nodes[v].distances) {
+            nodes[v].distances = nodes[u].distances + 1;
+            nodes[v].parent = u;
+            nodes[v].color = GRAPH_BFS_COLOR_BLACK;
+
+            seeds[seed_num].index = v;
+            seeds[seed_num].distances = nodes[v].distances;
+            seed_num++;
+        }
+    }
+
+    if (!seed_num) {
+        free(seeds);
+        return 0;
+    }
+
+    /* 每个顶点最多进入队列一次，队列不需要初始化 */
+    buf = malloc(sizeof(int) * graph->number);
+    if (!buf) {
+        free(seeds);
+        return -1;
+    }
+
+    queue.elems = buf;
+    queue.hpos = 0;
+    queue.num = 0;
+    queue.size = graph->number;
+
+    qsort(seeds, seed_num, sizeof(GRAPH_BFS_SEED), graph_bfs_seed_compare);
+
+    /**
+     * 起点按距离排序后与队列归并，保证顶点按距离非递减的顺序出列，每个顶点的距离一经出列
+     * 就不会再变短，所以受影响的顶点只会被处理一次。
+     */
+    while (spos < seed_num || queue.num > 0) {
+        GRAPH_ADJTEX *adj = NULL;
+        int u = 0;
+
+        if (spos < seed_num && (!queue.num ||
+            seeds[spos].distances <= nodes[graph_queue_head(&queue)].distances)) {
+            u = seeds[spos].index;
+
+            /* 距离在入列后又被缩短过，以更短的那一次为准 */
+            if (nodes[u].distances != seeds[spos++].distances) {
+                continue;
+            }
+        } else {
+            u = graph_queue_head(&queue);
+            graph_queue_dequeue(&queue);
+        }
+
+        adj = vlist[u].head;
+        while (adj) {
+            int index = adj->index;
+            GRAPH_BFS_NODE *node = nodes + index;
+
+            if (!GRAPH_VERTEX_IS_REMOVED(vlist + index) &&
+                (node->distances < 0 || nodes[u].distances + 1 < node->distances)) {
+                node->distances = nodes[u].distances + 1;
+                node->parent = u;
+                node->color = GRAPH_BFS_COLOR_BLACK;
+                graph_queue_enqueue(&queue, index);
+            }
+            adj = adj->next;
+        }
+    }
+
+    free(buf);
+    free(seeds);
+    return 0;
+}
+
+int graph_bfs_distance(const GRAPH_BFS_TREE *tree, int index)
+{
+    if (!tree || index < 0 || index >= tree->count) {
+        return -1;
+    }
+    return tree->nodes[index].distances;
+}
+
+int graph_bfs_parent(const GRAPH_BFS_TREE *tree, int index)
+{
+    if (!tree || index < 0 || index >= tree->count) {
+        return -1;
+    }
+    return tree->nodes[index].parent;
+}
+
+/* 沿父结点从终点回溯，从后向前写入 len 个顶点 */
+static void graph_bfs_fill_path(const GRAPH_BFS_NODE *nodes, int dest, int *path, int len)
+{
+    while (len > 0) {
+        path[--len] = dest;
+        dest = nodes[dest].parent;
+    }
+}
+
+int graph_bfs_path(const GRAPH_BFS_TREE *tree, int dest, int *path, int size)
+{
+    int len = 0;
+
+    if (!tree || !path || dest < 0 || dest >= tree->count) {
+        return -1;
+    }
+
+    /* 距离已知，路径长度无需回溯即可确定 */
+    len = tree->nodes[dest].distances + 1;
+    if (len <= 0 || len > size) {
+        return -1;
+    }
+
+    graph_bfs_fill_path(tree->nodes, dest, path, len);
+    return len;
+}
+
+int graph_bfs_paths(
+    const GRAPH_BFS_TREE *tree,
+    const int *dests,
+    int num,
+    int *path,
+    int size,
+    int *offsets)
+{
+    int total = 0;
+    int i = 0;
+
+    if (!tree || !dests || !path || !offsets || num < 0) {
+        return -1;
+    }
+
+    /* 先计算所有路径的位置，空间不足时不写入任何数据 */
+    for (; i < num; i++) {
+        int dest = dests[i];
+
+        offsets[i] = total;
+        if (dest >= 0 && dest < tree->count && tree->nodes[dest].distances >= 0) {
+            total += tree->nodes[dest].distances + 1;
+        }
+    }
+    offsets[num] = total;
+
+    if (total > size) {
+        return -1;
+    }
+
+    for (i = 0; i < num; i++) {
+        int len = offsets[i + 1] - offsets[i];
+
+        if (len > 0) {
+            graph_bfs_fill_path(tree->nodes, dests[i], path + offsets[i], len);
+        }
+    }
+
+    return total;
+}
+
 /* 打印路径 */
 static void graph_print_path(
     GRAPH *graph,
@@ -504,7 +1080,7 @@ static int graph_dfs_visit(
         int cur = next->index;
         GRAPH_DFS_NODE *tmp = nodes + cur;
 
-        if (tmp->color == GRAPH_BFS_COLOR_WHITE) {
+        if (tmp->color == GRAPH_BFS_COLOR_WHITE && !GRAPH_VERTEX_IS_REMOVED(graph->vex_list + cur)) {
             tmp->parent = index;
 
             /* 继续查找邻接点的邻接点，依次递归进去 */
@@ -527,6 +1103,34 @@ static int graph_dfs_visit(
     return 0;
 }
 
+/* 重置深度优先搜索森林，图在建森林之后插入的顶点会被追加进来 */
+static int graph_dfs_forest_reset(const GRAPH *graph, GRAPH_DFS_FOREST *forest)
+{
+    GRAPH_DFS_NODE *nodes = forest->nodes;
+    int i = 0;
+    int j = graph->number;
+
+    if (j > forest->count) {
+        nodes = realloc(nodes, j * sizeof(GRAPH_DFS_NODE));
+        if (!nodes) {
+            return -1;
+        }
+        forest->nodes = nodes;
+        forest->count = j;
+    }
+
+    for (j = forest->count; i < j; i++) {
+        GRAPH_DFS_NODE *node = nodes + i;
+        node->index = i;
+        node->parent = -1;
+        node->color = GRAPH_BFS_COLOR_WHITE;
+        node->ts_find = 0;
+        node->ts_ok = 0;
+    }
+
+    return 0;
+}
+
 int graph_dfs(
     const GRAPH *graph,
     GRAPH_DFS_FOREST *forest,
@@ -543,12 +1147,17 @@ int graph_dfs(
         return -1;
     }
 
+    /* 每次都从头搜索，先重置森林 */
+    if (graph_dfs_forest_reset(graph, forest)) {
+        return -1;
+    }
+
     forest->time = 0;
     nodes = forest->nodes;
 
     for (count = forest->count; i < count; i++) {
         GRAPH_DFS_NODE *node = nodes + i;
-        if (node->color == GRAPH_BFS_COLOR_WHITE) {
+        if (node->color == GRAPH_BFS_COLOR_WHITE && !GRAPH_VERTEX_IS_REMOVED(graph->vex_list + i)) {
             if (graph_dfs_visit(graph, forest, i, visit_node_before, visit_node_after, args) != 0) {
                 return -1;
             }
@@ -558,5 +1167,47 @@ int graph_dfs(
     return 0;
 }
 
+int graph_index_lookup(const GRAPH *graph, const void *data, unsigned int hash)
+{
+    GRAPH_INDEX *index = graph->index;
+    unsigned int pos = hash & index->mask;
+    int slot = 0;
+
+    while ((slot = index->slots[pos]) != GRAPH_INDEX_EMPTY) {
+        if (slot >= 0 && index->hashes[pos] == hash &&
+            !index->compare(graph->vex_list[slot].data, data)) {
+            return (int)pos;
+        }
+        pos = (pos + 1) & index->mask;
+    }
+
+    return -1;
+}
+
+void graph_index_insert(GRAPH *graph, int index, unsigned int hash)
+{
+    GRAPH_INDEX *table = graph->index;
+    unsigned int pos = hash & table->mask;
+
+    /* 已删除的槽可以直接复用 */
+    while (table->slots[pos] >= 0) {
+        pos = (pos + 1) & table->mask;
+    }
+
+    table->slots[pos] = index;
+    table->hashes[pos] = hash;
+}
+
+void graph_index_erase(GRAPH *graph, int index)
+{
+    GRAPH_INDEX *table = graph->index;
+    const void *data = graph->vex_list[index].data;
+    int pos = graph_index_lookup(graph, data, table->hash(data));
+
+    if (pos >= 0 && table->slots[pos] == index) {
+        table->slots[pos] = GRAPH_INDEX_DELETED;
+    }
+}
+
 /* 实现顶点队列 */
 QUEUE_IMPLEMENT(graph, GRAPH, int, 0);
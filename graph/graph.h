@@ -53,6 +53,10 @@
 
 typedef struct graph_vertex_st GRAPH_VERTEX;
 typedef struct graph_adjvex_st GRAPH_ADJTEX;
+typedef struct graph_index_st GRAPH_INDEX;
+
+/* 顶点已被删除（墓碑标记），其索引不会被复用 */
+#define GRAPH_VERTEX_REMOVED 0x00000001
 
 /* 邻接顶点 */
 struct graph_adjvex_st
@@ -74,6 +78,12 @@ struct graph_vertex_st
     /* 邻接顶点数量 */
     int count;
 
+    /* 指向该顶点的邻接点数量（入度） */
+    int in_count;
+
+    /* 顶点标记 */
+    int flag;
+
     /* 顶点数据 */
     void *data;
 };
@@ -88,8 +98,27 @@ typedef struct graph_st
 
     /* 顶点最大数量 */
     int max_num;
+
+    /* 邻接点总数，包含尚未清理的失效邻接点 */
+    int edges;
+
+    /* 指向已删除顶点、尚未清理的失效邻接点数量 */
+    int stale;
+
+    /* 已删除的顶点数量 */
+    int removed;
+
+    /* 顶点数据到顶点索引的散列索引，未创建时为 NULL */
+    GRAPH_INDEX *index;
 } GRAPH;
 
+/* 边，由起点 from 指向终点 to */
+typedef struct graph_edge_st
+{
+    int from;
+    int to;
+} GRAPH_EDGE;
+
 /* 广度优先搜索树节点 */
 typedef struct graph_bfs_node_st GRAPH_BFS_NODE;
 
@@ -108,15 +137,46 @@ GRAPH *graph_create(int size);
 /* 销毁图 */
 void graph_destroy(GRAPH *graph);
 
-/* 插入顶点，成功返回顶点索引，失败返回 -1 */
+/* 插入顶点，成功返回顶点索引，失败返回 -1；创建了散列索引时，数据重复也返回 -1 */
 int graph_push_data(GRAPH *graph, void *data);
 
+/**
+ * 为顶点数据创建散列索引，此后 graph_push_data 和 graph_remove_vertex 会自动维护索引
+ * 
+ * hash -- 计算顶点数据的散列值
+ * compare -- 比较两个顶点数据，相等返回 0
+ * 
+ * 已有顶点的数据存在重复时创建失败，成功返回 0，失败返回 -1
+ */
+int graph_create_index(
+    GRAPH *graph,
+    unsigned int (*hash)(const void *data),
+    int (*compare)(const void *a, const void *b)
+);
+
+/* 根据顶点数据查找顶点索引，不存在或者未创建索引返回 -1 */
+int graph_find_index(const GRAPH *graph, const void *data);
+
 /* 指定当前顶点的邻接点索引，成功返回 0， 失败返回 -1 */
 int graph_set_adjacent(GRAPH *graph, int cur, int dest);
 
 /* 清理邻接表 */
 void graph_clear_adjacent(GRAPH *graph);
 
+/* 移除当前顶点指向 dest 的邻接点，成功返回 0，失败返回 -1 */
+int graph_remove_adjacent(GRAPH *graph, int cur, int dest);
+
+/**
+ * 删除顶点，data 不为 NULL，返回顶点数据
+ * 
+ * 被删除的顶点只做墓碑标记，索引保持不变且不会被复用；其他顶点指向它的邻接点在遍历时被
+ * 跳过，累计到一定数量后再统一清理，因此删除的开销与被删除的边数成正比。
+ */
+int graph_remove_vertex(GRAPH *graph, int index, void **data);
+
+/* 立即清理所有指向已删除顶点的失效邻接点 */
+void graph_compact(GRAPH *graph);
+
 /* 打印所有的邻接点 */
 void graph_print(GRAPH *graph, const char *(*get_print_content)(void *));
 
@@ -126,9 +186,47 @@ GRAPH_BFS_TREE *graph_bfs_tree_create(const GRAPH *graph);
 /* 销毁广度优先搜索树 */
 void graph_bfs_tree_destroy(GRAPH_BFS_TREE *tree);
 
-/* 从 src 开始执行广度优先搜索 */
+/* 从 src 开始执行广度优先搜索，搜索前会重置搜索树 */
 int graph_bfs(const GRAPH *graph, GRAPH_BFS_TREE *tree, int src);
 
+/**
+ * 增量维护广度优先搜索树
+ * 
+ * edges 中的 num 条边已经通过 graph_set_adjacent 加入图中，tree 是加边之前由 graph_bfs 
+ * 生成的搜索树。函数只从距离变短的顶点开始向外传播，修正受影响顶点的父结点和距离，开销
+ * 与受影响的区域成正比。成功返回 0，失败返回 -1。
+ */
+int graph_bfs_update(const GRAPH *graph, GRAPH_BFS_TREE *tree, const GRAPH_EDGE *edges, int num);
+
+/* 获取顶点到源点的距离，不可达返回 -1 */
+int graph_bfs_distance(const GRAPH_BFS_TREE *tree, int index);
+
+/* 获取顶点在搜索树中的父结点，源点或不可达返回 -1 */
+int graph_bfs_parent(const GRAPH_BFS_TREE *tree, int index);
+
+/**
+ * 将源点到 dest 的路径写入 path，path[0] 为源点，最后一个元素为 dest
+ * 
+ * 路径包含 graph_bfs_distance(tree, dest) + 1 个顶点，成功返回路径的顶点数，不可达或者
+ * size 不足返回 -1
+ */
+int graph_bfs_path(const GRAPH_BFS_TREE *tree, int dest, int *path, int size);
+
+/**
+ * 批量获取源点到 dests 中 num 个目标点的路径，依次写入 path
+ * 
+ * 第 i 条路径位于 path[offsets[i]] 到 path[offsets[i + 1] - 1]，offsets 至少包含 num + 1 个
+ * 元素；不可达的目标点对应空路径。成功返回写入的顶点总数，size 不足返回 -1
+ */
+int graph_bfs_paths(
+    const GRAPH_BFS_TREE *tree,
+    const int *dests,
+    int num,
+    int *path,
+    int size,
+    int *offsets
+);
+
 /* 广度优先搜索并打印源点到目标点的路径信息 */
 void graph_bfs_print(GRAPH *graph, int src, int dest, const char *(*get_print_content)(void *));
 
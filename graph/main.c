@@ -6,12 +6,31 @@ extern void test_bfs();
 /* 深度优先搜索测试 */
 extern void test_dfs();
 
+/* 删除顶点和边，清理后检查邻接表和遍历结果 */
+extern int test_remove();
+
+/* 插入边后增量维护广度优先搜索树，与重新搜索的结果比较 */
+extern int test_bfs_update();
+
+/* 按顶点数据查找顶点索引，包括删除顶点和清理之后 */
+extern int test_index();
+
+/* 批量获取多个目标点的路径，包括不可达的目标点 */
+extern int test_bfs_paths();
+
 int main(int argc, char *argv[]) 
 {
+    int failed = 0;
+
 #if 0
     test_bfs();
 #else
     test_dfs();
 #endif
-    return 0;
+
+    failed += test_remove();
+    failed += test_bfs_update();
+    failed += test_index();
+    failed += test_bfs_paths();
+    return failed ? 1 : 0;
 }
@@ -88,6 +88,15 @@ int input_int(const char *hint, int def);
 /* 显示城市列表 */
 void show_city_list();
 
+/* 从 src 开始的搜索树与重新执行 graph_bfs 的结果一致，父结点必须是一条最短路径上的前驱 */
+int check_bfs_tree(const GRAPH *graph, const GRAPH_BFS_TREE *tree, int src);
+
+/* 判断 cur 的邻接表中是否有指向 dest 的有效邻接点 */
+int has_adjacent(const GRAPH *graph, int cur, int dest);
+
+/* 打印检查结果，失败返回 1 */
+int report_check(const char *name, int ok);
+
 const char *print_address(void *data)
 {
     return (const char *)data;
@@ -122,6 +131,359 @@ void test_bfs()
     graph_destroy(graph);
 }
 
+/* 记录深度优先搜索结束访问的顺序 */
+static void record_finish(void *args, int index)
+{
+    int *order = args;
+
+    order[++order[0]] = index;
+}
+
+/**
+ * 删除顶点和边
+ * 
+ * 删除郑州、济南两个顶点以及北京到石家庄的边，立即清理失效的邻接点。其余顶点的索引不变，
+ * 邻接表、入度和遍历结果都与不含这些顶点和边、重新构建的图一致。
+ */
+int test_remove()
+{
+    GRAPH *graph = graph_create(0);
+    GRAPH *expect = graph_create(0);
+    GRAPH_BFS_TREE *tree = NULL;
+    GRAPH_BFS_TREE *fresh = NULL;
+    GRAPH_ADJTEX *node = NULL;
+    GRAPH_ADJTEX *other = NULL;
+    void *data = NULL;
+
+    int order[64] = { 0 };
+    int expect_order[64] = { 0 };
+    int ok = 1;
+    int i = 0;
+    int j = 0;
+
+    build_geography_data(graph);
+
+    for (i = 0; i < graph->number; i++) {
+        graph_push_data(expect, graph->vex_list[i].data);
+    }
+
+    /* 参照图不含被删除的边，被删除的顶点作为孤立顶点保留，使其余顶点的索引相同 */
+    for (i = 0; i < graph->number; i++) {
+        for (node = graph->vex_list[i].head; node; node = node->next) {
+            if (i == 3 || i == 22 || node->index == 3 || node->index == 22 || (i == 0 && node->index == 1)) {
+                continue;
+            }
+            graph_set_adjacent(expect, i, node->index);
+        }
+    }
+
+    ok &= !graph_remove_adjacent(graph, 0, 1);
+    ok &= graph_remove_adjacent(graph, 0, 1) < 0;
+    ok &= !graph_remove_vertex(graph, 3, &data) && data == zhengzhou;
+    ok &= !graph_remove_vertex(graph, 22, NULL);
+    ok &= graph_remove_vertex(graph, 22, NULL) < 0;
+    ok &= graph->stale > 0;
+
+    graph_compact(graph);
+    ok &= !graph->stale && graph->number == expect->number && graph->edges == expect->edges;
+
+    for (i = 0; ok && i < graph->number; i++) {
+        GRAPH_VERTEX *vertex = graph->vex_list + i;
+
+        if (i == 3 || i == 22) {
+            ok &= (vertex->flag & GRAPH_VERTEX_REMOVED) && !vertex->head && !vertex->count;
+            continue;
+        }
+
+        ok &= vertex->data == expect->vex_list[i].data;
+        ok &= vertex->count == expect->vex_list[i].count && vertex->in_count == expect->vex_list[i].in_count;
+
+        /* 清理保持邻接点原来的顺序 */
+        other = expect->vex_list[i].head;
+        for (node = vertex->head; ok && node; node = node->next, other = other->next) {
+            ok &= other && node->index == other->index;
+        }
+        ok &= !other;
+    }
+
+    tree = graph_bfs_tree_create(graph);
+    fresh = graph_bfs_tree_create(expect);
+
+    for (i = 0; ok && tree && fresh && i < graph->number; i++) {
+        if (i == 3 || i == 22) {
+            ok &= graph_bfs(graph, tree, i) < 0;
+            continue;
+        }
+
+        ok &= !graph_bfs(graph, tree, i) && !graph_bfs(expect, fresh, i);
+        for (j = 0; ok && j < graph->number; j++) {
+            ok &= graph_bfs_distance(tree, j) == graph_bfs_distance(fresh, j);
+        }
+        ok &= check_bfs_tree(graph, tree, i);
+    }
+    ok &= tree && fresh;
+
+    graph_bfs_tree_destroy(tree);
+    graph_bfs_tree_destroy(fresh);
+
+    /* 深度优先搜索跳过被删除的顶点，参照图中它们是单独的树 */
+    if (ok) {
+        GRAPH_DFS_FOREST *forest = graph_dfs_forest_create(graph);
+        GRAPH_DFS_FOREST *expect_forest = graph_dfs_forest_create(expect);
+
+        ok &= forest && expect_forest;
+        ok &= ok && !graph_dfs(graph, forest, NULL, record_finish, order);
+        ok &= ok && !graph_dfs(expect, expect_forest, NULL, record_finish, expect_order);
+
+        for (i = 1, j = 1; ok && j <= expect_order[0]; j++) {
+            if (expect_order[j] != 3 && expect_order[j] != 22) {
+                ok &= i <= order[0] && order[i++] == expect_order[j];
+            }
+        }
+        ok &= i == order[0] + 1;
+
+        graph_dfs_forest_destroy(forest);
+        graph_dfs_forest_destroy(expect_forest);
+    }
+
+    graph_clear_adjacent(graph);
+    graph_destroy(graph);
+    graph_clear_adjacent(expect);
+    graph_destroy(expect);
+    return report_check("删除顶点和边", ok);
+}
+
+/**
+ * 增量维护广度优先搜索树
+ * 
+ * 从每个城市出发建树，之后分批插入伪随机的边（包括到达原来不可达顶点的边和新插入的顶点），
+ * 每批调用 graph_bfs_update 修正搜索树，结果与重新执行 graph_bfs 一致。
+ */
+int test_bfs_update()
+{
+    GRAPH_EDGE edges[4];
+    unsigned int seed = 12345;
+    int ok = 1;
+    int src = 0;
+    int round = 0;
+    int i = 0;
+
+    for (; ok && src < 35; src++) {
+        GRAPH *graph = graph_create(0);
+        GRAPH_BFS_TREE *tree = NULL;
+
+        build_geography_data(graph);
+
+        /* 新插入的顶点在建树之后才出现 */
+        graph_push_data(graph, (void *)"新城");
+
+        tree = graph_bfs_tree_create(graph);
+        ok &= tree && !graph_bfs(graph, tree, src);
+
+        for (round = 0; ok && round < 8; round++) {
+            int num = 0;
+
+            for (i = 0; i < 4; i++) {
+                seed = seed * 1103515245 + 12345;
+                edges[num].from = (seed >> 8) % graph->number;
+                edges[num].to = (seed >> 20) % graph->number;
+
+                if (edges[num].from != edges[num].to &&
+                    !graph_set_adjacent(graph, edges[num].from, edges[num].to)) {
+                    num++;
+                }
+            }
+
+            ok &= !graph_bfs_update(graph, tree, edges, num);
+            ok &= check_bfs_tree(graph, tree, src);
+        }
+
+        graph_bfs_tree_destroy(tree);
+        graph_clear_adjacent(graph);
+        graph_destroy(graph);
+    }
+
+    return report_check("增量维护搜索树", ok);
+}
+
+/* 字符串的 FNV-1a 散列 */
+static unsigned int hash_address(const void *data)
+{
+    const unsigned char *str = data;
+    unsigned int hash = 2166136261u;
+
+    while (*str) {
+        hash = (hash ^ *str++) * 16777619u;
+    }
+    return hash;
+}
+
+static int compare_address(const void *a, const void *b)
+{
+    return strcmp(a, b);
+}
+
+/**
+ * 顶点数据的散列索引
+ * 
+ * 按城市名查找顶点索引；删除顶点和清理之后，被删除的城市查不到，其余城市的索引不变；
+ * 重新插入被删除的城市得到新的索引；已有重复数据时不能创建索引。
+ */
+int test_index()
+{
+    GRAPH *graph = graph_create(0);
+    GRAPH *dup = graph_create(0);
+    char name[STR_BUFF_MAX];
+    int ok = 1;
+    int i = 0;
+
+    build_geography_data(graph);
+    ok &= graph_find_index(graph, beijing) < 0;
+    ok &= !graph_create_index(graph, hash_address, compare_address);
+
+    /* 查找使用比较函数，不要求是同一个地址 */
+    for (i = 0; ok && city_list[i]; i++) {
+        snprintf(name, sizeof(name), "%s", city_list[i]);
+        ok &= graph_find_index(graph, name) == i;
+    }
+
+    ok &= graph_find_index(graph, "东京") < 0;
+    ok &= graph_push_data(graph, (void *)beijing) < 0;
+
+    ok &= !graph_remove_vertex(graph, 3, NULL) && !graph_remove_vertex(graph, 22, NULL);
+    ok &= graph_find_index(graph, zhengzhou) < 0 && graph_find_index(graph, jinan) < 0;
+
+    graph_compact(graph);
+
+    for (i = 0; ok && city_list[i]; i++) {
+        ok &= graph_find_index(graph, city_list[i]) == (i == 3 || i == 22 ? -1 : i);
+    }
+
+    i = graph_push_data(graph, (void *)zhengzhou);
+    ok &= i == 35 && graph_find_index(graph, zhengzhou) == i;
+
+    graph_push_data(dup, (void *)beijing);
+    graph_push_data(dup, (void *)beijing);
+    ok &= graph_create_index(dup, hash_address, compare_address) < 0;
+    ok &= graph_find_index(dup, beijing) < 0;
+
+    graph_destroy(dup);
+    graph_clear_adjacent(graph);
+    graph_destroy(graph);
+    return report_check("顶点索引", ok);
+}
+
+/**
+ * 批量获取路径
+ * 
+ * 从北京出发，目标点包括源点自身、台北、重复的目标点、没有边的新顶点和越界的索引。
+ * 第 i 条路径位于 path[offsets[i]] 到 path[offsets[i + 1] - 1]，与 graph_bfs_path
+ * 逐条获取的结果相同，不可达的目标点对应空路径；空间不足时返回 -1 并且不写入路径。
+ */
+int test_bfs_paths()
+{
+    GRAPH *graph = graph_create(0);
+    GRAPH_BFS_TREE *tree = NULL;
+    int dests[] = { 0, 34, 21, -1, 34, 35, 100, 18 };
+    int num = sizeof(dests) / sizeof(int);
+    int offsets[sizeof(dests) / sizeof(int) + 1];
+    int path[256];
+    int single[64];
+    int total = 0;
+    int ok = 1;
+    int i = 0;
+    int j = 0;
+
+    build_geography_data(graph);
+
+    /* 没有任何边的顶点不可达 */
+    graph_push_data(graph, (void *)"新城");
+
+    tree = graph_bfs_tree_create(graph);
+    ok &= tree && !graph_bfs(graph, tree, 0);
+
+    total = ok ? graph_bfs_paths(tree, dests, num, path, sizeof(path) / sizeof(int), offsets) : -1;
+    ok &= total > 0 && offsets[0] == 0 && offsets[num] == total;
+
+    for (i = 0; ok && i < num; i++) {
+        int len = offsets[i + 1] - offsets[i];
+        int expect = graph_bfs_path(tree, dests[i], single, sizeof(single) / sizeof(int));
+
+        if (expect < 0) {
+            ok &= len == 0;
+            continue;
+        }
+
+        ok &= len == expect && len == graph_bfs_distance(tree, dests[i]) + 1;
+        ok &= path[offsets[i]] == 0 && path[offsets[i + 1] - 1] == dests[i];
+        for (j = 0; ok && j < len; j++) {
+            ok &= path[offsets[i] + j] == single[j];
+        }
+    }
+
+    /* 只有源点自身的路径长度为 1，不可达的目标点为空路径 */
+    ok &= offsets[1] - offsets[0] == 1;
+    ok &= offsets[4] == offsets[3] && offsets[6] == offsets[5] && offsets[7] == offsets[6];
+
+    /* 空间不足时不写入任何路径 */
+    path[0] = -2;
+    ok &= graph_bfs_paths(tree, dests, num, path, total - 1, offsets) < 0 && path[0] == -2;
+
+    /* 没有目标点时只写入 offsets[0] */
+    ok &= graph_bfs_paths(tree, dests, 0, path, 0, offsets) == 0 && offsets[0] == 0;
+
+    graph_bfs_tree_destroy(tree);
+    graph_clear_adjacent(graph);
+    graph_destroy(graph);
+    return report_check("批量获取路径", ok);
+}
+
+int check_bfs_tree(const GRAPH *graph, const GRAPH_BFS_TREE *tree, int src)
+{
+    GRAPH_BFS_TREE *fresh = graph_bfs_tree_create(graph);
+    int ok = fresh && !graph_bfs(graph, fresh, src);
+    int i = 0;
+
+    for (; ok && i < graph->number; i++) {
+        int distance = graph_bfs_distance(tree, i);
+        int parent = graph_bfs_parent(tree, i);
+
+        ok &= distance == graph_bfs_distance(fresh, i);
+
+        if (distance > 0) {
+            ok &= parent >= 0 && graph_bfs_distance(fresh, parent) == distance - 1;
+            ok &= has_adjacent(graph, parent, i);
+        } else {
+            ok &= parent == -1;
+        }
+    }
+
+    graph_bfs_tree_destroy(fresh);
+    return ok;
+}
+
+int has_adjacent(const GRAPH *graph, int cur, int dest)
+{
+    GRAPH_ADJTEX *node = graph->vex_list[cur].head;
+
+    if (graph->vex_list[dest].flag & GRAPH_VERTEX_REMOVED) {
+        return 0;
+    }
+
+    for (; node; node = node->next) {
+        if (node->index == dest) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int report_check(const char *name, int ok)
+{
+    printf("%-24s %s\n", name, ok ? "通过" : "失败");
+    return ok ? 0 : 1;
+}
+
 /* 构建地理信息 */
 void build_geography_data(GRAPH *graph)
 {
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rbtree.h"
+#include "rbshard.h"
+
+/**
+ * 红黑树性能测试：
+ *
+ * 1.生成 count 个互不相同的随机字符串键，以及同样数量不存在于树中的键；
+ * 2.计时依次插入所有键，以及拥有键时插入所有键；用 1 个线程和与处理器核数相同的线程（至少 2 个）
+ *   分别向分片映射插入所有键，对比写入的扩展性；
+ * 3.打乱顺序后计时查找所有存在的键和不存在的键，分别逐个查找和批量查找，以及开启布隆过滤器时
+ *   逐个查找；
+ * 4.计时将 1% 和 0.01% 的新键逐个插入和用 rb_union 合并到树中；
+ * 5.计时全量扫描求和，对比 rb_iterate 和 rb_reduce_parallel；
+ * 6.计时删除所有键；
+ * 7.将键排序后计时由有序数组直接构建红黑树，以及按顺序插入和查找。
+ *
+ * 用法：./bench [count] [seed]
+ */
+
+#define BENCH_DEFAULT_COUNT 1000000
+
+/* 键的格式为 16 位十六进制数，加上结尾的 0 */
+#define BENCH_KEY_SIZE 17
+
+/* 批量查找每批的键数 */
+#define BENCH_BATCH_SIZE 1024
+
+/* 增量合并的键数为总键数的 1 / BENCH_DELTA_RATIO，以及远小于树的 1 / BENCH_DELTA_SMALL_RATIO */
+#define BENCH_DELTA_RATIO       100
+#define BENCH_DELTA_SMALL_RATIO 10000
+
+/* 多线程插入时分片映射的分片数 */
+#define BENCH_SHARDS 64
+
+/* 多线程插入时每个线程负责的键 */
+typedef struct bench_shard_job_st
+{
+    RB_SHARD_MAP *map;
+    const char **keys;
+    int begin;
+    int end;
+} BENCH_SHARD_JOB;
+
+static unsigned long long bench_seed = 1;
+
+/* splitmix64 伪随机数 */
+static unsigned long long bench_random()
+{
+    unsigned long long z = (bench_seed += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double bench_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_shuffle(const char **keys, int count)
+{
+    int i = count - 1;
+
+    for (; i > 0; i--) {
+        int j = (int)(bench_random() % (unsigned long long)(i + 1));
+        const char *tmp = keys[i];
+
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+static int bench_compare_key(const void *a, const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* 全量扫描：累加每个键的首字节 */
+static void bench_scan_visit(void *key, void *data, void *args)
+{
+    *(unsigned long long *)args += *(unsigned char *)key;
+}
+
+static void *bench_scan_init(void *args)
+{
+    return calloc(1, sizeof(unsigned long long));
+}
+
+static void bench_scan_map(void *acc, void *key, void *data, void *args)
+{
+    *(unsigned long long *)acc += *(unsigned char *)key;
+}
+
+static void bench_scan_combine(void *acc, void *other, void *args)
+{
+    *(unsigned long long *)acc += *(unsigned long long *)other;
+    free(other);
+}
+
+static void *bench_shard_insert(void *args)
+{
+    BENCH_SHARD_JOB *job = args;
+    int i = job->begin;
+
+    for (; i < job->end; i++) {
+        rb_shard_insert(job->map, job->keys[i], (void *)job->keys[i]);
+    }
+    return NULL;
+}
+
+/* threads 个线程各自插入 keys 中连续的一段，返回耗时，失败返回负数 */
+static double bench_shard_run(const char **keys, int count, int threads)
+{
+    RB_SHARD_MAP *map = rb_shard_create(BENCH_SHARDS);
+    pthread_t *tids = malloc(threads * sizeof(pthread_t));
+    BENCH_SHARD_JOB *jobs = malloc(threads * sizeof(BENCH_SHARD_JOB));
+    double start = 0;
+    double elapsed = -1;
+    int i = 0;
+
+    if (map && tids && jobs) {
+        start = bench_now();
+        for (; i < threads; i++) {
+            jobs[i].map = map;
+            jobs[i].keys = keys;
+            jobs[i].begin = (int)((long long)count * i / threads);
+            jobs[i].end = (int)((long long)count * (i + 1) / threads);
+            pthread_create(&tids[i], NULL, bench_shard_insert, &jobs[i]);
+        }
+        for (i = 0; i < threads; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        elapsed = bench_now() - start;
+
+        if (rb_shard_count(map) != count) {
+            elapsed = -1;
+        }
+    }
+
+    rb_shard_destroy(map);
+    free(jobs);
+    free(tids);
+    return elapsed;
+}
+
+static void bench_report(const char *name, double elapsed, int count)
+{
+    printf("%-16s %10.3f 秒 %10.1f ns/op %12.0f op/s\n",
+        name, elapsed, elapsed * 1e9 / count, count / elapsed);
+}
+
+/* 将 count / ratio 个新键分别逐个插入和用 rb_union 合并到树中，计时之后删除 */
+static void bench_delta(RB_TREE *tree, const char **miss, int count, int ratio)
+{
+    RB_TREE *delta = NULL;
+    char name[64];
+    double start = 0;
+    int n = count / ratio > 0 ? count / ratio : 1;
+    int i = 0;
+
+    start = bench_now();
+    for (i = 0; i < n; i++) {
+        rb_insert(tree, miss[i], (void *)miss[i]);
+    }
+    snprintf(name, sizeof(name), "rb_insert (增量 1/%d)", ratio);
+    bench_report(name, bench_now() - start, n);
+
+    for (i = 0; i < n; i++) {
+        rb_delete(tree, miss[i], NULL);
+    }
+
+    delta = rb_create();
+    for (i = 0; i < n; i++) {
+        rb_insert(delta, miss[i], (void *)miss[i]);
+    }
+
+    start = bench_now();
+    rb_union(tree, delta, NULL, NULL);
+    snprintf(name, sizeof(name), "rb_union (增量 1/%d)", ratio);
+    bench_report(name, bench_now() - start, n);
+
+    for (i = 0; i < n; i++) {
+        rb_delete(tree, miss[i], NULL);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int count = BENCH_DEFAULT_COUNT;
+
+    RB_TREE *tree = NULL;
+    RB_TREE *delta = NULL;
+    char *buf = NULL;
+    const char **keys = NULL;
+    const char **miss = NULL;
+    void *data = NULL;
+    void **values = NULL;
+    void *result = NULL;
+    RB_STATS stats;
+    unsigned long long sum = 0;
+    char name[64];
+
+    double start = 0;
+    double elapsed = 0;
+    int threads = 0;
+    int found = 0;
+    int n = 0;
+    int i = 0;
+
+    if (argc > 1) {
+        count = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        bench_seed = strtoull(argv[2], NULL, 10);
+    }
+
+    if (count <= 0) {
+        fprintf(stderr, "用法：%s [count] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    /* 存在的键最低位为 0，不存在的键最低位为 1，两组键互不相同且在键空间中交错分布 */
+    buf = malloc(2 * (size_t)count * BENCH_KEY_SIZE);
+    keys = malloc(count * sizeof(char *));
+    miss = malloc(count * sizeof(char *));
+
+    for (; i < count; i++) {
+        char *key = buf + (size_t)i * BENCH_KEY_SIZE;
+        char *other = buf + ((size_t)count + i) * BENCH_KEY_SIZE;
+
+        snprintf(key, BENCH_KEY_SIZE, "%016llx", bench_random() & ~1ULL);
+        snprintf(other, BENCH_KEY_SIZE, "%016llx", bench_random() | 1ULL);
+        keys[i] = key;
+        miss[i] = other;
+    }
+
+    printf("键 %d 个\n", count);
+
+    tree = rb_create();
+
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        if (rb_insert(tree, keys[i], (void *)keys[i])) {
+            /* 随机键重复的概率极低，重复的键只在查找时计入未命中 */
+            keys[i] = miss[i];
+        }
+    }
+    bench_report("rb_insert", bench_now() - start, count);
+
+    /* 拥有键时插入同样的键，键被复制到树的键区域中 */
+    delta = rb_create_ex(RB_FLAG_OWN_KEYS);
+
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        rb_insert(delta, keys[i], (void *)keys[i]);
+    }
+    bench_report("rb_insert (拥有键)", bench_now() - start, count);
+
+    rb_destroy(delta);
+
+    /* 分片映射的写入扩展性，只有一个核时多个线程只能交替执行 */
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    printf("处理器核数 %d\n", threads);
+    threads = threads > 2 ? threads : 2;
+
+    for (i = 0; i < 2; i++) {
+        n = i ? threads : 1;
+        elapsed = bench_shard_run(keys, count, n);
+        snprintf(name, sizeof(name), "rb_shard_insert (%d 线程)", n);
+
+        if (elapsed < 0) {
+            printf("%s 失败\n", name);
+        } else {
+            bench_report(name, elapsed, count);
+        }
+    }
+
+    bench_shuffle(keys, count);
+
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        found += !rb_find(tree, keys[i], &data);
+    }
+    bench_report("rb_find (命中)", bench_now() - start, count);
+
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        found += !rb_find(tree, miss[i], &data);
+    }
+    bench_report("rb_find (未命中)", bench_now() - start, count);
+
+    printf("命中 %d 次\n", found);
+
+    /* 批量查找，每批 BENCH_BATCH_SIZE 个键 */
+    values = malloc(BENCH_BATCH_SIZE * sizeof(void *));
+    found = 0;
+
+    start = bench_now();
+    for (i = 0; i < count; i += BENCH_BATCH_SIZE) {
+        n = count - i < BENCH_BATCH_SIZE ? count - i : BENCH_BATCH_SIZE;
+        found += rb_find_batch(tree, keys + i, n, values);
+    }
+    bench_report("rb_find_batch (命中)", bench_now() - start, count);
+
+    start = bench_now();
+    for (i = 0; i < count; i += BENCH_BATCH_SIZE) {
+        n = count - i < BENCH_BATCH_SIZE ? count - i : BENCH_BATCH_SIZE;
+        found += rb_find_batch(tree, miss + i, n, values);
+    }
+    bench_report("rb_find_batch (未命中)", bench_now() - start, count);
+
+    printf("命中 %d 次\n", found);
+    free(values);
+
+    /* 同样的键插入开启布隆过滤器的树，未命中的查找大多不访问树；bench 与 rbtree.c 用同样的 CFLAGS 编译 */
+#if defined(__AVX2__)
+    printf("布隆过滤器探测 AVX2\n");
+#else
+    printf("布隆过滤器探测 标量，make bench CFLAGS=-mavx2 开启 AVX2\n");
+#endif
+    delta = rb_create_ex(RB_FLAG_BLOOM);
+    found = 0;
+
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        rb_insert(delta, keys[i], (void *)keys[i]);
+    }
+    bench_report("rb_insert (bloom)", bench_now() - start, count);
+
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        found += !rb_find(delta, keys[i], &data);
+    }
+    bench_report("rb_find (bloom, 命中)", bench_now() - start, count);
+
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        found += !rb_find(delta, miss[i], &data);
+    }
+    bench_report("rb_find (bloom, 未命中)", bench_now() - start, count);
+
+    /* 过滤器拦截的次数是计数器，需要定义 RBTREE_STAT */
+    rb_stats(delta, &stats);
+#ifdef RBTREE_STAT
+    printf("命中 %d 次 过滤器拦截 %llu 次 内存 %zu 字节\n", found, stats.bloom_rejects, stats.bytes);
+#else
+    printf("命中 %d 次 内存 %zu 字节\n", found, stats.bytes);
+#endif
+    rb_destroy(delta);
+
+    /* 树的形状和计数器，计数器需要定义 RBTREE_STAT */
+    rb_stats(tree, &stats);
+    printf("高度 %d 黑高 %d 内存 %zu 字节 查找 %llu 比较 %llu 旋转 %llu/%llu\n",
+        stats.height, stats.black_height, stats.bytes, stats.lookups, stats.compares,
+        stats.insert_rotations, stats.delete_rotations);
+
+    /* 将新键合并到树中，对比逐个插入和 rb_union，增量远小于树时 rb_union 直接插入较小的子树 */
+    bench_delta(tree, miss, count, BENCH_DELTA_RATIO);
+    bench_delta(tree, miss, count, BENCH_DELTA_SMALL_RATIO);
+
+    start = bench_now();
+    rb_iterate(tree, bench_scan_visit, &sum);
+    bench_report("rb_iterate", bench_now() - start, count);
+
+    start = bench_now();
+    rb_reduce_parallel(tree, 0, 0, bench_scan_init, bench_scan_map, bench_scan_combine, NULL, &result);
+    bench_report("rb_reduce_parallel", bench_now() - start, count);
+
+    printf("校验 %llu %llu\n", sum, result ? *(unsigned long long *)result : 0);
+    free(result);
+
+    bench_shuffle(keys, count);
+
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        rb_delete(tree, keys[i], NULL);
+    }
+    bench_report("rb_delete", bench_now() - start, count);
+
+    rb_destroy(tree);
+
+    /* 排序并去掉重复的键 */
+    qsort(keys, count, sizeof(char *), bench_compare_key);
+    for (i = 1, n = 1; i < count; i++) {
+        if (strcmp(keys[n - 1], keys[i])) {
+            keys[n++] = keys[i];
+        }
+    }
+
+    start = bench_now();
+    tree = rb_build_sorted(keys, NULL, n);
+    bench_report("rb_build_sorted", bench_now() - start, n);
+
+    rb_destroy(tree);
+
+    /* 按顺序插入和查找，对比从根结点开始和从最近访问的结点开始 */
+    for (i = 0; i < 2; i++) {
+        int j = 0;
+
+        tree = rb_create_ex(i ? RB_FLAG_FINGER : 0);
+
+        start = bench_now();
+        for (j = 0; j < n; j++) {
+            rb_insert(tree, keys[j], NULL);
+        }
+        bench_report(i ? "rb_insert (有序, finger)" : "rb_insert (有序)", bench_now() - start, n);
+
+        start = bench_now();
+        for (j = 0; j < n; j++) {
+            rb_find(tree, keys[j], &data);
+        }
+        bench_report(i ? "rb_find (有序, finger)" : "rb_find (有序)", bench_now() - start, n);
+
+        rb_destroy(tree);
+    }
+    free(miss);
+    free(keys);
+    free(buf);
+    return 0;
+}
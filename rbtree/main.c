@@ -1,9 +1,26 @@
 #include <stdio.h>
+#include <string.h>
 #include "rbtree.h"
+#include "rbshard.h"
+#include "rbpersist.h"
+#include "rbmmap.h"
+#include "rbwal.h"
+#include "rblsm.h"
+#include "rbtree_tpl.h"
+
+/* 以整数为键的模板红黑树 */
+RB_DEFINE(imap, IMAP, long, const char *)
+RB_IMPLEMENT(imap, IMAP, long, const char *, RB_COMPARE_NUM)
 
 /* 打印树信息 */
 static void visit_tree(void *key, void *data, void *args);
 
+/* 打印文件中的树 */
+static void visit_file(const char *key, const void *value, size_t size, void *args);
+
+/* 打印整数键的树 */
+static void visit_imap(long key, const char **value, void *args);
+
 struct key_value
 {
     const char *key;
@@ -25,6 +42,14 @@ struct key_value
 int main(int argc, char *argv[])
 {
     RB_TREE *tree = rb_create();
+    RB_SHARD_MAP *map = NULL;
+    RBP_TREE *ptree = NULL;
+    RBP_SNAPSHOT *snapshot = NULL;
+    RBM_TREE *mtree = NULL;
+    RB_WAL *wal = NULL;
+    RB_LSM *lsm = NULL;
+    IMAP_RBTREE itree;
+    const char *key = NULL;
     int i = 0;
     int num = sizeof(test_info) / sizeof(struct key_value);
 
@@ -38,7 +63,110 @@ int main(int argc, char *argv[])
 #endif
 
     rb_iterate(tree, visit_tree, NULL);
+
+    /* 顺序统计 */
+    if (!rb_select(tree, rb_count(tree) / 2, &key, NULL)) {
+        printf("median key:%s, keys below E: %d\n", key, rb_rank(tree, "E"));
+    }
+
     rb_destroy(tree);
+
+    /* 模板生成的整数键红黑树，键逆序插入，遍历时仍然按键的顺序输出 */
+    imap_rbtree_init(&itree);
+
+    for (i = num - 1; i >= 0; i--) {
+        imap_rbtree_insert(&itree, i * 10, test_info[i].value);
+    }
+    imap_rbtree_delete(&itree, 30, NULL);
+
+    if (!imap_rbtree_find(&itree, 40, &key)) {
+        printf("imap key 40: %s\n", key);
+    }
+    imap_rbtree_iterate(&itree, visit_imap, NULL);
+    imap_rbtree_clear(&itree);
+
+    /* 按散列划分的分片映射，遍历时仍然按键的顺序输出 */
+    map = rb_shard_create(4);
+
+    for (i = 0; i < num; i++) {
+        rb_shard_insert(map, test_info[i].key, (void *)(test_info[i].value));
+    }
+
+    rb_shard_iterate_range(map, "C", "G", visit_tree, NULL);
+    rb_shard_destroy(map);
+
+    /* 快照不受之后修改的影响 */
+    ptree = rbp_create();
+
+    for (i = 0; i < num; i++) {
+        rbp_insert(ptree, test_info[i].key, (void *)(test_info[i].value));
+    }
+
+    snapshot = rbp_snapshot(ptree);
+    rbp_delete(ptree, "A", NULL);
+    printf("snapshot keys: %d, current keys: %d\n", rbp_snapshot_count(snapshot), rbp_count(ptree));
+
+    rbp_destroy(ptree);
+    rbp_snapshot_iterate(snapshot, visit_tree, NULL);
+    rbp_snapshot_release(snapshot);
+
+    /* 文件中的树关闭后重新打开，不需要重新插入即可查找 */
+    mtree = rbm_open("rbmmap.db", RBM_CREATE);
+
+    for (i = 0; mtree && i < num; i++) {
+        rbm_insert(mtree, test_info[i].key, test_info[i].value, strlen(test_info[i].value) + 1);
+    }
+    rbm_close(mtree);
+
+    mtree = rbm_open("rbmmap.db", 0);
+    if (mtree) {
+        printf("mapped keys: %d\n", rbm_count(mtree));
+        rbm_iterate(mtree, visit_file, NULL);
+        rbm_close(mtree);
+    }
+    remove("rbmmap.db");
+
+    /* 修改先写日志，重新打开时由检查点和日志恢复 */
+    wal = rb_wal_open("rbwal.log", 0);
+
+    for (i = 0; wal && i < num; i++) {
+        rb_wal_insert(wal, test_info[i].key, test_info[i].value, strlen(test_info[i].value) + 1);
+        if (i == num / 2) {
+            rb_wal_checkpoint(wal);
+        }
+    }
+    rb_wal_delete(wal, "A");
+    rb_wal_close(wal);
+
+    wal = rb_wal_open("rbwal.log", 0);
+    if (wal) {
+        printf("logged keys: %d\n", rb_wal_count(wal));
+        rb_wal_iterate(wal, visit_file, NULL);
+        rb_wal_close(wal);
+    }
+    remove("rbwal.log");
+    remove("rbwal.log.ckpt");
+
+    /* 一半的键刷写到表文件，范围查询合并内存表和表文件 */
+    lsm = rb_lsm_open("rblsm.db", 0);
+
+    for (i = 0; lsm && i < num; i++) {
+        rb_lsm_put(lsm, test_info[i].key, test_info[i].value, strlen(test_info[i].value) + 1);
+        if (i == num / 2) {
+            rb_lsm_flush(lsm);
+        }
+    }
+    rb_lsm_delete(lsm, "B");
+
+    if (lsm) {
+        printf("lsm tables: %d, scan [C, G):\n", rb_lsm_table_count(lsm));
+        rb_lsm_scan(lsm, "C", "G", visit_file, NULL);
+
+        if (rb_lsm_close(lsm)) {
+            printf("lsm close failed, unflushed writes lost\n");
+        }
+    }
+    rb_lsm_destroy("rblsm.db");
     return 0;
 }
 
@@ -46,3 +174,13 @@ void visit_tree(void *key, void *data, void *args)
 {
     printf("key:%s, data = %s\n", (const char *)key, (const char *)data);
 }
+
+void visit_file(const char *key, const void *value, size_t size, void *args)
+{
+    printf("key:%s, value = %s\n", key, (const char *)value);
+}
+
+void visit_imap(long key, const char **value, void *args)
+{
+    printf("key:%ld, value = %s\n", key, *value);
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+
+/* 直接包含实现，构造损坏的文件时需要访问文件头和结点的布局 */
+#include "rbmmap.c"
+
+/**
+ * 内存映射红黑树的损坏文件测试：
+ *
+ * 1.创建只有一个键的文件，关闭后重新打开，结果必须完整；
+ * 2.分别将根结点的左孩子、空闲链表的表头改为接近 2^64 的偏移量，并标记为未正常关闭，
+ *   打开时的完整检查必须拒绝该文件，不能访问映射之外的内存；
+ * 3.文件已经打开时再次打开必须失败，关闭之后可以再次打开。
+ *
+ * 用法：./mmap_test [path]
+ */
+
+#define MMAP_TEST_PATH "mmap_test.db"
+
+/* 加上结点的大小之后在 64 位上溢出，并且按 RBM_MIN_BLOCK 对齐 */
+#define MMAP_TEST_BAD_OFFSET 0xFFFFFFFFFFFFFFE0ULL
+
+static const char *mmap_test_path = MMAP_TEST_PATH;
+
+/* 创建只有一个键的文件 */
+static int mmap_test_create()
+{
+    RBM_TREE *tree = NULL;
+    int ret = 0;
+
+    remove(mmap_test_path);
+
+    tree = rbm_open(mmap_test_path, RBM_CREATE);
+    if (!tree) {
+        return -1;
+    }
+
+    ret = rbm_insert(tree, "key", "value", sizeof("value"));
+    rbm_close(tree);
+    return ret;
+}
+
+/* 打开文件，由 corrupt 修改文件头之后标记为未正常关闭 */
+static int mmap_test_corrupt(void (*corrupt)(RBM_TREE *tree))
+{
+    RBM_TREE *tree = NULL;
+
+    if (mmap_test_create()) {
+        return -1;
+    }
+
+    tree = rbm_open(mmap_test_path, 0);
+    if (!tree) {
+        return -1;
+    }
+
+    corrupt(tree);
+    tree->header->clean = 0;
+
+    /* 直接解除映射，跳过 rbm_close 中的检查点 */
+    munmap(tree->base, tree->size);
+    close(tree->fd);
+    free(tree);
+    return 0;
+}
+
+static void mmap_test_bad_left(RBM_TREE *tree)
+{
+    rbm_node(tree, tree->header->root)->left = MMAP_TEST_BAD_OFFSET;
+}
+
+static void mmap_test_bad_free(RBM_TREE *tree)
+{
+    tree->header->free[0] = MMAP_TEST_BAD_OFFSET;
+}
+
+static void mmap_test_unchanged(RBM_TREE *tree)
+{
+}
+
+/* 损坏文件之后重新打开，valid 表示文件是否应当被接受 */
+static int mmap_test_case(const char *name, void (*corrupt)(RBM_TREE *tree), int valid)
+{
+    RBM_TREE *tree = NULL;
+    const void *value = NULL;
+    size_t size = 0;
+    int ok = 0;
+
+    if (!mmap_test_corrupt(corrupt)) {
+        tree = rbm_open(mmap_test_path, 0);
+
+        if (valid) {
+            ok = tree && !rbm_find(tree, "key", &value, &size) && size == sizeof("value");
+        } else {
+            ok = !tree;
+        }
+        rbm_close(tree);
+    }
+
+    printf("%-24s %s\n", name, ok ? "通过" : "失败");
+    return ok ? 0 : 1;
+}
+
+/* 同一个文件不能同时打开两次 */
+static int mmap_test_exclusive(const char *name)
+{
+    RBM_TREE *tree = NULL;
+    RBM_TREE *other = NULL;
+    int ok = 0;
+
+    if (!mmap_test_create()) {
+        tree = rbm_open(mmap_test_path, 0);
+        other = rbm_open(mmap_test_path, 0);
+        ok = tree && !other;
+
+        rbm_close(other);
+        rbm_close(tree);
+
+        other = rbm_open(mmap_test_path, 0);
+        ok = ok && other;
+        rbm_close(other);
+    }
+
+    printf("%-24s %s\n", name, ok ? "通过" : "失败");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int failed = 0;
+
+    if (argc > 1) {
+        mmap_test_path = argv[1];
+    }
+
+    /* 未正常关闭但没有损坏的文件通过完整检查 */
+    failed += mmap_test_case("未正常关闭的完整文件", mmap_test_unchanged, 1);
+    failed += mmap_test_case("左孩子偏移量溢出", mmap_test_bad_left, 0);
+    failed += mmap_test_case("空闲链表偏移量溢出", mmap_test_bad_free, 0);
+    failed += mmap_test_exclusive("重复打开");
+
+    remove(mmap_test_path);
+    return failed ? 1 : 0;
+}
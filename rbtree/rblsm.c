@@ -0,0 +1,1671 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "rbtree.h"
+#include "rblsm.h"
+
+/*===========================================================================*/
+
+/* 数据块的大小，块中最后一条记录可以超出 */
+#define RB_LSM_BLOCK_SIZE 4096
+
+/* 表文件的数目达到该值时合并 */
+#define RB_LSM_COMPACT_TABLES 4
+
+/* 布隆过滤器每个键占用的位数和哈希函数的个数，误判率约 1% */
+#define RB_LSM_BLOOM_BITS 10
+#define RB_LSM_BLOOM_HASHES 7
+
+/* 记录头：键的长度、值的长度，值长度的最高位为删除标记 */
+#define RB_LSM_RECORD_SIZE 8
+#define RB_LSM_DELETED 0x80000000u
+
+/* 索引项：数据块的偏移量、大小和第一个键的长度 */
+#define RB_LSM_INDEX_SIZE 16
+
+/* 文件尾：索引偏移量、过滤器偏移量、记录数、数据块数、过滤器字数和魔数 */
+#define RB_LSM_FOOTER_SIZE 40
+#define RB_LSM_MAGIC "RBLSMTB1"
+
+#define RB_LSM_MANIFEST "MANIFEST"
+#define RB_LSM_MANIFEST_TEMP "MANIFEST.tmp"
+#define RB_LSM_TABLE_SUFFIX ".sst"
+
+/* 内存表中的值，删除标记也保存在内存表中 */
+typedef struct rb_lsm_value_st
+{
+    size_t size;
+    int deleted;
+    char data[];
+} RB_LSM_VALUE;
+
+/* 范围查询时内存表中记录的副本 */
+typedef struct rb_lsm_entry_st
+{
+    char *key;
+    RB_LSM_VALUE *value;
+} RB_LSM_ENTRY;
+
+/* 打开的表文件，索引和布隆过滤器常驻内存 */
+typedef struct rb_lsm_table_st
+{
+    uint64_t number;
+    int fd;
+
+    /* 引用计数，读取和合并期间持有引用，由 lsm->lock 保护 */
+    int refs;
+
+    uint64_t count;
+    uint64_t size;
+
+    /* 稀疏索引，每个数据块的偏移量、大小和第一个键 */
+    uint32_t block_count;
+    uint64_t *offsets;
+    uint32_t *sizes;
+    char **keys;
+    char *key_data;
+
+    uint32_t bloom_words;
+    uint64_t *bloom;
+} RB_LSM_TABLE;
+
+/* 遍历内存表副本或者表文件的迭代器 */
+typedef struct rb_lsm_iter_st
+{
+    /* 内存表副本 */
+    RB_LSM_ENTRY *entries;
+    int count;
+    int index;
+
+    /* 表文件，buffer 中为当前数据块 */
+    RB_LSM_TABLE *table;
+    uint32_t block;
+    char *buffer;
+    size_t buffer_size;
+    size_t len;
+    size_t pos;
+    size_t next;
+
+    /* 当前的记录 */
+    const char *key;
+    const char *value;
+    size_t size;
+    int deleted;
+    int valid;
+    int error;
+} RB_LSM_ITER;
+
+/* 写入表文件 */
+typedef struct rb_lsm_writer_st
+{
+    FILE *fp;
+    uint64_t offset;
+
+    char *block;
+    size_t block_len;
+    size_t block_size;
+
+    char *index;
+    size_t index_len;
+    size_t index_size;
+
+    uint32_t bloom_words;
+    uint64_t *bloom;
+
+    uint64_t count;
+    uint32_t block_count;
+    int error;
+} RB_LSM_WRITER;
+
+struct rb_lsm_st
+{
+    char *dir;
+    size_t memtable_size;
+
+    pthread_mutex_t lock;
+
+    /* 通知后台线程有工作，以及通知前台后台线程完成一项工作 */
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t thread;
+    int started;
+
+    /* 可写的内存表和正在刷写的只读内存表 */
+    RB_TREE *mem;
+    size_t mem_bytes;
+    RB_TREE *imm;
+
+    /* 表文件从旧到新排列 */
+    RB_LSM_TABLE **tables;
+    int table_count;
+    uint64_t next_number;
+
+    int compact_request;
+    int closing;
+
+    /* 后台线程出错后不再接受修改 */
+    int error;
+};
+
+/* 后台线程，依次执行刷写和合并 */
+static void *rb_lsm_worker(void *args);
+
+/* 将只读内存表写入表文件，需要持有锁，写入期间释放锁 */
+static int rb_lsm_flush_imm(RB_LSM *lsm);
+
+/* 合并 [start, table_count) 中的表文件，需要持有锁，合并期间释放锁 */
+static int rb_lsm_compact_range(RB_LSM *lsm, int start);
+
+/* 选择需要合并的表文件，返回第一个的下标，不需要合并时返回 -1 */
+static int rb_lsm_pick(RB_LSM *lsm);
+
+/* 将可写的内存表转为只读并通知后台线程，需要持有锁 */
+static int rb_lsm_rotate(RB_LSM *lsm);
+
+/* 修改操作的公共部分 */
+static int rb_lsm_write(RB_LSM *lsm, const char *key, const void *value, size_t size, int deleted);
+
+/* 在内存表中查找，找到返回 0，未找到返回 1 */
+static int rb_lsm_mem_get(RB_TREE *tree, const char *key, void *value, size_t *size, int *deleted);
+
+/* 复制内存表中 [start, end) 的记录 */
+static int rb_lsm_mem_copy(RB_TREE *tree, const char *start, const char *end, RB_LSM_ITER *iter);
+
+/* 释放内存表及其中的值 */
+static void rb_lsm_mem_free(RB_TREE *tree);
+
+/* 释放内存表中的值 */
+static void rb_lsm_free_value(void *key, void *data, void *args);
+
+/* 生成表文件的路径 */
+static char *rb_lsm_path(RB_LSM *lsm, uint64_t number);
+
+/* 拼接目录和文件名 */
+static char *rb_lsm_join(const char *dir, const char *name);
+
+/* 将表文件列表写入 MANIFEST，需要持有锁 */
+static int rb_lsm_save(RB_LSM *lsm);
+
+/* 读取 MANIFEST 并打开其中的表文件，不存在时为空 */
+static int rb_lsm_load(RB_LSM *lsm);
+
+/* 删除不在 MANIFEST 中的表文件，例如刷写或者合并时崩溃留下的文件 */
+static void rb_lsm_clean(RB_LSM *lsm);
+
+/* 同步目录，使创建和重命名持久化 */
+static int rb_lsm_sync_dir(const char *dir);
+
+/* 计算键的哈希值 */
+static uint64_t rb_lsm_hash(const char *key);
+
+/* 检查键是否可能在表文件中 */
+static int rb_lsm_bloom_check(const RB_LSM_TABLE *table, uint64_t hash);
+
+/* 打开表文件，读取索引和布隆过滤器 */
+static RB_LSM_TABLE *rb_lsm_table_open(RB_LSM *lsm, uint64_t number);
+
+/* 释放表文件的引用，需要持有锁 */
+static void rb_lsm_table_release(RB_LSM_TABLE *table);
+
+/* 在表文件中查找，找到返回 0，未找到返回 1，出错返回 -1 */
+static int rb_lsm_table_get(
+    RB_LSM_TABLE *table, const char *key, uint64_t hash, void *value, size_t *size, int *deleted);
+
+/* 获取所有表文件的引用，从新到旧排列，需要持有锁 */
+static RB_LSM_TABLE **rb_lsm_table_ref(RB_LSM *lsm, int start, int *count);
+
+/* 读取表文件中第一个键不大于 key 的数据块，key 为 NULL 时读取第一个数据块 */
+static void rb_lsm_iter_seek(RB_LSM_ITER *iter, RB_LSM_TABLE *table, const char *key);
+
+/* 移动到下一条记录 */
+static void rb_lsm_iter_next(RB_LSM_ITER *iter);
+
+/* 读取数据块 */
+static void rb_lsm_iter_load(RB_LSM_ITER *iter);
+
+/* 解析当前位置的记录 */
+static void rb_lsm_iter_decode(RB_LSM_ITER *iter);
+
+/* 释放迭代器 */
+static void rb_lsm_iter_free(RB_LSM_ITER *iter);
+
+/* 从按从新到旧排列的迭代器中选择最小的键，相同的键选择最新的，全部结束返回 -1 */
+static int rb_lsm_merge_pick(RB_LSM_ITER *iters, int count);
+
+/* 跳过所有迭代器中与 iters[pick] 相同的键 */
+static void rb_lsm_merge_skip(RB_LSM_ITER *iters, int count, int pick);
+
+/* 创建表文件，expect 为记录数的上限，用于确定布隆过滤器的大小 */
+static int rb_lsm_writer_open(RB_LSM_WRITER *writer, const char *path, uint64_t expect);
+
+/* 追加一条记录，键必须递增 */
+static void rb_lsm_writer_add(
+    RB_LSM_WRITER *writer, const char *key, const void *value, size_t size, int deleted);
+
+/* 写入当前数据块 */
+static void rb_lsm_writer_block(RB_LSM_WRITER *writer);
+
+/* 写入索引、布隆过滤器和文件尾并同步 */
+static int rb_lsm_writer_finish(RB_LSM_WRITER *writer);
+
+/*===========================================================================*/
+
+RB_LSM *rb_lsm_open(const char *dir, size_t memtable_size)
+{
+    RB_LSM *lsm = NULL;
+
+    if (!dir || !*dir) {
+        return NULL;
+    }
+
+    if (mkdir(dir, 0755) && errno != EEXIST) {
+        return NULL;
+    }
+
+    lsm = malloc(sizeof(RB_LSM));
+    if (!lsm) {
+        return NULL;
+    }
+    memset(lsm, 0, sizeof(RB_LSM));
+
+    lsm->memtable_size = memtable_size ? memtable_size : RB_LSM_MEMTABLE_SIZE;
+    lsm->next_number = 1;
+    pthread_mutex_init(&lsm->lock, NULL);
+    pthread_cond_init(&lsm->work, NULL);
+    pthread_cond_init(&lsm->done, NULL);
+
+    lsm->dir = rb_lsm_join(dir, "");
+    lsm->mem = rb_create_ex(RB_FLAG_OWN_KEYS);
+
+    if (!lsm->dir || !lsm->mem || rb_lsm_load(lsm)) {
+        rb_lsm_close(lsm);
+        return NULL;
+    }
+
+    rb_lsm_clean(lsm);
+
+    if (pthread_create(&lsm->thread, NULL, rb_lsm_worker, lsm)) {
+        rb_lsm_close(lsm);
+        return NULL;
+    }
+
+    lsm->started = 1;
+    return lsm;
+}
+
+int rb_lsm_close(RB_LSM *lsm)
+{
+    int ret = 0;
+    int i = 0;
+
+    if (!lsm) {
+        return -1;
+    }
+
+    if (lsm->started) {
+        /* 后台线程刷写剩余的内存表后退出 */
+        pthread_mutex_lock(&lsm->lock);
+        lsm->closing = 1;
+        pthread_cond_signal(&lsm->work);
+        pthread_mutex_unlock(&lsm->lock);
+
+        pthread_join(lsm->thread, NULL);
+    }
+
+    /* 后台线程出错时停止刷写，内存表中剩余的修改随之丢失 */
+    if (lsm->error || lsm->imm || (lsm->mem && rb_count(lsm->mem))) {
+        ret = -1;
+    }
+
+    rb_lsm_mem_free(lsm->mem);
+    rb_lsm_mem_free(lsm->imm);
+
+    for (i = 0; i < lsm->table_count; i++) {
+        rb_lsm_table_release(lsm->tables[i]);
+    }
+
+    pthread_cond_destroy(&lsm->done);
+    pthread_cond_destroy(&lsm->work);
+    pthread_mutex_destroy(&lsm->lock);
+
+    free(lsm->tables);
+    free(lsm->dir);
+    free(lsm);
+    return ret;
+}
+
+int rb_lsm_destroy(const char *dir)
+{
+    DIR *handle = NULL;
+    struct dirent *entry = NULL;
+    size_t suffix = strlen(RB_LSM_TABLE_SUFFIX);
+
+    if (!dir) {
+        return -1;
+    }
+
+    handle = opendir(dir);
+    if (!handle) {
+        return -1;
+    }
+
+    /* 只删除引擎创建的文件，目录中还有其它文件时 rmdir 失败 */
+    while ((entry = readdir(handle))) {
+        size_t len = strlen(entry->d_name);
+        char *path = NULL;
+
+        if (strcmp(entry->d_name, RB_LSM_MANIFEST) && strcmp(entry->d_name, RB_LSM_MANIFEST_TEMP) &&
+            (len <= suffix || strcmp(entry->d_name + len - suffix, RB_LSM_TABLE_SUFFIX))) {
+            continue;
+        }
+
+        path = rb_lsm_join(dir, entry->d_name);
+        if (path) {
+            unlink(path);
+            free(path);
+        }
+    }
+
+    closedir(handle);
+    return rmdir(dir) ? -1 : 0;
+}
+
+int rb_lsm_put(RB_LSM *lsm, const char *key, const void *value, size_t size)
+{
+    return rb_lsm_write(lsm, key, value, size, 0);
+}
+
+int rb_lsm_delete(RB_LSM *lsm, const char *key)
+{
+    return rb_lsm_write(lsm, key, NULL, 0, 1);
+}
+
+int rb_lsm_get(RB_LSM *lsm, const char *key, void *value, size_t *size)
+{
+    RB_LSM_TABLE **tables = NULL;
+    uint64_t hash = 0;
+    int deleted = 0;
+    int count = 0;
+    int ret = 1;
+    int i = 0;
+
+    if (!lsm || !key || !*key || !size) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+
+    ret = rb_lsm_mem_get(lsm->mem, key, value, size, &deleted);
+    if (ret && lsm->imm) {
+        ret = rb_lsm_mem_get(lsm->imm, key, value, size, &deleted);
+    }
+
+    if (!ret) {
+        pthread_mutex_unlock(&lsm->lock);
+        return deleted ? -1 : 0;
+    }
+
+    /* 读取表文件时不持有锁，引用保证合并不会关闭正在读取的文件 */
+    tables = rb_lsm_table_ref(lsm, 0, &count);
+    pthread_mutex_unlock(&lsm->lock);
+
+    if (!tables) {
+        return -1;
+    }
+
+    hash = rb_lsm_hash(key);
+    for (i = 0, ret = 1; ret > 0 && i < count; i++) {
+        ret = rb_lsm_table_get(tables[i], key, hash, value, size, &deleted);
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+    for (i = 0; i < count; i++) {
+        rb_lsm_table_release(tables[i]);
+    }
+    pthread_mutex_unlock(&lsm->lock);
+
+    free(tables);
+    return (ret || deleted) ? -1 : 0;
+}
+
+int rb_lsm_scan(RB_LSM *lsm, const char *start, const char *end,
+    void (*visit)(const char *key, const void *value, size_t size, void *args), void *args)
+{
+    RB_LSM_TABLE **tables = NULL;
+    RB_LSM_ITER *iters = NULL;
+    int count = 0;
+    int error = 0;
+    int pick = 0;
+    int i = 0;
+
+    if (!lsm || !visit) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+
+    tables = rb_lsm_table_ref(lsm, 0, &count);
+    iters = tables ? malloc(sizeof(RB_LSM_ITER) * (count + 2)) : NULL;
+
+    if (!iters) {
+        for (i = 0; tables && i < count; i++) {
+            rb_lsm_table_release(tables[i]);
+        }
+        pthread_mutex_unlock(&lsm->lock);
+        free(tables);
+        return -1;
+    }
+    memset(iters, 0, sizeof(RB_LSM_ITER) * (count + 2));
+
+    /* 迭代器从新到旧排列：内存表、只读内存表、表文件 */
+    error |= rb_lsm_mem_copy(lsm->mem, start, end, iters);
+    error |= rb_lsm_mem_copy(lsm->imm, start, end, iters + 1);
+
+    pthread_mutex_unlock(&lsm->lock);
+
+    for (i = 0; !error && i < count; i++) {
+        rb_lsm_iter_seek(iters + i + 2, tables[i], start);
+        while (iters[i + 2].valid && start && strcmp(iters[i + 2].key, start) < 0) {
+            rb_lsm_iter_next(iters + i + 2);
+        }
+        error |= iters[i + 2].error;
+    }
+
+    while (!error && (pick = rb_lsm_merge_pick(iters, count + 2)) >= 0) {
+        RB_LSM_ITER *iter = iters + pick;
+
+        if (end && strcmp(iter->key, end) >= 0) {
+            break;
+        }
+
+        if (!iter->deleted) {
+            visit(iter->key, iter->value, iter->size, args);
+        }
+
+        rb_lsm_merge_skip(iters, count + 2, pick);
+
+        for (i = 0; i < count + 2; i++) {
+            error |= iters[i].error;
+        }
+    }
+
+    for (i = 0; i < count + 2; i++) {
+        rb_lsm_iter_free(iters + i);
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+    for (i = 0; i < count; i++) {
+        rb_lsm_table_release(tables[i]);
+    }
+    pthread_mutex_unlock(&lsm->lock);
+
+    free(iters);
+    free(tables);
+    return error ? -1 : 0;
+}
+
+int rb_lsm_flush(RB_LSM *lsm)
+{
+    int ret = 0;
+
+    if (!lsm) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+
+    /* 等待之前的只读内存表刷写完成，再转换当前内存表并等待其完成 */
+    while (lsm->imm && !lsm->error) {
+        pthread_cond_wait(&lsm->done, &lsm->lock);
+    }
+
+    if (!lsm->error && rb_count(lsm->mem)) {
+        ret = rb_lsm_rotate(lsm);
+    }
+
+    while (lsm->imm && !lsm->error) {
+        pthread_cond_wait(&lsm->done, &lsm->lock);
+    }
+
+    ret = (ret || lsm->error) ? -1 : 0;
+    pthread_mutex_unlock(&lsm->lock);
+    return ret;
+}
+
+int rb_lsm_compact(RB_LSM *lsm)
+{
+    int ret = 0;
+
+    if (rb_lsm_flush(lsm)) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+
+    lsm->compact_request = 1;
+    pthread_cond_signal(&lsm->work);
+
+    while (lsm->compact_request && !lsm->error) {
+        pthread_cond_wait(&lsm->done, &lsm->lock);
+    }
+
+    ret = lsm->error ? -1 : 0;
+    pthread_mutex_unlock(&lsm->lock);
+    return ret;
+}
+
+int rb_lsm_table_count(RB_LSM *lsm)
+{
+    int count = 0;
+
+    if (!lsm) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+    count = lsm->table_count;
+    pthread_mutex_unlock(&lsm->lock);
+    return count;
+}
+
+/*-------------------------------------------------------*/
+
+void *rb_lsm_worker(void *args)
+{
+    RB_LSM *lsm = args;
+    int start = 0;
+
+    pthread_mutex_lock(&lsm->lock);
+
+    while (!lsm->error) {
+        /* 刷写优先，只读内存表刷写之前写入可能被阻塞 */
+        if (lsm->imm) {
+            rb_lsm_flush_imm(lsm);
+            continue;
+        }
+
+        if (lsm->closing) {
+            if (rb_count(lsm->mem) && !rb_lsm_rotate(lsm)) {
+                continue;
+            }
+            break;
+        }
+
+        if (lsm->compact_request) {
+            if (lsm->table_count) {
+                rb_lsm_compact_range(lsm, 0);
+            }
+            lsm->compact_request = 0;
+            pthread_cond_broadcast(&lsm->done);
+            continue;
+        }
+
+        start = rb_lsm_pick(lsm);
+        if (start >= 0) {
+            rb_lsm_compact_range(lsm, start);
+            continue;
+        }
+
+        pthread_cond_wait(&lsm->work, &lsm->lock);
+    }
+
+    /* 出错后唤醒所有等待的线程 */
+    pthread_cond_broadcast(&lsm->done);
+    pthread_mutex_unlock(&lsm->lock);
+    return NULL;
+}
+
+int rb_lsm_flush_imm(RB_LSM *lsm)
+{
+    RB_LSM_WRITER writer;
+    RB_LSM_TABLE *table = NULL;
+    RB_LSM_TABLE **tables = NULL;
+    RB_CURSOR cursor;
+    uint64_t number = lsm->next_number++;
+    char *path = rb_lsm_path(lsm, number);
+    int ret = -1;
+
+    pthread_mutex_unlock(&lsm->lock);
+
+    /* 只读内存表只有后台线程会释放，其它线程只会查找，不持有锁也可以遍历 */
+    if (path && !rb_lsm_writer_open(&writer, path, rb_count(lsm->imm))) {
+        for (ret = rb_cursor_first(lsm->imm, &cursor); !ret; ret = rb_cursor_next(&cursor)) {
+            const char *key = NULL;
+            RB_LSM_VALUE *value = NULL;
+
+            rb_cursor_get(&cursor, &key, (void **)&value);
+            rb_lsm_writer_add(&writer, key, value->data, value->size, value->deleted);
+        }
+
+        ret = rb_lsm_writer_finish(&writer);
+    }
+
+    if (!ret) {
+        table = rb_lsm_table_open(lsm, number);
+    }
+
+    if (!table && path) {
+        unlink(path);
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+
+    tables = table ? realloc(lsm->tables, sizeof(RB_LSM_TABLE *) * (lsm->table_count + 1)) : NULL;
+    if (tables) {
+        lsm->tables = tables;
+        lsm->tables[lsm->table_count++] = table;
+    }
+
+    if (!tables || rb_lsm_save(lsm)) {
+        /* 文件尚未进入 MANIFEST，重新打开时由 rb_lsm_clean 删除 */
+        if (tables) {
+            lsm->table_count--;
+        }
+        if (table) {
+            rb_lsm_table_release(table);
+        }
+        lsm->error = 1;
+        free(path);
+        return -1;
+    }
+
+    rb_lsm_mem_free(lsm->imm);
+    lsm->imm = NULL;
+    pthread_cond_broadcast(&lsm->done);
+
+    free(path);
+    return 0;
+}
+
+int rb_lsm_compact_range(RB_LSM *lsm, int start)
+{
+    RB_LSM_WRITER writer;
+    RB_LSM_TABLE *table = NULL;
+    RB_LSM_TABLE **inputs = NULL;
+    RB_LSM_ITER *iters = NULL;
+    uint64_t number = lsm->next_number++;
+    uint64_t expect = 0;
+    char *path = rb_lsm_path(lsm, number);
+    int bottom = start == 0;
+    int opened = 0;
+    int replaced = 0;
+    int count = 0;
+    int error = 0;
+    int pick = 0;
+    int i = 0;
+
+    inputs = path ? rb_lsm_table_ref(lsm, start, &count) : NULL;
+    if (!inputs) {
+        lsm->error = 1;
+        free(path);
+        return -1;
+    }
+
+    pthread_mutex_unlock(&lsm->lock);
+
+    iters = malloc(sizeof(RB_LSM_ITER) * count);
+    error = !iters;
+
+    if (!error) {
+        memset(iters, 0, sizeof(RB_LSM_ITER) * count);
+
+        for (i = 0; i < count; i++) {
+            expect += inputs[i]->count;
+            rb_lsm_iter_seek(iters + i, inputs[i], NULL);
+            error |= iters[i].error;
+        }
+
+        opened = !error && !rb_lsm_writer_open(&writer, path, expect);
+        error = error || !opened;
+    }
+
+    while (!error && (pick = rb_lsm_merge_pick(iters, count)) >= 0) {
+        RB_LSM_ITER *iter = iters + pick;
+
+        /* 最旧的表中没有更早的记录，删除标记不再需要 */
+        if (!(bottom && iter->deleted)) {
+            rb_lsm_writer_add(&writer, iter->key, iter->value, iter->size, iter->deleted);
+        }
+
+        rb_lsm_merge_skip(iters, count, pick);
+
+        for (i = 0; i < count; i++) {
+            error |= iters[i].error;
+        }
+    }
+
+    if (opened) {
+        writer.error |= error;
+        error = rb_lsm_writer_finish(&writer) || error;
+    }
+
+    if (!error && writer.count) {
+        table = rb_lsm_table_open(lsm, number);
+        error = !table;
+    }
+
+    /* 所有记录都被删除时不生成文件 */
+    if (opened && (error || !writer.count)) {
+        unlink(path);
+    }
+
+    for (i = 0; iters && i < count; i++) {
+        rb_lsm_iter_free(iters + i);
+    }
+    free(iters);
+
+    pthread_mutex_lock(&lsm->lock);
+
+    if (!error) {
+        /* 只有后台线程修改表文件列表，输入仍然是 [start, table_count)，用输出替换 */
+        if (table) {
+            lsm->tables[start] = table;
+        }
+        lsm->table_count = start + (table ? 1 : 0);
+
+        replaced = 1;
+        error = rb_lsm_save(lsm);
+    }
+
+    /* 输入的文件已经不在 MANIFEST 中，打开的文件在最后一个引用释放后才关闭 */
+    for (i = 0; i < count; i++) {
+        if (!error) {
+            char *old = rb_lsm_path(lsm, inputs[i]->number);
+
+            if (old) {
+                unlink(old);
+                free(old);
+            }
+        }
+
+        /* 列表中的引用 */
+        if (replaced) {
+            rb_lsm_table_release(inputs[i]);
+        }
+        rb_lsm_table_release(inputs[i]);
+    }
+
+    if (error) {
+        if (table && !replaced) {
+            rb_lsm_table_release(table);
+        }
+        lsm->error = 1;
+    }
+
+    free(inputs);
+    free(path);
+    return error ? -1 : 0;
+}
+
+int rb_lsm_pick(RB_LSM *lsm)
+{
+    uint64_t size = 0;
+    int start = lsm->table_count - RB_LSM_COMPACT_TABLES;
+    int i = 0;
+
+    if (start < 0) {
+        return -1;
+    }
+
+    /**
+     * 至少合并最新的若干个表，再向前包含大小不超过已选部分两倍的表，合并后的表大小按倍数
+     * 增长，每条记录被重写的次数与表的数目成对数关系。
+     */
+    for (i = start; i < lsm->table_count; i++) {
+        size += lsm->tables[i]->size;
+    }
+
+    while (start > 0 && lsm->tables[start - 1]->size <= size * 2) {
+        size += lsm->tables[--start]->size;
+    }
+
+    return start;
+}
+
+int rb_lsm_rotate(RB_LSM *lsm)
+{
+    RB_TREE *mem = rb_create_ex(RB_FLAG_OWN_KEYS);
+
+    if (!mem) {
+        return -1;
+    }
+
+    lsm->imm = lsm->mem;
+    lsm->mem = mem;
+    lsm->mem_bytes = 0;
+    pthread_cond_signal(&lsm->work);
+    return 0;
+}
+
+int rb_lsm_write(RB_LSM *lsm, const char *key, const void *value, size_t size, int deleted)
+{
+    RB_LSM_VALUE *data = NULL;
+    RB_LSM_VALUE *old = NULL;
+    size_t len = 0;
+
+    if (!lsm || !key || !*key || (size && !value) || size >= RB_LSM_DELETED) {
+        return -1;
+    }
+
+    len = strlen(key);
+    if (len >= RB_LSM_DELETED) {
+        return -1;
+    }
+
+    data = malloc(sizeof(RB_LSM_VALUE) + size);
+    if (!data) {
+        return -1;
+    }
+
+    data->size = size;
+    data->deleted = deleted;
+    if (size) {
+        memcpy(data->data, value, size);
+    }
+
+    pthread_mutex_lock(&lsm->lock);
+
+    /* 内存表已满时转为只读，上一个只读内存表还在刷写时等待 */
+    while (!lsm->error && lsm->mem_bytes >= lsm->memtable_size) {
+        if (!lsm->imm) {
+            if (rb_lsm_rotate(lsm)) {
+                break;
+            }
+        } else {
+            pthread_cond_wait(&lsm->done, &lsm->lock);
+        }
+    }
+
+    if (lsm->error || rb_upsert(lsm->mem, key, data, (void **)&old) < 0) {
+        pthread_mutex_unlock(&lsm->lock);
+        free(data);
+        return -1;
+    }
+
+    /* 近似的内存占用，用于决定刷写的时机 */
+    if (old) {
+        lsm->mem_bytes += size;
+        lsm->mem_bytes -= old->size < lsm->mem_bytes ? old->size : lsm->mem_bytes;
+        free(old);
+    } else {
+        lsm->mem_bytes += sizeof(RB_LSM_VALUE) + size + len + 1 + 64;
+    }
+
+    pthread_mutex_unlock(&lsm->lock);
+    return 0;
+}
+
+int rb_lsm_mem_get(RB_TREE *tree, const char *key, void *value, size_t *size, int *deleted)
+{
+    RB_LSM_VALUE *data = NULL;
+
+    if (rb_find(tree, key, (void **)&data)) {
+        return 1;
+    }
+
+    *deleted = data->deleted;
+    if (!data->deleted) {
+        if (value) {
+            memcpy(value, data->data, data->size < *size ? data->size : *size);
+        }
+        *size = data->size;
+    }
+
+    return 0;
+}
+
+int rb_lsm_mem_copy(RB_TREE *tree, const char *start, const char *end, RB_LSM_ITER *iter)
+{
+    RB_CURSOR cursor;
+    RB_LSM_ENTRY *entries = NULL;
+    int size = 0;
+    int ret = 0;
+
+    if (!tree) {
+        return 0;
+    }
+
+    ret = start ? rb_cursor_lower_bound(tree, &cursor, start) : rb_cursor_first(tree, &cursor);
+
+    for (; !ret; ret = rb_cursor_next(&cursor)) {
+        const char *key = NULL;
+        RB_LSM_VALUE *value = NULL;
+        RB_LSM_ENTRY *entry = NULL;
+
+        rb_cursor_get(&cursor, &key, (void **)&value);
+        if (end && strcmp(key, end) >= 0) {
+            break;
+        }
+
+        if (iter->count == size) {
+            size = size ? size * 2 : 64;
+            entries = realloc(iter->entries, sizeof(RB_LSM_ENTRY) * size);
+            if (!entries) {
+                return -1;
+            }
+            iter->entries = entries;
+        }
+
+        entry = iter->entries + iter->count;
+        entry->key = malloc(strlen(key) + 1);
+        entry->value = malloc(sizeof(RB_LSM_VALUE) + value->size);
+
+        if (!entry->key || !entry->value) {
+            free(entry->key);
+            free(entry->value);
+            return -1;
+        }
+
+        strcpy(entry->key, key);
+        memcpy(entry->value, value, sizeof(RB_LSM_VALUE) + value->size);
+        iter->count++;
+    }
+
+    iter->index = -1;
+    rb_lsm_iter_next(iter);
+    return 0;
+}
+
+void rb_lsm_mem_free(RB_TREE *tree)
+{
+    if (tree) {
+        rb_iterate(tree, rb_lsm_free_value, NULL);
+        rb_destroy(tree);
+    }
+}
+
+void rb_lsm_free_value(void *key, void *data, void *args)
+{
+    free(data);
+}
+
+char *rb_lsm_path(RB_LSM *lsm, uint64_t number)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "%06llu%s", (unsigned long long)number, RB_LSM_TABLE_SUFFIX);
+    return rb_lsm_join(lsm->dir, name);
+}
+
+char *rb_lsm_join(const char *dir, const char *name)
+{
+    size_t len = strlen(dir);
+    char *path = malloc(len + strlen(name) + 2);
+
+    if (!path) {
+        return NULL;
+    }
+
+    strcpy(path, dir);
+    if (*name) {
+        path[len++] = '/';
+        strcpy(path + len, name);
+    }
+
+    return path;
+}
+
+int rb_lsm_save(RB_LSM *lsm)
+{
+    char *temp = rb_lsm_join(lsm->dir, RB_LSM_MANIFEST_TEMP);
+    char *path = rb_lsm_join(lsm->dir, RB_LSM_MANIFEST);
+    FILE *fp = NULL;
+    int error = 0;
+    int i = 0;
+
+    fp = (temp && path) ? fopen(temp, "w") : NULL;
+    error = !fp;
+
+    /* 第一行为下一个文件编号，之后每行一个表文件编号，从旧到新 */
+    if (!error) {
+        error |= fprintf(fp, "%llu\n", (unsigned long long)lsm->next_number) < 0;
+
+        for (i = 0; i < lsm->table_count; i++) {
+            error |= fprintf(fp, "%llu\n", (unsigned long long)lsm->tables[i]->number) < 0;
+        }
+
+        error |= fflush(fp) != 0;
+        error |= fsync(fileno(fp)) != 0;
+        error |= fclose(fp) != 0;
+    }
+
+    if (!error) {
+        error = rename(temp, path) || rb_lsm_sync_dir(lsm->dir);
+    }
+
+    free(temp);
+    free(path);
+    return error ? -1 : 0;
+}
+
+int rb_lsm_load(RB_LSM *lsm)
+{
+    char *path = rb_lsm_join(lsm->dir, RB_LSM_MANIFEST);
+    unsigned long long number = 0;
+    FILE *fp = NULL;
+    int size = 0;
+
+    if (!path) {
+        return -1;
+    }
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        free(path);
+        return errno == ENOENT ? 0 : -1;
+    }
+    free(path);
+
+    if (fscanf(fp, "%llu", &number) != 1) {
+        fclose(fp);
+        return -1;
+    }
+    lsm->next_number = number;
+
+    while (fscanf(fp, "%llu", &number) == 1) {
+        RB_LSM_TABLE *table = NULL;
+
+        if (lsm->table_count == size) {
+            RB_LSM_TABLE **tables = NULL;
+
+            size = size ? size * 2 : 8;
+            tables = realloc(lsm->tables, sizeof(RB_LSM_TABLE *) * size);
+            if (!tables) {
+                fclose(fp);
+                return -1;
+            }
+            lsm->tables = tables;
+        }
+
+        /* MANIFEST 中的表文件缺失或者损坏时打开失败 */
+        table = number < lsm->next_number ? rb_lsm_table_open(lsm, number) : NULL;
+        if (!table) {
+            fclose(fp);
+            return -1;
+        }
+
+        lsm->tables[lsm->table_count++] = table;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+void rb_lsm_clean(RB_LSM *lsm)
+{
+    DIR *handle = opendir(lsm->dir);
+    struct dirent *entry = NULL;
+
+    if (!handle) {
+        return;
+    }
+
+    while ((entry = readdir(handle))) {
+        unsigned long long number = 0;
+        char suffix[8];
+        int live = 0;
+        int i = 0;
+
+        if (sscanf(entry->d_name, "%llu%7s", &number, suffix) != 2 || strcmp(suffix, RB_LSM_TABLE_SUFFIX)) {
+            continue;
+        }
+
+        for (i = 0; !live && i < lsm->table_count; i++) {
+            live = lsm->tables[i]->number == number;
+        }
+
+        if (!live) {
+            char *path = rb_lsm_join(lsm->dir, entry->d_name);
+
+            if (path) {
+                unlink(path);
+                free(path);
+            }
+        }
+    }
+
+    closedir(handle);
+}
+
+int rb_lsm_sync_dir(const char *dir)
+{
+    int fd = open(dir, O_RDONLY);
+    int ret = 0;
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    ret = fsync(fd) ? -1 : 0;
+    close(fd);
+    return ret;
+}
+
+uint64_t rb_lsm_hash(const char *key)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+int rb_lsm_bloom_check(const RB_LSM_TABLE *table, uint64_t hash)
+{
+    uint64_t bits = (uint64_t)table->bloom_words * 64;
+    uint64_t delta = (hash >> 33) | (hash << 31) | 1;
+    int i = 0;
+
+    /* 双重哈希，第 i 个哈希值为 hash + i * delta */
+    for (i = 0; i < RB_LSM_BLOOM_HASHES; i++, hash += delta) {
+        uint64_t bit = hash % bits;
+
+        if (!(table->bloom[bit / 64] & (1ull << (bit % 64)))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+RB_LSM_TABLE *rb_lsm_table_open(RB_LSM *lsm, uint64_t number)
+{
+    RB_LSM_TABLE *table = NULL;
+    char footer[RB_LSM_FOOTER_SIZE];
+    char *path = rb_lsm_path(lsm, number);
+    char *index = NULL;
+    uint64_t index_offset = 0;
+    uint64_t bloom_offset = 0;
+    size_t index_len = 0;
+    size_t pos = 0;
+    size_t keys = 0;
+    struct stat st;
+    uint32_t i = 0;
+
+    table = path ? malloc(sizeof(RB_LSM_TABLE)) : NULL;
+    if (!table) {
+        free(path);
+        return NULL;
+    }
+    memset(table, 0, sizeof(RB_LSM_TABLE));
+
+    table->number = number;
+    table->refs = 1;
+    table->fd = open(path, O_RDONLY);
+    free(path);
+
+    if (table->fd < 0 || fstat(table->fd, &st) || st.st_size < RB_LSM_FOOTER_SIZE ||
+        pread(table->fd, footer, RB_LSM_FOOTER_SIZE, st.st_size - RB_LSM_FOOTER_SIZE) != RB_LSM_FOOTER_SIZE ||
+        memcmp(footer + 32, RB_LSM_MAGIC, 8)) {
+        goto failed;
+    }
+
+    table->size = (uint64_t)st.st_size;
+    memcpy(&index_offset, footer, 8);
+    memcpy(&bloom_offset, footer + 8, 8);
+    memcpy(&table->count, footer + 16, 8);
+    memcpy(&table->block_count, footer + 24, 4);
+    memcpy(&table->bloom_words, footer + 28, 4);
+
+    if (index_offset > bloom_offset || !table->block_count || !table->bloom_words ||
+        bloom_offset + (uint64_t)table->bloom_words * 8 != table->size - RB_LSM_FOOTER_SIZE) {
+        goto failed;
+    }
+
+    index_len = bloom_offset - index_offset;
+    index = malloc(index_len);
+    table->offsets = malloc(sizeof(uint64_t) * table->block_count);
+    table->sizes = malloc(sizeof(uint32_t) * table->block_count);
+    table->keys = malloc(sizeof(char *) * table->block_count);
+    table->bloom = malloc(sizeof(uint64_t) * table->bloom_words);
+
+    if (!index || !table->offsets || !table->sizes || !table->keys || !table->bloom ||
+        pread(table->fd, index, index_len, index_offset) != (ssize_t)index_len ||
+        pread(table->fd, table->bloom, sizeof(uint64_t) * table->bloom_words, bloom_offset) !=
+            (ssize_t)(sizeof(uint64_t) * table->bloom_words)) {
+        goto failed;
+    }
+
+    /* 索引项中的键没有结尾的 0，复制到 key_data 中，第一遍只检查并统计长度 */
+    for (i = 0, pos = 0; i < table->block_count; i++) {
+        uint32_t len = 0;
+
+        if (index_len - pos < RB_LSM_INDEX_SIZE) {
+            goto failed;
+        }
+
+        memcpy(&table->offsets[i], index + pos, 8);
+        memcpy(&table->sizes[i], index + pos + 8, 4);
+        memcpy(&len, index + pos + 12, 4);
+
+        if (index_len - pos - RB_LSM_INDEX_SIZE < len ||
+            table->offsets[i] + table->sizes[i] > index_offset) {
+            goto failed;
+        }
+
+        pos += RB_LSM_INDEX_SIZE + len;
+        keys += len + 1;
+    }
+
+    table->key_data = malloc(keys);
+    if (!table->key_data) {
+        goto failed;
+    }
+
+    for (i = 0, pos = 0, keys = 0; i < table->block_count; i++) {
+        uint32_t len = 0;
+
+        memcpy(&len, index + pos + 12, 4);
+        table->keys[i] = table->key_data + keys;
+        memcpy(table->keys[i], index + pos + RB_LSM_INDEX_SIZE, len);
+        table->keys[i][len] = 0;
+
+        pos += RB_LSM_INDEX_SIZE + len;
+        keys += len + 1;
+    }
+
+    free(index);
+    return table;
+
+failed:
+    free(index);
+    rb_lsm_table_release(table);
+    return NULL;
+}
+
+void rb_lsm_table_release(RB_LSM_TABLE *table)
+{
+    if (--table->refs) {
+        return;
+    }
+
+    if (table->fd >= 0) {
+        close(table->fd);
+    }
+
+    free(table->offsets);
+    free(table->sizes);
+    free(table->keys);
+    free(table->key_data);
+    free(table->bloom);
+    free(table);
+}
+
+int rb_lsm_table_get(
+    RB_LSM_TABLE *table, const char *key, uint64_t hash, void *value, size_t *size, int *deleted)
+{
+    RB_LSM_ITER iter;
+    int ret = 1;
+
+    if (!rb_lsm_bloom_check(table, hash)) {
+        return 1;
+    }
+
+    memset(&iter, 0, sizeof(RB_LSM_ITER));
+    rb_lsm_iter_seek(&iter, table, key);
+
+    /* 只需要检查一个数据块，下一个数据块的第一个键一定大于 key */
+    while (iter.valid && strcmp(iter.key, key) < 0 && iter.next < iter.len) {
+        rb_lsm_iter_next(&iter);
+    }
+
+    if (iter.error) {
+        ret = -1;
+    } else if (iter.valid && !strcmp(iter.key, key)) {
+        *deleted = iter.deleted;
+        if (!iter.deleted) {
+            if (value) {
+                memcpy(value, iter.value, iter.size < *size ? iter.size : *size);
+            }
+            *size = iter.size;
+        }
+        ret = 0;
+    }
+
+    rb_lsm_iter_free(&iter);
+    return ret;
+}
+
+RB_LSM_TABLE **rb_lsm_table_ref(RB_LSM *lsm, int start, int *count)
+{
+    RB_LSM_TABLE **tables = NULL;
+    int i = 0;
+
+    *count = lsm->table_count - start;
+
+    /* 至少分配一项，没有表文件时也返回非 NULL */
+    tables = malloc(sizeof(RB_LSM_TABLE *) * (*count + 1));
+    if (!tables) {
+        return NULL;
+    }
+
+    for (i = 0; i < *count; i++) {
+        tables[i] = lsm->tables[lsm->table_count - 1 - i];
+        tables[i]->refs++;
+    }
+
+    return tables;
+}
+
+void rb_lsm_iter_seek(RB_LSM_ITER *iter, RB_LSM_TABLE *table, const char *key)
+{
+    uint32_t low = 0;
+    uint32_t high = table->block_count;
+
+    iter->table = table;
+
+    /* 查找最后一个第一个键不大于 key 的数据块，key 小于所有键时为第一个数据块 */
+    while (key && high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+
+        if (strcmp(table->keys[mid], key) <= 0) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    iter->block = low;
+    rb_lsm_iter_load(iter);
+}
+
+void rb_lsm_iter_next(RB_LSM_ITER *iter)
+{
+    if (!iter->table) {
+        /* 内存表副本 */
+        if (++iter->index < iter->count) {
+            RB_LSM_ENTRY *entry = iter->entries + iter->index;
+
+            iter->key = entry->key;
+            iter->value = entry->value->data;
+            iter->size = entry->value->size;
+            iter->deleted = entry->value->deleted;
+            iter->valid = 1;
+        } else {
+            iter->valid = 0;
+        }
+        return;
+    }
+
+    iter->pos = iter->next;
+    if (iter->pos < iter->len) {
+        rb_lsm_iter_decode(iter);
+        return;
+    }
+
+    if (++iter->block < iter->table->block_count) {
+        rb_lsm_iter_load(iter);
+    } else {
+        iter->valid = 0;
+    }
+}
+
+void rb_lsm_iter_load(RB_LSM_ITER *iter)
+{
+    RB_LSM_TABLE *table = iter->table;
+    size_t size = table->sizes[iter->block];
+
+    iter->valid = 0;
+
+    if (size > iter->buffer_size) {
+        char *buffer = realloc(iter->buffer, size);
+
+        if (!buffer) {
+            iter->error = 1;
+            return;
+        }
+
+        iter->buffer = buffer;
+        iter->buffer_size = size;
+    }
+
+    if (!size || pread(table->fd, iter->buffer, size, table->offsets[iter->block]) != (ssize_t)size) {
+        iter->error = 1;
+        return;
+    }
+
+    iter->len = size;
+    iter->pos = 0;
+    rb_lsm_iter_decode(iter);
+}
+
+void rb_lsm_iter_decode(RB_LSM_ITER *iter)
+{
+    uint32_t key_len = 0;
+    uint32_t value_len = 0;
+    size_t left = iter->len - iter->pos;
+    char *p = iter->buffer + iter->pos;
+
+    iter->valid = 0;
+
+    if (left < RB_LSM_RECORD_SIZE) {
+        iter->error = 1;
+        return;
+    }
+
+    /* 记录格式：键长、值长 | 键（带结尾的 0）、值 */
+    memcpy(&key_len, p, 4);
+    memcpy(&value_len, p + 4, 4);
+
+    iter->deleted = (value_len & RB_LSM_DELETED) != 0;
+    iter->size = value_len & ~RB_LSM_DELETED;
+
+    if (left - RB_LSM_RECORD_SIZE < (uint64_t)key_len + 1 + iter->size ||
+        p[RB_LSM_RECORD_SIZE + key_len] || !key_len) {
+        iter->error = 1;
+        return;
+    }
+
+    iter->key = p + RB_LSM_RECORD_SIZE;
+    iter->value = iter->key + key_len + 1;
+    iter->next = iter->pos + RB_LSM_RECORD_SIZE + key_len + 1 + iter->size;
+    iter->valid = 1;
+}
+
+void rb_lsm_iter_free(RB_LSM_ITER *iter)
+{
+    int i = 0;
+
+    for (i = 0; i < iter->count; i++) {
+        free(iter->entries[i].key);
+        free(iter->entries[i].value);
+    }
+
+    free(iter->entries);
+    free(iter->buffer);
+}
+
+int rb_lsm_merge_pick(RB_LSM_ITER *iters, int count)
+{
+    int pick = -1;
+    int i = 0;
+
+    for (i = 0; i < count; i++) {
+        if (iters[i].valid && (pick < 0 || strcmp(iters[i].key, iters[pick].key) < 0)) {
+            pick = i;
+        }
+    }
+
+    return pick;
+}
+
+void rb_lsm_merge_skip(RB_LSM_ITER *iters, int count, int pick)
+{
+    int i = 0;
+
+    /* 先跳过其它迭代器，iters[pick] 的键在移动之后失效 */
+    for (i = 0; i < count; i++) {
+        if (i != pick && iters[i].valid && !strcmp(iters[i].key, iters[pick].key)) {
+            rb_lsm_iter_next(iters + i);
+        }
+    }
+
+    rb_lsm_iter_next(iters + pick);
+}
+
+int rb_lsm_writer_open(RB_LSM_WRITER *writer, const char *path, uint64_t expect)
+{
+    memset(writer, 0, sizeof(RB_LSM_WRITER));
+
+    writer->bloom_words = (uint32_t)((expect * RB_LSM_BLOOM_BITS + 63) / 64);
+    if (!writer->bloom_words) {
+        writer->bloom_words = 1;
+    }
+
+    writer->bloom = malloc(sizeof(uint64_t) * writer->bloom_words);
+    writer->fp = writer->bloom ? fopen(path, "wb") : NULL;
+
+    if (!writer->fp) {
+        free(writer->bloom);
+        writer->bloom = NULL;
+        return -1;
+    }
+
+    memset(writer->bloom, 0, sizeof(uint64_t) * writer->bloom_words);
+    return 0;
+}
+
+void rb_lsm_writer_add(
+    RB_LSM_WRITER *writer, const char *key, const void *value, size_t size, int deleted)
+{
+    uint32_t key_len = (uint32_t)strlen(key);
+    uint32_t value_len = (uint32_t)size | (deleted ? RB_LSM_DELETED : 0);
+    size_t len = RB_LSM_RECORD_SIZE + key_len + 1 + size;
+    uint64_t bits = (uint64_t)writer->bloom_words * 64;
+    uint64_t hash = rb_lsm_hash(key);
+    uint64_t delta = (hash >> 33) | (hash << 31) | 1;
+    int i = 0;
+
+    if (writer->error) {
+        return;
+    }
+
+    if (writer->block_len + len > writer->block_size) {
+        size_t grow = writer->block_size ? writer->block_size : RB_LSM_BLOCK_SIZE * 2;
+        char *block = NULL;
+
+        while (grow < writer->block_len + len) {
+            grow *= 2;
+        }
+
+        block = realloc(writer->block, grow);
+        if (!block) {
+            writer->error = 1;
+            return;
+        }
+
+        writer->block = block;
+        writer->block_size = grow;
+    }
+
+    memcpy(writer->block + writer->block_len, &key_len, 4);
+    memcpy(writer->block + writer->block_len + 4, &value_len, 4);
+    memcpy(writer->block + writer->block_len + RB_LSM_RECORD_SIZE, key, key_len + 1);
+    if (size) {
+        memcpy(writer->block + writer->block_len + RB_LSM_RECORD_SIZE + key_len + 1, value, size);
+    }
+    writer->block_len += len;
+    writer->count++;
+
+    for (i = 0; i < RB_LSM_BLOOM_HASHES; i++, hash += delta) {
+        uint64_t bit = hash % bits;
+
+        writer->bloom[bit / 64] |= 1ull << (bit % 64);
+    }
+
+    if (writer->block_len >= RB_LSM_BLOCK_SIZE) {
+        rb_lsm_writer_block(writer);
+    }
+}
+
+void rb_lsm_writer_block(RB_LSM_WRITER *writer)
+{
+    uint32_t size = (uint32_t)writer->block_len;
+    uint32_t key_len = 0;
+    char *p = NULL;
+
+    if (writer->error || !writer->block_len) {
+        return;
+    }
+
+    /* 索引项：偏移量、大小、第一个键的长度和第一个键 */
+    memcpy(&key_len, writer->block, 4);
+
+    if (writer->index_len + RB_LSM_INDEX_SIZE + key_len > writer->index_size) {
+        size_t grow = writer->index_size ? writer->index_size : 4096;
+
+        while (grow < writer->index_len + RB_LSM_INDEX_SIZE + key_len) {
+            grow *= 2;
+        }
+
+        p = realloc(writer->index, grow);
+        if (!p) {
+            writer->error = 1;
+            return;
+        }
+
+        writer->index = p;
+        writer->index_size = grow;
+    }
+
+    p = writer->index + writer->index_len;
+    memcpy(p, &writer->offset, 8);
+    memcpy(p + 8, &size, 4);
+    memcpy(p + 12, &key_len, 4);
+    memcpy(p + RB_LSM_INDEX_SIZE, writer->block + RB_LSM_RECORD_SIZE, key_len);
+    writer->index_len += RB_LSM_INDEX_SIZE + key_len;
+
+    if (fwrite(writer->block, 1, size, writer->fp) != size) {
+        writer->error = 1;
+        return;
+    }
+
+    writer->offset += size;
+    writer->block_len = 0;
+    writer->block_count++;
+}
+
+int rb_lsm_writer_finish(RB_LSM_WRITER *writer)
+{
+    char footer[RB_LSM_FOOTER_SIZE];
+    uint64_t bloom_offset = 0;
+    int error = 0;
+
+    rb_lsm_writer_block(writer);
+
+    /* 文件尾：索引偏移量、过滤器偏移量、记录数、数据块数、过滤器字数、魔数 */
+    bloom_offset = writer->offset + writer->index_len;
+    memcpy(footer, &writer->offset, 8);
+    memcpy(footer + 8, &bloom_offset, 8);
+    memcpy(footer + 16, &writer->count, 8);
+    memcpy(footer + 24, &writer->block_count, 4);
+    memcpy(footer + 28, &writer->bloom_words, 4);
+    memcpy(footer + 32, RB_LSM_MAGIC, 8);
+
+    error = writer->error;
+    if (!error) {
+        error |= fwrite(writer->index, 1, writer->index_len, writer->fp) != writer->index_len;
+        error |= fwrite(writer->bloom, sizeof(uint64_t), writer->bloom_words, writer->fp) != writer->bloom_words;
+        error |= fwrite(footer, 1, RB_LSM_FOOTER_SIZE, writer->fp) != RB_LSM_FOOTER_SIZE;
+        error |= fflush(writer->fp) != 0;
+        error |= fsync(fileno(writer->fp)) != 0;
+    }
+
+    error |= fclose(writer->fp) != 0;
+
+    free(writer->block);
+    free(writer->index);
+    free(writer->bloom);
+    return error ? -1 : 0;
+}
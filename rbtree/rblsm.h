@@ -0,0 +1,79 @@
+#ifndef __RBLSM_H__
+#define __RBLSM_H__
+
+#include <stddef.h>
+
+/**
+ * 以红黑树为内存表的 LSM 键值存储
+ *
+ * 数据先写入内存中的红黑树，超过一定大小后转为只读并由后台线程刷写到磁盘，磁盘上的数据
+ * 保存在多个有序且不再修改的表文件中：
+ *
+ * 1.刷写 -- 按键的顺序遍历只读内存表，写入新的表文件，刷写期间新的修改写入另一个内存表，
+ *   两个内存表都满时写入等待刷写完成；
+ * 2.表文件 -- 记录按键的顺序存放在约 4KB 的数据块中，文件末尾是稀疏索引（每个数据块的第一个
+ *   键）和布隆过滤器，打开时只将索引和过滤器读入内存，查找时最多读取一个数据块；
+ * 3.合并 -- 表文件数目达到阈值时后台线程将较新且大小相近的若干个表合并为一个，同一个键只保留
+ *   最新的记录，合并到最旧的表时丢弃删除标记；
+ * 4.读取 -- 依次查找内存表、只读内存表和从新到旧的表文件，第一次找到的记录即为最新的值，
+ *   范围查询对所有数据源做多路归并。
+ *
+ * 表文件的列表保存在 MANIFEST 中，先写入临时文件再重命名。内存表没有日志保护，进程崩溃时
+ * 丢失尚未刷写的修改，rb_lsm_flush 和 rb_lsm_close 将其写入磁盘。所有函数都可以在多个线程中
+ * 同时调用，刷写和合并由同一个后台线程依次执行。
+ */
+typedef struct rb_lsm_st RB_LSM;
+
+/* 内存表达到该大小时刷写 */
+#define RB_LSM_MEMTABLE_SIZE (4 * 1024 * 1024)
+
+/**
+ * 打开目录 dir 中的数据，目录不存在时创建
+ *
+ * memtable_size 为内存表刷写的大小，为 0 时使用 RB_LSM_MEMTABLE_SIZE。
+ */
+RB_LSM *rb_lsm_open(const char *dir, size_t memtable_size);
+
+/**
+ * 刷写内存表并等待后台线程结束后关闭
+ *
+ * 无论成功与否都释放 lsm。写表文件失败或者此前后台线程已经出错时返回 -1，此时内存表中
+ * 尚未刷写的修改已经丢失，磁盘上保留最后一次成功刷写的状态。
+ */
+int rb_lsm_close(RB_LSM *lsm);
+
+/* 删除目录中的所有数据文件和目录本身，不能在打开时调用 */
+int rb_lsm_destroy(const char *dir);
+
+/* 插入或者替换键的值，值复制到内存表中 */
+int rb_lsm_put(RB_LSM *lsm, const char *key, const void *value, size_t size);
+
+/* 删除键，写入删除标记，键不存在时也返回 0 */
+int rb_lsm_delete(RB_LSM *lsm, const char *key);
+
+/**
+ * 查找键，将值复制到 value 中，最多复制 *size 字节，size 返回值的实际大小
+ *
+ * value 可以为 NULL，此时只获取值的大小。键不存在或者已删除返回 -1。
+ */
+int rb_lsm_get(RB_LSM *lsm, const char *key, void *value, size_t *size);
+
+/**
+ * 按键的顺序遍历 [start, end) 中的键，start 或者 end 为 NULL 表示不限制
+ *
+ * 内存表在开始时复制，遍历期间不持有锁，visit 中可以修改，但修改不一定可见；value 只在
+ * visit 调用期间有效。
+ */
+int rb_lsm_scan(RB_LSM *lsm, const char *start, const char *end,
+    void (*visit)(const char *key, const void *value, size_t size, void *args), void *args);
+
+/* 将内存表写入表文件，返回时数据已经持久化 */
+int rb_lsm_flush(RB_LSM *lsm);
+
+/* 刷写内存表后将所有表文件合并为一个，并丢弃所有删除标记 */
+int rb_lsm_compact(RB_LSM *lsm);
+
+/* 获取表文件的数目 */
+int rb_lsm_table_count(RB_LSM *lsm);
+
+#endif /* __RBLSM_H__ */
@@ -0,0 +1,961 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "rbmmap.h"
+
+/*===========================================================================*/
+
+#define RBM_COLOR_RED   0      /* 定义红色 */
+#define RBM_COLOR_BLACK 1      /* 定义黑色 */
+#define RBM_COLOR_MASK  1      /* 颜色掩码 */
+
+#define RBM_MAGIC        "RBMMAP1"      /* 包括结尾的 0 共 8 字节 */
+#define RBM_VERSION      1
+#define RBM_HEADER_SIZE  4096           /* 文件头独占一页，修改标记时只需要同步这一页 */
+#define RBM_INITIAL_SIZE (1024 * 1024)  /* 新文件的大小，之后按倍数增长 */
+#define RBM_MIN_BLOCK    32             /* 最小的块，也是所有块的对齐单位 */
+#define RBM_CLASSES      40             /* 块的大小为 RBM_MIN_BLOCK 的 2 的幂倍，按大小分级 */
+#define RBM_MAX_HEIGHT   128            /* 检查时允许的最大深度，超过说明结构已经损坏 */
+
+/* 文件头，位于文件起始位置，因此偏移量 0 可以表示空结点 */
+typedef struct rbm_header_st
+{
+    char magic[8];
+    uint32_t version;
+
+    /* 上次检查点之后没有修改时为 1 */
+    uint32_t clean;
+
+    /* 已经分配的空间，之后的空间尚未使用 */
+    uint64_t used;
+
+    uint64_t root;
+    uint64_t count;
+
+    /* 执行检查点的次数 */
+    uint64_t generation;
+
+    /* 各级空闲块链表，空闲块的前 8 个字节存放下一个空闲块的偏移量 */
+    uint64_t free[RBM_CLASSES];
+} RBM_HEADER;
+
+/**
+ * 文件中的结点，键（包括结尾的 0）和值紧跟在结点之后
+ *
+ * 块按 RBM_MIN_BLOCK 对齐，父结点偏移量的最低位总是 0，用来存放颜色。键与结点位于
+ * 同一个块中，比较时不需要访问其它位置的内存。
+ */
+typedef struct rbm_node_st
+{
+    uint64_t parent_color;
+    uint64_t left;
+    uint64_t right;
+
+    uint32_t key_size;
+    uint32_t value_size;
+} RBM_NODE;
+
+/* 内存映射的红黑树 */
+struct rbm_tree_st
+{
+    int fd;
+
+    /* 映射的起始地址和文件大小 */
+    char *base;
+    size_t size;
+
+    RBM_HEADER *header;
+};
+
+/* 将文件的前 size 字节映射到内存，成功后才解除原来的映射 */
+static int rbm_map(RBM_TREE *tree, size_t size);
+
+/* 校验文件头 */
+static int rbm_check_header(const RBM_TREE *tree);
+
+/* 检查 offset 处的结点是否有效，并且父结点为 parent */
+static int rbm_check_node(const RBM_TREE *tree, uint64_t offset, uint64_t parent);
+
+/* 检查空闲链表 */
+static int rbm_check_free(const RBM_TREE *tree);
+
+/* 检查点之后第一次修改时，先同步写入文件不一致的标记 */
+static int rbm_modify(RBM_TREE *tree);
+
+/* 获取能容纳 size 字节的块的级别 */
+static int rbm_block_class(uint64_t size);
+
+/* 申请 size 字节的块，文件空间不足时增长，失败返回 0 */
+static uint64_t rbm_alloc(RBM_TREE *tree, uint64_t size);
+
+/* 将结点所在的块放回空闲链表 */
+static void rbm_free(RBM_TREE *tree, uint64_t offset);
+
+/* 偏移量对应的结点 */
+static RBM_NODE *rbm_node(const RBM_TREE *tree, uint64_t offset);
+
+/* 结点的键 */
+static const char *rbm_node_key(const RBM_NODE *node);
+
+/* 颜色和父结点的获取与设置，空结点为黑色 */
+static unsigned int rbm_get_color(const RBM_TREE *tree, uint64_t offset);
+static void rbm_set_color(RBM_TREE *tree, uint64_t offset, unsigned int color);
+static uint64_t rbm_get_parent(const RBM_TREE *tree, uint64_t offset);
+static void rbm_set_parent(RBM_TREE *tree, uint64_t offset, uint64_t parent);
+
+/* 左旋和右旋 */
+static void rbm_left_rotate(RBM_TREE *tree, uint64_t offset);
+static void rbm_right_rotate(RBM_TREE *tree, uint64_t offset);
+
+/* 插入和删除后恢复红黑树的性质 */
+static void rbm_insert_fixup(RBM_TREE *tree, uint64_t offset);
+static void rbm_delete_fixup(RBM_TREE *tree, uint64_t offset, uint64_t parent);
+
+/* 用以 src 为根的子树替换以 dest 为根的子树 */
+static void rbm_transplant(RBM_TREE *tree, uint64_t dest, uint64_t src);
+
+/* 查找键，返回结点的偏移量，不存在时返回 0，parent 返回最后访问的结点，cmp 返回与它比较的结果 */
+static uint64_t rbm_search(const RBM_TREE *tree, const char *key, uint64_t *parent, int *cmp);
+
+/* 获取后继结点 */
+static uint64_t rbm_next(const RBM_TREE *tree, uint64_t offset);
+
+/*===========================================================================*/
+
+RBM_TREE *rbm_open(const char *path, int flags)
+{
+    RBM_TREE *tree = NULL;
+    struct stat st;
+    int created = 0;
+
+    if (!path) {
+        return NULL;
+    }
+
+    tree = malloc(sizeof(RBM_TREE));
+    if (!tree) {
+        return NULL;
+    }
+    memset(tree, 0, sizeof(RBM_TREE));
+
+    tree->fd = open(path, O_RDWR | ((flags & RBM_CREATE) ? O_CREAT : 0), 0644);
+    if (tree->fd < 0) {
+        free(tree);
+        return NULL;
+    }
+
+    /* 两处同时修改会破坏文件，锁在关闭文件时释放 */
+    if (flock(tree->fd, LOCK_EX | LOCK_NB) || fstat(tree->fd, &st)) {
+        goto failed;
+    }
+
+    if (!st.st_size) {
+        /* 新文件 */
+        if (!(flags & RBM_CREATE) || ftruncate(tree->fd, RBM_INITIAL_SIZE)) {
+            goto failed;
+        }
+        st.st_size = RBM_INITIAL_SIZE;
+        created = 1;
+    }
+
+    if ((size_t)st.st_size < RBM_HEADER_SIZE || rbm_map(tree, (size_t)st.st_size)) {
+        goto failed;
+    }
+
+    if (created) {
+        memcpy(tree->header->magic, RBM_MAGIC, sizeof(tree->header->magic));
+        tree->header->version = RBM_VERSION;
+        tree->header->clean = 1;
+        tree->header->used = RBM_HEADER_SIZE;
+
+        if (msync(tree->base, RBM_HEADER_SIZE, MS_SYNC)) {
+            goto failed;
+        }
+    }
+
+    /* 正常关闭的文件只校验文件头，打开的时间与树的大小无关 */
+    if (rbm_check_header(tree) || (!tree->header->clean && rbm_check(tree))) {
+        goto failed;
+    }
+
+    return tree;
+
+failed:
+    if (tree->base) {
+        munmap(tree->base, tree->size);
+    }
+    close(tree->fd);
+    free(tree);
+    return NULL;
+}
+
+void rbm_close(RBM_TREE *tree)
+{
+    if (!tree) {
+        return;
+    }
+
+    rbm_checkpoint(tree);
+
+    munmap(tree->base, tree->size);
+    close(tree->fd);
+    free(tree);
+}
+
+int rbm_insert(RBM_TREE *tree, const char *key, const void *value, size_t size)
+{
+    RBM_NODE *node = NULL;
+    uint64_t parent = 0;
+    uint64_t offset = 0;
+    size_t key_size = 0;
+    int cmp = 0;
+
+    if (!tree || !key || !*key || (size && !value)) {
+        return -1;
+    }
+
+    key_size = strlen(key) + 1;
+    if (key_size > UINT32_MAX || size > UINT32_MAX) {
+        return -1;
+    }
+
+    if (rbm_search(tree, key, &parent, &cmp)) {
+        /* 键已存在 */
+        return -1;
+    }
+
+    if (rbm_modify(tree)) {
+        return -1;
+    }
+
+    /* 申请可能重新映射文件，偏移量不变，之后才获取结点地址 */
+    offset = rbm_alloc(tree, sizeof(RBM_NODE) + key_size + size);
+    if (!offset) {
+        return -1;
+    }
+
+    node = rbm_node(tree, offset);
+    node->parent_color = parent | RBM_COLOR_RED;
+    node->left = 0;
+    node->right = 0;
+    node->key_size = (uint32_t)key_size;
+    node->value_size = (uint32_t)size;
+    memcpy(node + 1, key, key_size);
+    if (size) {
+        memcpy((char *)(node + 1) + key_size, value, size);
+    }
+
+    if (!parent) {
+        tree->header->root = offset;
+    } else if (cmp < 0) {
+        rbm_node(tree, parent)->left = offset;
+    } else {
+        rbm_node(tree, parent)->right = offset;
+    }
+
+    rbm_insert_fixup(tree, offset);
+    tree->header->count++;
+    return 0;
+}
+
+int rbm_delete(RBM_TREE *tree, const char *key)
+{
+    RBM_NODE *target = NULL;
+    uint64_t offset = 0;
+    uint64_t child = 0;
+    uint64_t parent = 0;
+    unsigned int color = RBM_COLOR_RED;
+    int cmp = 0;
+
+    if (!tree || !key || !*key) {
+        return -1;
+    }
+
+    offset = rbm_search(tree, key, &parent, &cmp);
+    if (!offset) {
+        return -1;
+    }
+
+    if (rbm_modify(tree)) {
+        return -1;
+    }
+
+    target = rbm_node(tree, offset);
+    color = rbm_get_color(tree, offset);
+
+    if (!target->left) {
+        child = target->right;
+        parent = rbm_get_parent(tree, offset);
+        rbm_transplant(tree, offset, child);
+    } else if (!target->right) {
+        child = target->left;
+        parent = rbm_get_parent(tree, offset);
+        rbm_transplant(tree, offset, child);
+    } else {
+        /* 用后继结点代替被删除的结点，结点大小不同，所以重新链接而不是交换内容 */
+        uint64_t mini = target->right;
+        RBM_NODE *succ = NULL;
+
+        while (rbm_node(tree, mini)->left) {
+            mini = rbm_node(tree, mini)->left;
+        }
+
+        succ = rbm_node(tree, mini);
+        color = rbm_get_color(tree, mini);
+        child = succ->right;
+
+        if (rbm_get_parent(tree, mini) == offset) {
+            parent = mini;
+        } else {
+            parent = rbm_get_parent(tree, mini);
+            rbm_transplant(tree, mini, child);
+
+            succ->right = target->right;
+            rbm_set_parent(tree, succ->right, mini);
+        }
+
+        rbm_transplant(tree, offset, mini);
+        succ->left = target->left;
+        rbm_set_parent(tree, succ->left, mini);
+        rbm_set_color(tree, mini, rbm_get_color(tree, offset));
+    }
+
+    if (color == RBM_COLOR_BLACK) {
+        rbm_delete_fixup(tree, child, parent);
+    }
+
+    rbm_free(tree, offset);
+    tree->header->count--;
+    return 0;
+}
+
+int rbm_find(RBM_TREE *tree, const char *key, const void **value, size_t *size)
+{
+    const RBM_NODE *node = NULL;
+    uint64_t offset = 0;
+    uint64_t parent = 0;
+    int cmp = 0;
+
+    if (!tree || !key || !*key || !value) {
+        return -1;
+    }
+
+    offset = rbm_search(tree, key, &parent, &cmp);
+    if (!offset) {
+        return -1;
+    }
+
+    node = rbm_node(tree, offset);
+    *value = (const char *)(node + 1) + node->key_size;
+
+    if (size) {
+        *size = node->value_size;
+    }
+
+    return 0;
+}
+
+int rbm_count(const RBM_TREE *tree)
+{
+    return tree ? (int)tree->header->count : 0;
+}
+
+int rbm_iterate(
+    RBM_TREE *tree, void (*visit)(const char *key, const void *value, size_t size, void *args), void *args)
+{
+    uint64_t offset = 0;
+
+    if (!tree || !visit) {
+        return -1;
+    }
+
+    offset = tree->header->root;
+    if (!offset) {
+        return 0;
+    }
+
+    while (rbm_node(tree, offset)->left) {
+        offset = rbm_node(tree, offset)->left;
+    }
+
+    for (; offset; offset = rbm_next(tree, offset)) {
+        const RBM_NODE *node = rbm_node(tree, offset);
+
+        visit(rbm_node_key(node), (const char *)(node + 1) + node->key_size, node->value_size, args);
+    }
+
+    return 0;
+}
+
+int rbm_checkpoint(RBM_TREE *tree)
+{
+    if (!tree) {
+        return -1;
+    }
+
+    if (tree->header->clean) {
+        return 0;
+    }
+
+    /* 先同步所有数据，再同步一致的标记，标记写入文件时数据一定已经写入 */
+    if (msync(tree->base, tree->size, MS_SYNC)) {
+        return -1;
+    }
+
+    tree->header->clean = 1;
+    tree->header->generation++;
+    return msync(tree->base, RBM_HEADER_SIZE, MS_SYNC) ? -1 : 0;
+}
+
+int rbm_check(RBM_TREE *tree)
+{
+    const RBM_HEADER *header = NULL;
+    const char *prev = NULL;
+    uint64_t offset = 0;
+    uint64_t count = 0;
+    int black = 0;
+    int height = -1;
+    int depth = 0;
+
+    if (!tree || rbm_check_header(tree) || rbm_check_free(tree)) {
+        return -1;
+    }
+
+    header = tree->header;
+    offset = header->root;
+
+    if (!offset) {
+        return header->count ? -1 : 0;
+    }
+
+    if (rbm_check_node(tree, offset, 0) || rbm_get_color(tree, offset) != RBM_COLOR_BLACK) {
+        return -1;
+    }
+
+    /**
+     * 借助父结点中序遍历。向下移动前检查孩子的父结点是否指向当前结点，所以回溯时一定
+     * 沿原路返回，损坏的文件不会使遍历出现环路。black 为路径上的黑色结点数，每到达一个
+     * 空孩子时与其它路径比较。
+     */
+    black = 1;
+    depth = 1;
+
+    for (;;) {
+        const RBM_NODE *node = rbm_node(tree, offset);
+
+        /* 移动到最左侧的结点 */
+        while (node->left) {
+            uint64_t child = node->left;
+
+            if (rbm_check_node(tree, child, offset) || ++depth > RBM_MAX_HEIGHT) {
+                return -1;
+            }
+
+            offset = child;
+            node = rbm_node(tree, offset);
+            black += rbm_get_color(tree, offset) == RBM_COLOR_BLACK;
+        }
+
+        if (height < 0) {
+            height = black;
+        } else if (black != height) {
+            return -1;
+        }
+
+        for (;;) {
+            const char *key = rbm_node_key(node);
+            uint64_t parent = 0;
+
+            if ((prev && strcmp(prev, key) >= 0) || ++count > header->count) {
+                return -1;
+            }
+            prev = key;
+
+            if (node->right) {
+                uint64_t child = node->right;
+
+                if (child == node->left || rbm_check_node(tree, child, offset) || ++depth > RBM_MAX_HEIGHT) {
+                    return -1;
+                }
+
+                offset = child;
+                black += rbm_get_color(tree, offset) == RBM_COLOR_BLACK;
+                break;
+            }
+
+            if (black != height) {
+                return -1;
+            }
+
+            /* 回溯到第一个从左子树返回的祖先 */
+            for (;;) {
+                parent = rbm_get_parent(tree, offset);
+                black -= rbm_get_color(tree, offset) == RBM_COLOR_BLACK;
+                depth--;
+
+                if (!parent) {
+                    return count == header->count ? 0 : -1;
+                }
+
+                if (rbm_node(tree, parent)->left == offset) {
+                    offset = parent;
+                    break;
+                }
+
+                offset = parent;
+            }
+
+            node = rbm_node(tree, offset);
+        }
+    }
+}
+
+/*-------------------------------------------------------*/
+
+int rbm_map(RBM_TREE *tree, size_t size)
+{
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, tree->fd, 0);
+
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    if (tree->base) {
+        munmap(tree->base, tree->size);
+    }
+
+    tree->base = base;
+    tree->size = size;
+    tree->header = (RBM_HEADER *)base;
+    return 0;
+}
+
+int rbm_check_header(const RBM_TREE *tree)
+{
+    const RBM_HEADER *header = tree->header;
+
+    if (memcmp(header->magic, RBM_MAGIC, sizeof(header->magic)) || header->version != RBM_VERSION) {
+        return -1;
+    }
+
+    if (header->used < RBM_HEADER_SIZE || header->used > tree->size || header->used % RBM_MIN_BLOCK) {
+        return -1;
+    }
+
+    if (header->root >= header->used) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int rbm_check_node(const RBM_TREE *tree, uint64_t offset, uint64_t parent)
+{
+    const RBM_NODE *node = NULL;
+    uint64_t used = tree->header->used;
+
+    /* 偏移量来自文件，可能接近 2^64，用减法比较避免溢出 */
+    if (offset < RBM_HEADER_SIZE || offset % RBM_MIN_BLOCK || offset > used ||
+        used - offset < sizeof(RBM_NODE)) {
+        return -1;
+    }
+
+    node = rbm_node(tree, offset);
+
+    /* 键非空，并且结点、键和值都在已分配的空间内 */
+    if (node->key_size < 2 ||
+        sizeof(RBM_NODE) + (uint64_t)node->key_size + node->value_size > used - offset) {
+        return -1;
+    }
+
+    if (strnlen(rbm_node_key(node), node->key_size) != node->key_size - 1) {
+        return -1;
+    }
+
+    if (rbm_get_parent(tree, offset) != parent) {
+        return -1;
+    }
+
+    /* 红色结点的父结点不能是红色 */
+    if (parent && rbm_get_color(tree, offset) == RBM_COLOR_RED &&
+        rbm_get_color(tree, parent) == RBM_COLOR_RED) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int rbm_check_free(const RBM_TREE *tree)
+{
+    const RBM_HEADER *header = tree->header;
+    int i = 0;
+
+    for (; i < RBM_CLASSES; i++) {
+        uint64_t block = (uint64_t)RBM_MIN_BLOCK << i;
+        uint64_t offset = header->free[i];
+        uint64_t steps = 0;
+
+        /* 链表长度不会超过已分配空间能容纳的块数，超过说明出现了环路 */
+        for (; offset; offset = *(const uint64_t *)(tree->base + offset)) {
+            if (offset < RBM_HEADER_SIZE || offset % RBM_MIN_BLOCK || offset > header->used ||
+                header->used - offset < block) {
+                return -1;
+            }
+
+            if (++steps > header->used / block) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int rbm_modify(RBM_TREE *tree)
+{
+    if (!tree->header->clean) {
+        return 0;
+    }
+
+    /* 标记必须先于任何修改写入文件，否则崩溃后可能把不一致的文件当作一致的 */
+    tree->header->clean = 0;
+    return msync(tree->base, RBM_HEADER_SIZE, MS_SYNC) ? -1 : 0;
+}
+
+int rbm_block_class(uint64_t size)
+{
+    int cls = 0;
+
+    while (((uint64_t)RBM_MIN_BLOCK << cls) < size) {
+        cls++;
+    }
+
+    return cls;
+}
+
+uint64_t rbm_alloc(RBM_TREE *tree, uint64_t size)
+{
+    int cls = rbm_block_class(size);
+    uint64_t block = (uint64_t)RBM_MIN_BLOCK << cls;
+    uint64_t offset = 0;
+
+    if (cls >= RBM_CLASSES) {
+        return 0;
+    }
+
+    offset = tree->header->free[cls];
+    if (offset) {
+        tree->header->free[cls] = *(uint64_t *)(tree->base + offset);
+        return offset;
+    }
+
+    if (tree->header->used + block > tree->size) {
+        size_t grow = tree->size;
+
+        while (tree->header->used + block > grow) {
+            grow *= 2;
+        }
+
+        if (ftruncate(tree->fd, (off_t)grow) || rbm_map(tree, grow)) {
+            return 0;
+        }
+    }
+
+    offset = tree->header->used;
+    tree->header->used += block;
+    return offset;
+}
+
+void rbm_free(RBM_TREE *tree, uint64_t offset)
+{
+    const RBM_NODE *node = rbm_node(tree, offset);
+    int cls = rbm_block_class(sizeof(RBM_NODE) + (uint64_t)node->key_size + node->value_size);
+
+    *(uint64_t *)(tree->base + offset) = tree->header->free[cls];
+    tree->header->free[cls] = offset;
+}
+
+RBM_NODE *rbm_node(const RBM_TREE *tree, uint64_t offset)
+{
+    return (RBM_NODE *)(tree->base + offset);
+}
+
+const char *rbm_node_key(const RBM_NODE *node)
+{
+    return (const char *)(node + 1);
+}
+
+unsigned int rbm_get_color(const RBM_TREE *tree, uint64_t offset)
+{
+    if (!offset) {
+        return RBM_COLOR_BLACK;
+    }
+
+    return rbm_node(tree, offset)->parent_color & RBM_COLOR_MASK;
+}
+
+void rbm_set_color(RBM_TREE *tree, uint64_t offset, unsigned int color)
+{
+    RBM_NODE *node = NULL;
+
+    if (!offset) {
+        return;
+    }
+
+    node = rbm_node(tree, offset);
+    node->parent_color = (node->parent_color & ~(uint64_t)RBM_COLOR_MASK) | color;
+}
+
+uint64_t rbm_get_parent(const RBM_TREE *tree, uint64_t offset)
+{
+    return rbm_node(tree, offset)->parent_color & ~(uint64_t)RBM_COLOR_MASK;
+}
+
+void rbm_set_parent(RBM_TREE *tree, uint64_t offset, uint64_t parent)
+{
+    RBM_NODE *node = NULL;
+
+    if (!offset) {
+        return;
+    }
+
+    node = rbm_node(tree, offset);
+    node->parent_color = parent | (node->parent_color & RBM_COLOR_MASK);
+}
+
+void rbm_left_rotate(RBM_TREE *tree, uint64_t offset)
+{
+    RBM_NODE *node = rbm_node(tree, offset);
+    uint64_t right = node->right;
+    RBM_NODE *y = rbm_node(tree, right);
+    uint64_t parent = rbm_get_parent(tree, offset);
+
+    node->right = y->left;
+    rbm_set_parent(tree, y->left, offset);
+
+    rbm_set_parent(tree, right, parent);
+
+    if (!parent) {
+        tree->header->root = right;
+    } else if (rbm_node(tree, parent)->left == offset) {
+        rbm_node(tree, parent)->left = right;
+    } else {
+        rbm_node(tree, parent)->right = right;
+    }
+
+    y->left = offset;
+    rbm_set_parent(tree, offset, right);
+}
+
+void rbm_right_rotate(RBM_TREE *tree, uint64_t offset)
+{
+    RBM_NODE *node = rbm_node(tree, offset);
+    uint64_t left = node->left;
+    RBM_NODE *x = rbm_node(tree, left);
+    uint64_t parent = rbm_get_parent(tree, offset);
+
+    node->left = x->right;
+    rbm_set_parent(tree, x->right, offset);
+
+    rbm_set_parent(tree, left, parent);
+
+    if (!parent) {
+        tree->header->root = left;
+    } else if (rbm_node(tree, parent)->left == offset) {
+        rbm_node(tree, parent)->left = left;
+    } else {
+        rbm_node(tree, parent)->right = left;
+    }
+
+    x->right = offset;
+    rbm_set_parent(tree, offset, left);
+}
+
+void rbm_insert_fixup(RBM_TREE *tree, uint64_t offset)
+{
+    uint64_t parent = 0;
+
+    while ((parent = rbm_get_parent(tree, offset)) && rbm_get_color(tree, parent) == RBM_COLOR_RED) {
+        /* 父结点是红色，一定不是根结点，所以祖父结点存在 */
+        uint64_t grand = rbm_get_parent(tree, parent);
+        uint64_t uncle = 0;
+
+        if (parent == rbm_node(tree, grand)->left) {
+            uncle = rbm_node(tree, grand)->right;
+
+            if (rbm_get_color(tree, uncle) == RBM_COLOR_RED) {
+                rbm_set_color(tree, uncle, RBM_COLOR_BLACK);
+                rbm_set_color(tree, parent, RBM_COLOR_BLACK);
+                rbm_set_color(tree, grand, RBM_COLOR_RED);
+                offset = grand;
+                continue;
+            }
+
+            if (offset == rbm_node(tree, parent)->right) {
+                offset = parent;
+                rbm_left_rotate(tree, offset);
+                parent = rbm_get_parent(tree, offset);
+            }
+
+            rbm_set_color(tree, parent, RBM_COLOR_BLACK);
+            rbm_set_color(tree, grand, RBM_COLOR_RED);
+            rbm_right_rotate(tree, grand);
+        } else {
+            uncle = rbm_node(tree, grand)->left;
+
+            if (rbm_get_color(tree, uncle) == RBM_COLOR_RED) {
+                rbm_set_color(tree, uncle, RBM_COLOR_BLACK);
+                rbm_set_color(tree, parent, RBM_COLOR_BLACK);
+                rbm_set_color(tree, grand, RBM_COLOR_RED);
+                offset = grand;
+                continue;
+            }
+
+            if (offset == rbm_node(tree, parent)->left) {
+                offset = parent;
+                rbm_right_rotate(tree, offset);
+                parent = rbm_get_parent(tree, offset);
+            }
+
+            rbm_set_color(tree, parent, RBM_COLOR_BLACK);
+            rbm_set_color(tree, grand, RBM_COLOR_RED);
+            rbm_left_rotate(tree, grand);
+        }
+    }
+
+    rbm_set_color(tree, tree->header->root, RBM_COLOR_BLACK);
+}
+
+void rbm_delete_fixup(RBM_TREE *tree, uint64_t offset, uint64_t parent)
+{
+    while (offset != tree->header->root && rbm_get_color(tree, offset) == RBM_COLOR_BLACK) {
+        RBM_NODE *node = rbm_node(tree, parent);
+
+        if (offset == node->left) {
+            uint64_t brother = node->right;
+
+            if (rbm_get_color(tree, brother) == RBM_COLOR_RED) {
+                rbm_set_color(tree, brother, RBM_COLOR_BLACK);
+                rbm_set_color(tree, parent, RBM_COLOR_RED);
+                rbm_left_rotate(tree, parent);
+                brother = node->right;
+            }
+
+            if (rbm_get_color(tree, rbm_node(tree, brother)->left) == RBM_COLOR_BLACK &&
+                rbm_get_color(tree, rbm_node(tree, brother)->right) == RBM_COLOR_BLACK) {
+                rbm_set_color(tree, brother, RBM_COLOR_RED);
+                offset = parent;
+                parent = rbm_get_parent(tree, offset);
+            } else {
+                if (rbm_get_color(tree, rbm_node(tree, brother)->right) == RBM_COLOR_BLACK) {
+                    rbm_set_color(tree, rbm_node(tree, brother)->left, RBM_COLOR_BLACK);
+                    rbm_set_color(tree, brother, RBM_COLOR_RED);
+                    rbm_right_rotate(tree, brother);
+                    brother = node->right;
+                }
+
+                rbm_set_color(tree, brother, rbm_get_color(tree, parent));
+                rbm_set_color(tree, parent, RBM_COLOR_BLACK);
+                rbm_set_color(tree, rbm_node(tree, brother)->right, RBM_COLOR_BLACK);
+                rbm_left_rotate(tree, parent);
+                offset = tree->header->root;
+            }
+        } else {
+            uint64_t brother = node->left;
+
+            if (rbm_get_color(tree, brother) == RBM_COLOR_RED) {
+                rbm_set_color(tree, brother, RBM_COLOR_BLACK);
+                rbm_set_color(tree, parent, RBM_COLOR_RED);
+                rbm_right_rotate(tree, parent);
+                brother = node->left;
+            }
+
+            if (rbm_get_color(tree, rbm_node(tree, brother)->right) == RBM_COLOR_BLACK &&
+                rbm_get_color(tree, rbm_node(tree, brother)->left) == RBM_COLOR_BLACK) {
+                rbm_set_color(tree, brother, RBM_COLOR_RED);
+                offset = parent;
+                parent = rbm_get_parent(tree, offset);
+            } else {
+                if (rbm_get_color(tree, rbm_node(tree, brother)->left) == RBM_COLOR_BLACK) {
+                    rbm_set_color(tree, rbm_node(tree, brother)->right, RBM_COLOR_BLACK);
+                    rbm_set_color(tree, brother, RBM_COLOR_RED);
+                    rbm_left_rotate(tree, brother);
+                    brother = node->left;
+                }
+
+                rbm_set_color(tree, brother, rbm_get_color(tree, parent));
+                rbm_set_color(tree, parent, RBM_COLOR_BLACK);
+                rbm_set_color(tree, rbm_node(tree, brother)->left, RBM_COLOR_BLACK);
+                rbm_right_rotate(tree, parent);
+                offset = tree->header->root;
+            }
+        }
+    }
+
+    rbm_set_color(tree, offset, RBM_COLOR_BLACK);
+}
+
+void rbm_transplant(RBM_TREE *tree, uint64_t dest, uint64_t src)
+{
+    uint64_t parent = rbm_get_parent(tree, dest);
+
+    if (!parent) {
+        tree->header->root = src;
+    } else if (rbm_node(tree, parent)->left == dest) {
+        rbm_node(tree, parent)->left = src;
+    } else {
+        rbm_node(tree, parent)->right = src;
+    }
+
+    rbm_set_parent(tree, src, parent);
+}
+
+uint64_t rbm_search(const RBM_TREE *tree, const char *key, uint64_t *parent, int *cmp)
+{
+    uint64_t offset = tree->header->root;
+
+    *parent = 0;
+    *cmp = 0;
+
+    while (offset) {
+        const RBM_NODE *node = rbm_node(tree, offset);
+
+        *cmp = strcmp(key, rbm_node_key(node));
+        if (!*cmp) {
+            return offset;
+        }
+
+        *parent = offset;
+        offset = *cmp < 0 ? node->left : node->right;
+    }
+
+    return 0;
+}
+
+uint64_t rbm_next(const RBM_TREE *tree, uint64_t offset)
+{
+    const RBM_NODE *node = rbm_node(tree, offset);
+    uint64_t parent = 0;
+
+    if (node->right) {
+        offset = node->right;
+
+        while (rbm_node(tree, offset)->left) {
+            offset = rbm_node(tree, offset)->left;
+        }
+
+        return offset;
+    }
+
+    while ((parent = rbm_get_parent(tree, offset)) && rbm_node(tree, parent)->right == offset) {
+        offset = parent;
+    }
+
+    return parent;
+}
@@ -0,0 +1,68 @@
+#ifndef __RBMMAP_H__
+#define __RBMMAP_H__
+
+#include <stddef.h>
+
+/**
+ * 基于内存映射文件的红黑树
+ *
+ * 结点、键和值都保存在映射到内存的文件中，结点之间用相对于文件起始位置的偏移量代替指针，
+ * 文件映射到任何地址都有效。进程重启后只需要重新映射文件就可以直接查找，不需要重新插入。
+ *
+ * 1.文件头记录根结点、键的数目和按大小分级的空闲链表，被删除的结点空间在之后插入时复用，
+ *   空间不足时文件按倍数增长；
+ * 2.rbm_checkpoint 用 msync 将所有修改同步写入文件，并在文件头中标记文件处于一致状态，
+ *   检查点之后的第一次修改先同步写入未一致的标记；
+ * 3.打开时总是校验文件头，上次修改后没有执行检查点（例如进程崩溃）时完整检查树的结构，
+ *   不一致时打开失败。
+ *
+ * 注意：修改直接写在映射的文件上，没有日志，也没有保存根结点和空闲链表的副本。检查点只是写回
+ * 修改并打上标记，不是恢复点，不能回退到检查点时的内容。进程在修改过程中（例如旋转或者文件增长
+ * 时）崩溃或者掉电，部分写入的结构无法通过完整检查，整个文件都无法打开，其中的数据全部丢失。
+ * 需要在崩溃后保留数据时由调用方另外备份，或者使用 rbwal.h 中带预写日志的 RB_WAL。
+ *
+ * 不支持并发访问，多个线程使用时由调用方加锁；同一个文件同时只能打开一次，打开时对文件
+ * 加排它锁，已经被打开（包括同一进程中）时返回 NULL。
+ */
+typedef struct rbm_tree_st RBM_TREE;
+
+#define RBM_CREATE 0x0001   /* 文件不存在时创建 */
+
+/* 打开或者创建文件，文件已经被打开、文件头无效或者树的结构不一致时返回 NULL */
+RBM_TREE *rbm_open(const char *path, int flags);
+
+/* 执行检查点后关闭文件，需要确认检查点成功时先调用 rbm_checkpoint */
+void rbm_close(RBM_TREE *tree);
+
+/* 插入键和 size 字节的值，二者都复制到文件中，键已存在返回 -1 */
+int rbm_insert(RBM_TREE *tree, const char *key, const void *value, size_t size);
+
+/* 删除键，键不存在返回 -1 */
+int rbm_delete(RBM_TREE *tree, const char *key);
+
+/**
+ * 查找键，value 返回文件中值的地址，size 不为 NULL 时返回值的大小
+ *
+ * 插入可能使文件增长并重新映射，返回的地址在下一次修改之前有效。
+ */
+int rbm_find(RBM_TREE *tree, const char *key, const void **value, size_t *size);
+
+/* 获取键的数目 */
+int rbm_count(const RBM_TREE *tree);
+
+/* 按键的顺序遍历，visit 中不能修改树 */
+int rbm_iterate(
+    RBM_TREE *tree, void (*visit)(const char *key, const void *value, size_t size, void *args), void *args);
+
+/* 将修改同步写入文件并标记为一致状态，之后的修改中途崩溃时不能回退到该状态 */
+int rbm_checkpoint(RBM_TREE *tree);
+
+/**
+ * 完整检查文件的一致性，时间复杂度为 O(n)
+ *
+ * 检查所有偏移量是否越界、父子结点是否互相对应、键是否严格递增、是否满足红黑树的性质、
+ * 键的数目以及空闲链表，一致返回 0。
+ */
+int rbm_check(RBM_TREE *tree);
+
+#endif /* __RBMMAP_H__ */
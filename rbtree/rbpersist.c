@@ -0,0 +1,580 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rbpersist.h"
+
+/*===========================================================================*/
+
+#define RBP_COLOR_RED   0      /* 定义红色 */
+#define RBP_COLOR_BLACK 1      /* 定义黑色 */
+
+/* 结点数目不超过 2^31 时左倾红黑树的高度不超过 62 */
+#define RBP_MAX_HEIGHT 64
+
+/**
+ * 插入或者删除时每一层最多复制的结点数
+ *
+ * 删除时当前结点 1 个，move_red_left 中两次变色各 2 个、两次旋转各 1 个，balance 中两次
+ * 旋转各 1 个、变色 2 个，共 11 个；move_red_right 一侧不超过这个数，插入更少。
+ */
+#define RBP_COPY_PER_LEVEL 11
+
+typedef struct rbp_node_st RBP_NODE;
+
+/* 持久化红黑树结点，空结点用 NULL 表示，颜色为黑色 */
+struct rbp_node_st
+{
+    /* 引用该结点的父结点、树和快照的数目 */
+    int ref;
+    int color;
+
+    RBP_NODE *left;
+    RBP_NODE *right;
+
+    const char *key;
+    void *data;
+};
+
+/* 持久化红黑树 */
+struct rbp_tree_st
+{
+    RBP_NODE *root;
+    int count;
+
+    /* 预先申请的空闲结点，用 left 串成链表，修改过程中复制结点时从这里取 */
+    RBP_NODE *spare;
+    int spare_count;
+
+    pthread_mutex_t lock;
+};
+
+/* 快照 */
+struct rbp_snapshot_st
+{
+    RBP_NODE *root;
+    int count;
+};
+
+/**
+ * 预留一次修改需要的空闲结点
+ *
+ * 复制路径发生在旋转和变色的过程中，中途申请内存失败时树已经被改了一半，所以在修改之前
+ * 按树高的上界申请足够的结点，失败返回 -1，此时树没有任何变化。
+ */
+static int rbp_reserve(RBP_TREE *tree);
+
+/* 从预留的结点中取出一个，引用计数为 1 */
+static RBP_NODE *rbp_node_alloc(RBP_TREE *tree);
+
+/* 释放一个引用，引用计数归零时释放结点并释放对孩子结点的引用 */
+static void rbp_node_release(RBP_NODE *node);
+
+/**
+ * 获取可以修改的结点
+ *
+ * 结点只被一处引用时直接返回；否则用一个预留的结点复制它代替原来的引用，新结点引用原来的
+ * 孩子。调用方必须已经拥有引用该结点的父结点。
+ */
+static RBP_NODE *rbp_node_own(RBP_TREE *tree, RBP_NODE *node);
+
+/* 判断结点是否是红色，空结点为黑色 */
+static int rbp_node_is_red(const RBP_NODE *node);
+
+/* 左旋和右旋，node 必须可以修改，返回子树新的根结点 */
+static RBP_NODE *rbp_rotate_left(RBP_TREE *tree, RBP_NODE *node);
+static RBP_NODE *rbp_rotate_right(RBP_TREE *tree, RBP_NODE *node);
+
+/* 翻转结点和两个孩子的颜色 */
+static void rbp_flip_colors(RBP_TREE *tree, RBP_NODE *node);
+
+/* 删除时借一个红色结点到左子树或者右子树 */
+static RBP_NODE *rbp_move_red_left(RBP_TREE *tree, RBP_NODE *node);
+static RBP_NODE *rbp_move_red_right(RBP_TREE *tree, RBP_NODE *node);
+
+/* 自底向上恢复左倾红黑树的性质 */
+static RBP_NODE *rbp_balance(RBP_TREE *tree, RBP_NODE *node);
+
+/* 在子树中插入新结点，调用方确保键不存在，返回子树新的根结点 */
+static RBP_NODE *rbp_node_insert(RBP_TREE *tree, RBP_NODE *node, const char *key, void *data);
+
+/* 删除子树中最小的结点，返回子树新的根结点 */
+static RBP_NODE *rbp_node_delete_min(RBP_TREE *tree, RBP_NODE *node);
+
+/* 删除子树中的 key，调用方确保键存在，data 返回被删除的数据 */
+static RBP_NODE *rbp_node_delete(RBP_TREE *tree, RBP_NODE *node, const char *key, void **data);
+
+/* 在子树中查找 key */
+static RBP_NODE *rbp_node_find(RBP_NODE *node, const char *key);
+
+/*===========================================================================*/
+
+RBP_TREE *rbp_create()
+{
+    RBP_TREE *tree = malloc(sizeof(RBP_TREE));
+
+    if (!tree) {
+        return NULL;
+    }
+    memset(tree, 0, sizeof(RBP_TREE));
+
+    pthread_mutex_init(&tree->lock, NULL);
+    return tree;
+}
+
+void rbp_destroy(RBP_TREE *tree)
+{
+    RBP_NODE *node = NULL;
+
+    if (!tree) {
+        return;
+    }
+
+    /* 快照引用的结点由快照负责释放 */
+    rbp_node_release(tree->root);
+
+    while ((node = tree->spare)) {
+        tree->spare = node->left;
+        free(node);
+    }
+
+    pthread_mutex_destroy(&tree->lock);
+    free(tree);
+}
+
+int rbp_insert(RBP_TREE *tree, const char *key, void *data)
+{
+    if (!tree || !key || !*key) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&tree->lock);
+
+    /* 先确认键不存在，避免复制路径后才发现无需修改 */
+    if (rbp_node_find(tree->root, key) || rbp_reserve(tree)) {
+        pthread_mutex_unlock(&tree->lock);
+        return -1;
+    }
+
+    tree->root = rbp_node_insert(tree, tree->root, key, data);
+    tree->root->color = RBP_COLOR_BLACK;
+    tree->count++;
+
+    pthread_mutex_unlock(&tree->lock);
+    return 0;
+}
+
+int rbp_delete(RBP_TREE *tree, const char *key, void **data)
+{
+    void *value = NULL;
+
+    if (!tree || !key || !*key) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&tree->lock);
+
+    if (!rbp_node_find(tree->root, key) || rbp_reserve(tree)) {
+        pthread_mutex_unlock(&tree->lock);
+        return -1;
+    }
+
+    /* 根结点的两个孩子都是黑色时先将根结点染红，保证向下删除时当前结点或者左孩子是红色 */
+    tree->root = rbp_node_own(tree, tree->root);
+
+    if (!rbp_node_is_red(tree->root->left) && !rbp_node_is_red(tree->root->right)) {
+        tree->root->color = RBP_COLOR_RED;
+    }
+
+    tree->root = rbp_node_delete(tree, tree->root, key, &value);
+    if (tree->root) {
+        tree->root->color = RBP_COLOR_BLACK;
+    }
+    tree->count--;
+
+    pthread_mutex_unlock(&tree->lock);
+
+    if (data) {
+        *data = value;
+    }
+    return 0;
+}
+
+int rbp_find(RBP_TREE *tree, const char *key, void **data)
+{
+    RBP_NODE *node = NULL;
+
+    if (!tree || !key || !*key || !data) {
+        return -1;
+    }
+
+    /* 最新版本的结点可能正在被原地修改，需要加锁 */
+    pthread_mutex_lock(&tree->lock);
+
+    node = rbp_node_find(tree->root, key);
+    if (node) {
+        *data = node->data;
+    }
+
+    pthread_mutex_unlock(&tree->lock);
+    return node ? 0 : -1;
+}
+
+int rbp_count(RBP_TREE *tree)
+{
+    int count = 0;
+
+    if (!tree) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&tree->lock);
+    count = tree->count;
+    pthread_mutex_unlock(&tree->lock);
+    return count;
+}
+
+RBP_SNAPSHOT *rbp_snapshot(RBP_TREE *tree)
+{
+    RBP_SNAPSHOT *snapshot = NULL;
+
+    if (!tree) {
+        return NULL;
+    }
+
+    snapshot = malloc(sizeof(RBP_SNAPSHOT));
+    if (!snapshot) {
+        return NULL;
+    }
+
+    /* 引用根结点后，之后的修改都会先复制被共享的路径 */
+    pthread_mutex_lock(&tree->lock);
+
+    snapshot->root = tree->root;
+    snapshot->count = tree->count;
+
+    if (snapshot->root) {
+        __atomic_add_fetch(&snapshot->root->ref, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&tree->lock);
+    return snapshot;
+}
+
+void rbp_snapshot_release(RBP_SNAPSHOT *snapshot)
+{
+    if (!snapshot) {
+        return;
+    }
+
+    rbp_node_release(snapshot->root);
+    free(snapshot);
+}
+
+int rbp_snapshot_find(const RBP_SNAPSHOT *snapshot, const char *key, void **data)
+{
+    RBP_NODE *node = NULL;
+
+    if (!snapshot || !key || !*key || !data) {
+        return -1;
+    }
+
+    /* 快照中的结点不会再被修改，不需要加锁 */
+    node = rbp_node_find(snapshot->root, key);
+    if (!node) {
+        return -1;
+    }
+
+    *data = node->data;
+    return 0;
+}
+
+int rbp_snapshot_count(const RBP_SNAPSHOT *snapshot)
+{
+    return snapshot ? snapshot->count : 0;
+}
+
+int rbp_snapshot_iterate(
+    const RBP_SNAPSHOT *snapshot, void (*visit)(void *key, void *data, void *args), void *args)
+{
+    RBP_NODE *stack[RBP_MAX_HEIGHT];
+    RBP_NODE *node = NULL;
+    int top = 0;
+
+    if (!snapshot || !visit) {
+        return -1;
+    }
+
+    /* 结点没有父结点指针，用栈进行中序遍历，栈的深度不超过树高 */
+    node = snapshot->root;
+
+    while (node || top > 0) {
+        while (node) {
+            stack[top++] = node;
+            node = node->left;
+        }
+
+        node = stack[--top];
+        visit((void *)node->key, node->data, args);
+        node = node->right;
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------*/
+
+int rbp_reserve(RBP_TREE *tree)
+{
+    int levels = 1;
+    int need = 0;
+    unsigned int n = 0;
+
+    /* 左倾红黑树的高度不超过 2 * log2(count + 1)，插入的新结点再多一层 */
+    for (n = (unsigned int)tree->count + 1; n; n >>= 1) {
+        levels += 2;
+    }
+    need = levels * RBP_COPY_PER_LEVEL + 1;
+
+    while (tree->spare_count < need) {
+        RBP_NODE *node = malloc(sizeof(RBP_NODE));
+
+        if (!node) {
+            return -1;
+        }
+
+        node->left = tree->spare;
+        tree->spare = node;
+        tree->spare_count++;
+    }
+
+    return 0;
+}
+
+RBP_NODE *rbp_node_alloc(RBP_TREE *tree)
+{
+    RBP_NODE *node = tree->spare;
+
+    tree->spare = node->left;
+    tree->spare_count--;
+
+    memset(node, 0, sizeof(RBP_NODE));
+    node->ref = 1;
+    return node;
+}
+
+void rbp_node_release(RBP_NODE *node)
+{
+    /* 只有引用计数归零时才继续释放孩子，递归深度不超过树高 */
+    if (node && !__atomic_sub_fetch(&node->ref, 1, __ATOMIC_ACQ_REL)) {
+        rbp_node_release(node->left);
+        rbp_node_release(node->right);
+        free(node);
+    }
+}
+
+RBP_NODE *rbp_node_own(RBP_TREE *tree, RBP_NODE *node)
+{
+    RBP_NODE *copy = NULL;
+
+    /* 只有加锁的写者会增加引用计数，读到 1 说明没有其它版本引用该结点 */
+    if (!node || __atomic_load_n(&node->ref, __ATOMIC_ACQUIRE) == 1) {
+        return node;
+    }
+
+    /* 引用计数可能正被释放快照的线程修改，不能整体复制 */
+    copy = rbp_node_alloc(tree);
+    copy->color = node->color;
+    copy->left = node->left;
+    copy->right = node->right;
+    copy->key = node->key;
+    copy->data = node->data;
+
+    if (copy->left) {
+        __atomic_add_fetch(&copy->left->ref, 1, __ATOMIC_RELAXED);
+    }
+    if (copy->right) {
+        __atomic_add_fetch(&copy->right->ref, 1, __ATOMIC_RELAXED);
+    }
+
+    /* 快照可能恰好在此时释放，引用计数归零时由这里负责释放原结点 */
+    rbp_node_release(node);
+    return copy;
+}
+
+int rbp_node_is_red(const RBP_NODE *node)
+{
+    return node && node->color == RBP_COLOR_RED;
+}
+
+RBP_NODE *rbp_rotate_left(RBP_TREE *tree, RBP_NODE *node)
+{
+    RBP_NODE *x = rbp_node_own(tree, node->right);
+
+    node->right = x->left;
+    x->left = node;
+    x->color = node->color;
+    node->color = RBP_COLOR_RED;
+    return x;
+}
+
+RBP_NODE *rbp_rotate_right(RBP_TREE *tree, RBP_NODE *node)
+{
+    RBP_NODE *x = rbp_node_own(tree, node->left);
+
+    node->left = x->right;
+    x->right = node;
+    x->color = node->color;
+    node->color = RBP_COLOR_RED;
+    return x;
+}
+
+void rbp_flip_colors(RBP_TREE *tree, RBP_NODE *node)
+{
+    node->left = rbp_node_own(tree, node->left);
+    node->right = rbp_node_own(tree, node->right);
+
+    node->color = !node->color;
+    node->left->color = !node->left->color;
+    node->right->color = !node->right->color;
+}
+
+RBP_NODE *rbp_move_red_left(RBP_TREE *tree, RBP_NODE *node)
+{
+    rbp_flip_colors(tree, node);
+
+    if (rbp_node_is_red(node->right->left)) {
+        node->right = rbp_rotate_right(tree, node->right);
+        node = rbp_rotate_left(tree, node);
+        rbp_flip_colors(tree, node);
+    }
+
+    return node;
+}
+
+RBP_NODE *rbp_move_red_right(RBP_TREE *tree, RBP_NODE *node)
+{
+    rbp_flip_colors(tree, node);
+
+    if (rbp_node_is_red(node->left->left)) {
+        node = rbp_rotate_right(tree, node);
+        rbp_flip_colors(tree, node);
+    }
+
+    return node;
+}
+
+RBP_NODE *rbp_balance(RBP_TREE *tree, RBP_NODE *node)
+{
+    if (rbp_node_is_red(node->right) && !rbp_node_is_red(node->left)) {
+        node = rbp_rotate_left(tree, node);
+    }
+    if (rbp_node_is_red(node->left) && rbp_node_is_red(node->left->left)) {
+        node = rbp_rotate_right(tree, node);
+    }
+    if (rbp_node_is_red(node->left) && rbp_node_is_red(node->right)) {
+        rbp_flip_colors(tree, node);
+    }
+
+    return node;
+}
+
+RBP_NODE *rbp_node_insert(RBP_TREE *tree, RBP_NODE *node, const char *key, void *data)
+{
+    if (!node) {
+        RBP_NODE *add = rbp_node_alloc(tree);
+
+        add->color = RBP_COLOR_RED;
+        add->key = key;
+        add->data = data;
+        return add;
+    }
+
+    node = rbp_node_own(tree, node);
+
+    if (strcmp(key, node->key) < 0) {
+        node->left = rbp_node_insert(tree, node->left, key, data);
+    } else {
+        node->right = rbp_node_insert(tree, node->right, key, data);
+    }
+
+    return rbp_balance(tree, node);
+}
+
+RBP_NODE *rbp_node_delete_min(RBP_TREE *tree, RBP_NODE *node)
+{
+    node = rbp_node_own(tree, node);
+
+    /* 左倾红黑树中没有左孩子的结点也没有右孩子 */
+    if (!node->left) {
+        rbp_node_release(node);
+        return NULL;
+    }
+
+    if (!rbp_node_is_red(node->left) && !rbp_node_is_red(node->left->left)) {
+        node = rbp_move_red_left(tree, node);
+    }
+
+    node->left = rbp_node_delete_min(tree, node->left);
+    return rbp_balance(tree, node);
+}
+
+RBP_NODE *rbp_node_delete(RBP_TREE *tree, RBP_NODE *node, const char *key, void **data)
+{
+    node = rbp_node_own(tree, node);
+
+    if (strcmp(key, node->key) < 0) {
+        if (!rbp_node_is_red(node->left) && !rbp_node_is_red(node->left->left)) {
+            node = rbp_move_red_left(tree, node);
+        }
+
+        node->left = rbp_node_delete(tree, node->left, key, data);
+    } else {
+        if (rbp_node_is_red(node->left)) {
+            node = rbp_rotate_right(tree, node);
+        }
+
+        if (!strcmp(key, node->key) && !node->right) {
+            *data = node->data;
+            rbp_node_release(node);
+            return NULL;
+        }
+
+        if (!rbp_node_is_red(node->right) && !rbp_node_is_red(node->right->left)) {
+            node = rbp_move_red_right(tree, node);
+        }
+
+        if (!strcmp(key, node->key)) {
+            /* 用右子树中最小的结点替换当前结点，再删除右子树中最小的结点 */
+            RBP_NODE *mini = node->right;
+
+            while (mini->left) {
+                mini = mini->left;
+            }
+
+            *data = node->data;
+            node->key = mini->key;
+            node->data = mini->data;
+            node->right = rbp_node_delete_min(tree, node->right);
+        } else {
+            node->right = rbp_node_delete(tree, node->right, key, data);
+        }
+    }
+
+    return rbp_balance(tree, node);
+}
+
+RBP_NODE *rbp_node_find(RBP_NODE *node, const char *key)
+{
+    while (node) {
+        int cmp = strcmp(key, node->key);
+
+        if (!cmp) {
+            return node;
+        }
+
+        node = cmp < 0 ? node->left : node->right;
+    }
+
+    return NULL;
+}
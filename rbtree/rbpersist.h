@@ -0,0 +1,54 @@
+#ifndef __RBPERSIST_H__
+#define __RBPERSIST_H__
+
+/**
+ * 支持快照的持久化红黑树
+ *
+ * 采用左倾红黑树 (LLRB)，结点没有父结点指针，带有引用计数。修改时只复制从根结点到目标
+ * 结点路径上被共享的结点（路径复制），未被修改的子树在新旧版本之间共享，因此：
+ *
+ * 1.创建快照只需要增加根结点的引用计数，时间复杂度为 O(1)；
+ * 2.快照创建后树的修改不会影响快照，快照可以在其它线程中不加锁地查找和遍历；
+ * 3.快照释放时引用计数归零的结点才被释放，只属于旧版本的结点随最后一个快照一起回收。
+ *
+ * 写操作和创建快照之间由互斥锁串行化。键和数据的内存由调用方管理，被删除的键在引用它的
+ * 快照全部释放之前不能释放。
+ */
+typedef struct rbp_tree_st RBP_TREE;
+typedef struct rbp_snapshot_st RBP_SNAPSHOT;
+
+/* 创建持久化红黑树 */
+RBP_TREE *rbp_create();
+
+/* 销毁树，已经创建的快照仍然有效，需要分别释放 */
+void rbp_destroy(RBP_TREE *tree);
+
+/* 插入数据，键已存在或者内存不足返回 -1，失败时树不变 */
+int rbp_insert(RBP_TREE *tree, const char *key, void *data);
+
+/* 删除数据，data 不为 NULL，返回移除的数据地址；键不存在或者内存不足返回 -1，失败时树不变 */
+int rbp_delete(RBP_TREE *tree, const char *key, void **data);
+
+/* 在最新版本中查找数据 */
+int rbp_find(RBP_TREE *tree, const char *key, void **data);
+
+/* 获取最新版本中键的数目 */
+int rbp_count(RBP_TREE *tree);
+
+/* 创建当前版本的快照 */
+RBP_SNAPSHOT *rbp_snapshot(RBP_TREE *tree);
+
+/* 释放快照 */
+void rbp_snapshot_release(RBP_SNAPSHOT *snapshot);
+
+/* 在快照中查找数据 */
+int rbp_snapshot_find(const RBP_SNAPSHOT *snapshot, const char *key, void **data);
+
+/* 获取快照中键的数目 */
+int rbp_snapshot_count(const RBP_SNAPSHOT *snapshot);
+
+/* 按键的顺序遍历快照 */
+int rbp_snapshot_iterate(
+    const RBP_SNAPSHOT *snapshot, void (*visit)(void *key, void *data, void *args), void *args);
+
+#endif /* __RBPERSIST_H__ */
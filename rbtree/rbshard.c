@@ -0,0 +1,436 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rbshard.h"
+
+/*===========================================================================*/
+
+#define RB_SHARD_HASH  0    /* 按散列划分 */
+#define RB_SHARD_RANGE 1    /* 按区间划分 */
+
+#define RB_SHARD_CACHELINE 64
+
+/* 分片 */
+typedef struct rb_shard_st
+{
+    pthread_mutex_t lock;
+    RB_TREE *tree;
+
+    /* 避免相邻分片的锁位于同一个缓存行，不同分片的写者之间产生伪共享 */
+    char pad[RB_SHARD_CACHELINE];
+} RB_SHARD;
+
+/* 分片的有序映射 */
+struct rb_shard_map_st
+{
+    RB_SHARD *shards;
+    int count;
+
+    /* 划分方式 */
+    int type;
+
+    /* 按区间划分时的 count - 1 个边界 */
+    char **bounds;
+};
+
+/* 创建映射及其分片，bounds 为 NULL 时按散列划分 */
+static RB_SHARD_MAP *rb_shard_map_create(const char **bounds, int shards);
+
+/* 获取键所在的分片下标 */
+static int rb_shard_index(const RB_SHARD_MAP *map, const char *key);
+
+/* 字符串的 FNV-1a 散列值 */
+static unsigned int rb_shard_hash(const char *key);
+
+/* 比较两个游标指向的键 */
+static int rb_shard_cursor_compare(const RB_CURSOR *a, const RB_CURSOR *b);
+
+/* 最小堆的下沉操作 */
+static void rb_shard_heap_down(RB_CURSOR *heap, int count, int index);
+
+/* 按散列划分时用最小堆合并各个分片，依次访问 [begin, end) 之间的键 */
+static void rb_shard_merge(
+    RB_SHARD_MAP *map, const char *begin, const char *end,
+    void (*visit)(void *key, void *data, void *args), void *args, RB_CURSOR *heap);
+
+/*===========================================================================*/
+
+RB_SHARD_MAP *rb_shard_create(int shards)
+{
+    return rb_shard_map_create(NULL, shards);
+}
+
+RB_SHARD_MAP *rb_shard_create_range(const char **bounds, int shards)
+{
+    int i = 0;
+
+    if (!bounds && shards > 1) {
+        return NULL;
+    }
+
+    /* 边界必须非空并且严格递增 */
+    for (; i < shards - 1; i++) {
+        if (!bounds[i] || !*bounds[i]) {
+            return NULL;
+        }
+
+        if (i > 0 && strcmp(bounds[i - 1], bounds[i]) >= 0) {
+            return NULL;
+        }
+    }
+
+    return rb_shard_map_create(bounds, shards);
+}
+
+void rb_shard_destroy(RB_SHARD_MAP *map)
+{
+    int i = 0;
+
+    if (!map) {
+        return;
+    }
+
+    for (; i < map->count; i++) {
+        pthread_mutex_destroy(&map->shards[i].lock);
+        rb_destroy(map->shards[i].tree);
+    }
+
+    if (map->bounds) {
+        for (i = 0; i < map->count - 1; i++) {
+            free(map->bounds[i]);
+        }
+        free(map->bounds);
+    }
+
+    free(map->shards);
+    free(map);
+}
+
+int rb_shard_insert(RB_SHARD_MAP *map, const char *key, void *data)
+{
+    RB_SHARD *shard = NULL;
+    int ret = 0;
+
+    if (!map || !key || !*key) {
+        return -1;
+    }
+
+    shard = map->shards + rb_shard_index(map, key);
+
+    pthread_mutex_lock(&shard->lock);
+    ret = rb_insert(shard->tree, key, data);
+    pthread_mutex_unlock(&shard->lock);
+    return ret;
+}
+
+int rb_shard_upsert(RB_SHARD_MAP *map, const char *key, void *data, void **old)
+{
+    RB_SHARD *shard = NULL;
+    int ret = 0;
+
+    if (!map || !key || !*key) {
+        return -1;
+    }
+
+    shard = map->shards + rb_shard_index(map, key);
+
+    pthread_mutex_lock(&shard->lock);
+    ret = rb_upsert(shard->tree, key, data, old);
+    pthread_mutex_unlock(&shard->lock);
+    return ret;
+}
+
+int rb_shard_delete(RB_SHARD_MAP *map, const char *key, void **data)
+{
+    RB_SHARD *shard = NULL;
+    int ret = 0;
+
+    if (!map || !key || !*key) {
+        return -1;
+    }
+
+    shard = map->shards + rb_shard_index(map, key);
+
+    pthread_mutex_lock(&shard->lock);
+    ret = rb_delete(shard->tree, key, data);
+    pthread_mutex_unlock(&shard->lock);
+    return ret;
+}
+
+int rb_shard_find(RB_SHARD_MAP *map, const char *key, void **data)
+{
+    RB_SHARD *shard = NULL;
+    int ret = 0;
+
+    if (!map || !key || !*key) {
+        return -1;
+    }
+
+    shard = map->shards + rb_shard_index(map, key);
+
+    pthread_mutex_lock(&shard->lock);
+    ret = rb_find(shard->tree, key, data);
+    pthread_mutex_unlock(&shard->lock);
+    return ret;
+}
+
+int rb_shard_count(RB_SHARD_MAP *map)
+{
+    int count = 0;
+    int i = 0;
+
+    if (!map) {
+        return 0;
+    }
+
+    for (; i < map->count; i++) {
+        pthread_mutex_lock(&map->shards[i].lock);
+        count += rb_count(map->shards[i].tree);
+        pthread_mutex_unlock(&map->shards[i].lock);
+    }
+
+    return count;
+}
+
+int rb_shard_iterate_range(
+    RB_SHARD_MAP *map, const char *begin, const char *end,
+    void (*visit)(void *key, void *data, void *args), void *args)
+{
+    RB_CURSOR *heap = NULL;
+    int first = 0;
+    int last = 0;
+    int i = 0;
+
+    if (!map || !visit) {
+        return -1;
+    }
+
+    last = map->count - 1;
+
+    /* 按区间划分时只需要访问与 [begin, end) 相交的分片 */
+    if (map->type == RB_SHARD_RANGE) {
+        first = begin ? rb_shard_index(map, begin) : 0;
+        last = end ? rb_shard_index(map, end) : last;
+    } else {
+        heap = malloc(map->count * sizeof(RB_CURSOR));
+        if (!heap) {
+            return -1;
+        }
+    }
+
+    /* 按下标顺序加锁，多个遍历同时进行时不会死锁 */
+    for (i = first; i <= last; i++) {
+        pthread_mutex_lock(&map->shards[i].lock);
+    }
+
+    if (map->type == RB_SHARD_RANGE) {
+        /* 分片之间的键互不重叠，依次遍历即可 */
+        for (i = first; i <= last; i++) {
+            RB_CURSOR cursor;
+            const char *key = NULL;
+            void *data = NULL;
+            int ret = 0;
+
+            ret = begin ? rb_cursor_lower_bound(map->shards[i].tree, &cursor, begin) :
+                rb_cursor_first(map->shards[i].tree, &cursor);
+
+            for (; !ret; ret = rb_cursor_next(&cursor)) {
+                rb_cursor_get(&cursor, &key, &data);
+
+                if (end && strcmp(key, end) >= 0) {
+                    break;
+                }
+                visit((void *)key, data, args);
+            }
+        }
+    } else {
+        rb_shard_merge(map, begin, end, visit, args, heap);
+    }
+
+    for (i = last; i >= first; i--) {
+        pthread_mutex_unlock(&map->shards[i].lock);
+    }
+
+    free(heap);
+    return 0;
+}
+
+int rb_shard_iterate(RB_SHARD_MAP *map, void (*visit)(void *key, void *data, void *args), void *args)
+{
+    return rb_shard_iterate_range(map, NULL, NULL, visit, args);
+}
+
+/*-------------------------------------------------------*/
+
+RB_SHARD_MAP *rb_shard_map_create(const char **bounds, int shards)
+{
+    RB_SHARD_MAP *map = NULL;
+    int i = 0;
+
+    if (shards <= 0) {
+        return NULL;
+    }
+
+    map = malloc(sizeof(RB_SHARD_MAP));
+    if (!map) {
+        return NULL;
+    }
+    memset(map, 0, sizeof(RB_SHARD_MAP));
+
+    map->shards = malloc(shards * sizeof(RB_SHARD));
+    if (!map->shards) {
+        free(map);
+        return NULL;
+    }
+    memset(map->shards, 0, shards * sizeof(RB_SHARD));
+
+    map->type = bounds ? RB_SHARD_RANGE : RB_SHARD_HASH;
+
+    if (bounds) {
+        map->bounds = malloc(shards * sizeof(char *));
+        if (!map->bounds) {
+            free(map->shards);
+            free(map);
+            return NULL;
+        }
+        memset(map->bounds, 0, shards * sizeof(char *));
+    }
+
+    /* count 只包含已经初始化的分片，失败时由 rb_shard_destroy 释放这些分片和已经复制的边界 */
+    for (; i < shards; i++) {
+        pthread_mutex_init(&map->shards[i].lock, NULL);
+        map->shards[i].tree = rb_create();
+        map->count++;
+
+        if (!map->shards[i].tree) {
+            rb_shard_destroy(map);
+            return NULL;
+        }
+
+        if (bounds && i < shards - 1) {
+            map->bounds[i] = strdup(bounds[i]);
+            if (!map->bounds[i]) {
+                rb_shard_destroy(map);
+                return NULL;
+            }
+        }
+    }
+
+    return map;
+}
+
+int rb_shard_index(const RB_SHARD_MAP *map, const char *key)
+{
+    int low = 0;
+    int high = 0;
+
+    if (map->type == RB_SHARD_HASH) {
+        return rb_shard_hash(key) % map->count;
+    }
+
+    /* 二分查找第一个大于 key 的边界，它的下标就是键所在的分片 */
+    high = map->count - 1;
+
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+
+        if (strcmp(map->bounds[mid], key) <= 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+unsigned int rb_shard_hash(const char *key)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *key; key++) {
+        hash ^= (unsigned char)*key;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+int rb_shard_cursor_compare(const RB_CURSOR *a, const RB_CURSOR *b)
+{
+    const char *x = NULL;
+    const char *y = NULL;
+
+    rb_cursor_get(a, &x, NULL);
+    rb_cursor_get(b, &y, NULL);
+    return strcmp(x, y);
+}
+
+void rb_shard_heap_down(RB_CURSOR *heap, int count, int index)
+{
+    for (;;) {
+        int min = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        RB_CURSOR tmp;
+
+        if (left < count && rb_shard_cursor_compare(heap + left, heap + min) < 0) {
+            min = left;
+        }
+        if (right < count && rb_shard_cursor_compare(heap + right, heap + min) < 0) {
+            min = right;
+        }
+
+        if (min == index) {
+            break;
+        }
+
+        tmp = heap[index];
+        heap[index] = heap[min];
+        heap[min] = tmp;
+        index = min;
+    }
+}
+
+void rb_shard_merge(
+    RB_SHARD_MAP *map, const char *begin, const char *end,
+    void (*visit)(void *key, void *data, void *args), void *args, RB_CURSOR *heap)
+{
+    int count = 0;
+    int i = 0;
+
+    /* 每个分片的游标定位到第一个不小于 begin 的键 */
+    for (; i < map->count; i++) {
+        int ret = begin ? rb_cursor_lower_bound(map->shards[i].tree, heap + count, begin) :
+            rb_cursor_first(map->shards[i].tree, heap + count);
+
+        if (!ret) {
+            count++;
+        }
+    }
+
+    for (i = count / 2 - 1; i >= 0; i--) {
+        rb_shard_heap_down(heap, count, i);
+    }
+
+    /* 每次取出堆顶最小的键，游标后移后重新下沉，游标到达末尾时从堆中移除 */
+    while (count > 0) {
+        const char *key = NULL;
+        void *data = NULL;
+
+        rb_cursor_get(heap, &key, &data);
+
+        if (end && strcmp(key, end) >= 0) {
+            /* 堆顶已经不小于 end，其余的键更大 */
+            break;
+        }
+
+        visit((void *)key, data, args);
+
+        if (rb_cursor_next(heap)) {
+            heap[0] = heap[--count];
+        }
+        rb_shard_heap_down(heap, count, 0);
+    }
+}
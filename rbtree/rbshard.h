@@ -0,0 +1,49 @@
+#ifndef __RBSHARD_H__
+#define __RBSHARD_H__
+
+#include "rbtree.h"
+
+/**
+ * 分片的有序映射
+ *
+ * 键被划分到 N 个分片中，每个分片是一颗独立加锁的红黑树，写入不同分片的线程互不阻塞。
+ * 有两种划分方式：
+ *
+ * 1.按散列划分 -- 键按散列值均匀分布到各个分片，适合以单点操作为主的场景，有序遍历时
+ *   需要用最小堆合并所有分片；
+ * 2.按区间划分 -- 给定 N - 1 个严格递增的边界，第 i 个分片保存 [bounds[i - 1], bounds[i])
+ *   之间的键，有序遍历和区间查询只需要依次访问相关的分片。
+ */
+typedef struct rb_shard_map_st RB_SHARD_MAP;
+
+/* 创建按散列划分的映射，shards 为分片数目 */
+RB_SHARD_MAP *rb_shard_create(int shards);
+
+/* 创建按区间划分的映射，bounds 有 shards - 1 个严格递增的非空键，映射中保存边界的副本 */
+RB_SHARD_MAP *rb_shard_create_range(const char **bounds, int shards);
+
+/* 销毁映射 */
+void rb_shard_destroy(RB_SHARD_MAP *map);
+
+/* 单点操作只锁定键所在的分片，返回值与 rb_insert、rb_upsert、rb_delete 和 rb_find 相同 */
+int rb_shard_insert(RB_SHARD_MAP *map, const char *key, void *data);
+int rb_shard_upsert(RB_SHARD_MAP *map, const char *key, void *data, void **old);
+int rb_shard_delete(RB_SHARD_MAP *map, const char *key, void **data);
+int rb_shard_find(RB_SHARD_MAP *map, const char *key, void **data);
+
+/* 获取所有分片中键的数目 */
+int rb_shard_count(RB_SHARD_MAP *map);
+
+/**
+ * 按键的顺序遍历 [begin, end) 之间的键，begin 或者 end 为 NULL 表示不限制
+ *
+ * 遍历期间锁定所有相关的分片，看到的是一致的快照，visit 中不能修改该映射。
+ */
+int rb_shard_iterate_range(
+    RB_SHARD_MAP *map, const char *begin, const char *end,
+    void (*visit)(void *key, void *data, void *args), void *args);
+
+/* 按键的顺序遍历所有键 */
+int rb_shard_iterate(RB_SHARD_MAP *map, void (*visit)(void *key, void *data, void *args), void *args);
+
+#endif /* __RBSHARD_H__ */
@@ -1,36 +1,316 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "rbtree.h"
-#include "../stack/stack.h"
 
 /*===========================================================================*/
 
 #define RBTREE_COLOR_RED   0x00000000      /* 定义红色 */
 #define RBTREE_COLOR_BLACK 0x00000001      /* 定义黑色 */
-#define RBTREE_COLOR_MASK  0x0000FFFF      /* 颜色掩码 */
-#define RBTREE_NIL_NODE    0x00010000      /* 哨兵节点 */
+#define RBTREE_COLOR_MASK  0x00000001      /* 颜色掩码 */
+#define RBTREE_NODE_BLOCK  0x00000002      /* 结点位于成块申请的内存中，不能单独释放 */
+#define RBTREE_FLAG_MASK   0x00000003      /* 父结点地址中存放标记的低位 */
+
+/* 结点中缓存的键前缀长度 */
+#define RBTREE_KEY_PREFIX 8
+
+/* 键区域每块的大小，超过 1 / 8 的长键单独申请一块 */
+#define RBTREE_ARENA_CHUNK (64 * 1024)
+
+/* 去重表的初始大小，必须为 2 的幂 */
+#define RBTREE_INTERN_SIZE 64
+
+/* 布隆过滤器每块的字数，8 个 64 位字正好占一条缓存行，每个键在块内的每个字中各置一位 */
+#define RBTREE_BLOOM_WORDS 8
+
+/* 布隆过滤器每块容纳的键数，满载时每个键 16 位 */
+#define RBTREE_BLOOM_KEYS 32
+
+/* 批量查找时同时推进的查找数目 */
+#define RBTREE_BATCH_WIDTH 16
+
+/* 预取数据到缓存，不支持的编译器上为空操作 */
+#if defined(__GNUC__)
+#define RBTREE_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define RBTREE_PREFETCH(addr) ((void)0)
+#endif
+
+/* 哨兵节点 */
+#define RBTREE_NIL (&rb_nil_node)
+
+/**
+ * 累加计数器，定义 RBTREE_STAT 时才生效，否则为空操作
+ * 
+ * 查找可能在多个读者中同时进行，所以用原子操作累加。
+ */
+#ifdef RBTREE_STAT
+#define RB_STAT_ADD(tree, field, n) \
+    __atomic_fetch_add(&(tree)->stat.field, (unsigned long long)(n), __ATOMIC_RELAXED)
+#else
+#define RB_STAT_ADD(tree, field, n) ((void)(n))
+#endif
+
+/**
+ * 修改查找路径上的指针和数据
+ * 
+ * rb_sync_find 在写者修改的同时无锁读取这些字段，所以写入必须是原子的，并以 release 语义
+ * 保证写者先前的写入（seq 变为奇数、新结点的内容）先于新的指针对读者可见。x86 上与普通
+ * 写入生成相同的指令。
+ */
+#define RB_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+
+#define RB_SYNC_SLOTS     64    /* 同时进行无锁查找的线程数上限，超出的线程加锁查找 */
+#define RB_SYNC_RETRY     8     /* 无锁查找的重试次数，仍然失败时加锁查找 */
+#define RB_SYNC_MAX_STEPS 128   /* 无锁查找最多访问的结点数，超过说明读到了不一致的树 */
+#define RB_SYNC_RECLAIM   64    /* 待回收列表的初始大小，列表满时尝试回收 */
+#define RB_SYNC_CACHELINE 64
 
-/* 红黑树结点 */
+/**
+ * 红黑树结点
+ * 
+ * 结点至少按指针大小对齐，父结点地址的最低两位总是 0，因此用来存放结点颜色和标记，
+ * 64 位平台上结点大小从 48 字节减少到 40 字节，加上缓存的键前缀为 48 字节。
+ */
 struct rb_node_st
 {
-    unsigned int flag;
+    /* 父结点地址和颜色 */
+    uintptr_t parent_color;
 
-    RB_NODE *parent;
     RB_NODE *left;
     RB_NODE *right;
 
+    /**
+     * 键的前 RBTREE_KEY_PREFIX 个字节，按大端序组成整数，不足时补 0
+     * 
+     * 比较时先比较前缀，大多数情况下不需要访问位于其它内存中的键，每层少一次缓存未命中；
+     * 只有前缀相同时才比较键的剩余部分。
+     */
+    uint64_t prefix;
+
     const char *key;
     void *data;
+
+#ifdef RBTREE_ORDER_STAT
+    /* 以该结点为根的子树中的结点数目 */
+    int size;
+#endif
+};
+
+/**
+ * 成块申请的结点内存，结点紧跟在块头部之后
+ * 
+ * 拆分后的两颗树可能都含有同一块中的结点，所以结点块带有引用计数，引用它的树都销毁后才释放。
+ */
+typedef struct rb_block_st
+{
+    size_t ref;
+} RB_BLOCK;
+
+/* 树对结点块的引用 */
+typedef struct rb_block_ref_st RB_BLOCK_REF;
+
+struct rb_block_ref_st
+{
+    RB_BLOCK_REF *next;
+    RB_BLOCK *block;
 };
 
 /* 红黑树 */
 struct rb_tree_st
 {
     RB_NODE *root;
-    RB_NODE *nil;
 
+    /* 树所引用的结点块，销毁树时释放引用 */
+    RB_BLOCK_REF *blocks;
+
+    int count;
+
+    /* 创建时指定的 RB_FLAG_* */
+    int flags;
+
+    /* RB_FLAG_FINGER 时最近访问的结点，查找从这里开始，为 NULL 时从根结点开始 */
+    RB_NODE *finger;
+
+    /**
+     * 拥有键时键的副本依次存放在键区域中，区域按块申请，和结点块一样由引用计数管理，
+     * 拆分与连接后仍然属于引用它的树。arena 为当前块中的空闲位置。
+     */
+    char *arena;
+    size_t arena_left;
+
+    /* 去重时已复制的键，开放寻址的散列表 */
+    const char **interns;
+    size_t intern_size;
+    size_t intern_count;
+
+    /**
+     * RB_FLAG_BLOOM 时的分块布隆过滤器，共 bloom_blocks 块，块数为 2 的幂，按缓存行对齐。
+     * 为 NULL 时不过滤。删除不能清除位，bloom_stale 为上次重建之后删除或者移出的键数。
+     */
+    uint64_t *bloom;
+    size_t bloom_blocks;
+    int bloom_stale;
+
+#ifdef RBTREE_STAT
+    /* 热路径计数器，只使用 RB_STATS 中的计数器字段 */
+    RB_STATS stat;
+#endif
+};
+
+/* 拆分的结果，node 为与键相等的结点，不存在时为 NULL */
+typedef struct rb_split_st
+{
+    RB_NODE *left;
+    int left_bh;
+
+    RB_NODE *node;
+
+    RB_NODE *right;
+    int right_bh;
+} RB_SPLIT;
+
+#define RB_SET_UNION        0   /* 并集 */
+#define RB_SET_INTERSECTION 1   /* 交集 */
+#define RB_SET_DIFFERENCE   2   /* 差集 */
+
+#define RB_SET_PARALLEL_DEPTH 3 /* 递归的前几层并行执行，最多同时使用 2^3 个线程 */
+#define RB_SET_PARALLEL_BH    8 /* 子树的黑高不小于该值（至少 255 个结点）时才值得创建线程 */
+#define RB_SET_INSERT_BH      3 /* 并集中 other 的黑高不超过该值（最多 63 个结点）时直接插入 */
+#define RB_SET_INSERT_GAP     2 /* 并且 tree 的黑高至少比 other 高出该值，即 tree 远大于 other */
+
+#define RB_PARALLEL_MAX_THREADS 64  /* 并行遍历最多使用的线程数 */
+#define RB_PARALLEL_UNITS       4   /* 每个线程平均分到的子树数目，数目越多负载越均衡 */
+
+/* 并行遍历的单元，whole 为 1 时是以 node 为根的整颗子树，否则只有 node 一个结点 */
+typedef struct rb_parallel_unit_st
+{
+    RB_NODE *node;
+    int whole;
+
+    /* 有序归约时单元自己的累加器 */
+    void *acc;
+} RB_PARALLEL_UNIT;
+
+/* 并行遍历任务，visit 不为 NULL 时为遍历，否则为归约 */
+typedef struct rb_parallel_job_st
+{
+    /* 按中序排列的单元 */
+    RB_PARALLEL_UNIT *units;
     int count;
+    int size;
+
+    /* 下一个待处理的单元，各线程原子地领取 */
+    int next;
+
+    void (*visit)(void *key, void *data, void *args);
+
+    void *(*init)(void *args);
+    void (*map)(void *acc, void *key, void *data, void *args);
+    void (*combine)(void *acc, void *other, void *args);
+
+    void *args;
+    int ordered;
+
+    /* 实际使用的线程数 */
+    int threads;
+} RB_PARALLEL_JOB;
+
+/* 并行遍历的工作线程 */
+typedef struct rb_parallel_worker_st
+{
+    RB_PARALLEL_JOB *job;
+    pthread_t thread;
+
+    /* 无序归约时线程自己的累加器 */
+    void *acc;
+} RB_PARALLEL_WORKER;
+
+/* 集合运算的参数 */
+typedef struct rb_set_ctx_st
+{
+    int op;
+
+    void (*drop)(void *key, void *data, void *args);
+    void *args;
+} RB_SET_CTX;
+
+/* 集合运算的子任务，用于在线程中执行一半的递归 */
+typedef struct rb_set_task_st
+{
+    const RB_SET_CTX *ctx;
+
+    RB_NODE *tree;
+    int tree_bh;
+    RB_NODE *other;
+    int other_bh;
+    int depth;
+
+    RB_NODE *result;
+    int bh;
+    int dropped;
+} RB_SET_TASK;
+
+/* 读者登记槽，每个槽独占一个缓存行，避免不同读者之间的伪共享 */
+typedef struct rb_sync_slot_st
+{
+    /* 读者进入时的纪元，0 表示空闲 */
+    unsigned long epoch;
+
+    char pad[RB_SYNC_CACHELINE - sizeof(unsigned long)];
+} RB_SYNC_SLOT;
+
+/* 已从树中摘除、等待读者离开后释放的结点 */
+typedef struct rb_sync_retired_st
+{
+    RB_NODE *node;
+
+    /* 摘除时的纪元 */
+    unsigned long epoch;
+} RB_SYNC_RETIRED;
+
+/**
+ * 支持并发读的红黑树
+ * 
+ * 写操作持有互斥锁，修改前后各将 seq 加一，seq 为奇数表示正在修改。读者不加锁，
+ * 查找前后读取 seq，两次相同并且为偶数说明查找期间树没有被修改，结果有效。
+ * 
+ * 被删除的结点不会立即释放：读者查找前将当前纪元登记到 slots 中，写者摘除结点后
+ * 记录当时的纪元并将纪元加一，所有登记的纪元都大于结点的纪元时，没有读者还能访问
+ * 该结点，才真正释放。
+ */
+struct rb_sync_tree_st
+{
+    RB_TREE *tree;
+
+    pthread_mutex_t lock;
+
+    unsigned long seq;
+    unsigned long epoch;
+
+    RB_SYNC_RETIRED *retired;
+    int retired_count;
+    int retired_size;
+
+    RB_SYNC_SLOT slots[RB_SYNC_SLOTS];
+};
+
+/**
+ * 所有红黑树共用的哨兵节点，颜色为黑色
+ * 
+ * 哨兵节点是只读的，任何操作都不会修改它，删除结点时所需的父结点由调用方显式传递，
+ * 因此不同线程操作不同的树时不会在哨兵节点上产生竞争，结点也可以在树之间移动。
+ */
+static RB_NODE rb_nil_node = {
+    RBTREE_COLOR_BLACK, NULL, NULL, 0, NULL, NULL
 };
 
 /* 对结点 node 进行左旋转 */
@@ -42,8 +322,8 @@ static int rb_right_rotate(RB_TREE *tree, RB_NODE *node);
 /* 插入结点时调整红黑树 */
 static int rb_insert_fixup_tree(RB_TREE *tree, RB_NODE *node);
 
-/* 删除节点时调整红黑树 */
-static int rb_delete_fixup_tree(RB_TREE *tree, RB_NODE *node);
+/* 删除节点时调整红黑树，node 可能是哨兵节点，所以需要传入它的父结点 parent */
+static int rb_delete_fixup_tree(RB_TREE *tree, RB_NODE *node, RB_NODE *parent);
 
 /* 节点移动 */
 static int rb_node_transplant(RB_TREE *tree, RB_NODE *dest, RB_NODE *src);
@@ -52,619 +332,3157 @@ static int rb_node_transplant(RB_TREE *tree, RB_NODE *dest, RB_NODE *src);
 static void rb_node_set_color(RB_NODE *node, unsigned int color);
 
 /* 获取颜色 */
-static unsigned int rb_node_get_color(RB_NODE *node);
+static unsigned int rb_node_get_color(const RB_NODE *node);
+
+/* 获取父结点 */
+static RB_NODE *rb_node_get_parent(const RB_NODE *node);
+
+/* 设置父结点，保留颜色 */
+static void rb_node_set_parent(RB_NODE *node, RB_NODE *parent);
 
 /* 是否为哨兵节点，如果哨兵节点或者空节点，返回 1，否则返回 0 */
-static int rb_node_is_nil(RB_NODE *node);
+static int rb_node_is_nil(const RB_NODE *node);
+
+#ifdef RBTREE_ORDER_STAT
+/* 获取子树的结点数目，哨兵节点为 0 */
+static int rb_node_size(const RB_NODE *node);
+
+/* 从 node 开始到根结点路径上所有结点的子树大小加上 delta */
+static void rb_node_update_size(RB_NODE *node, int delta);
+#endif
+
+/**
+ * 查找 key 的插入位置，只从根结点向下搜索一次
+ * 
+ * 键不存在时插入新结点并返回 0，键已存在时返回 1，node 返回新插入或者已存在的结点，
+ * 出错返回 -1。
+ */
+static int rb_node_insert(RB_TREE *tree, const char *key, void *data, RB_NODE **node);
+
+/* 将 key 所在的结点从树中摘除但不释放，返回被摘除的结点，不存在返回 NULL */
+static RB_NODE *rb_node_unlink(RB_TREE *tree, const char *key);
+
+/* 释放结点，位于结点块中的结点随结点块一起释放 */
+static void rb_node_free(RB_NODE *node);
+
+/* 由有序数组中 [begin, end) 区间内的元素构建子树，深度为 red 的结点为红色 */
+static RB_NODE *rb_build_subtree(
+    RB_NODE *nodes, const char **keys, void **data,
+    int begin, int end, int depth, int red, RB_NODE *parent);
+
+/* 无锁查找登记读者，返回槽的下标，没有空闲的槽返回 -1 */
+static int rb_sync_enter(RB_SYNC_TREE *tree);
+
+/* 读者离开 */
+static void rb_sync_leave(RB_SYNC_TREE *tree, int slot);
+
+/* 无锁查找一次，找到返回 0，不存在返回 -1，查找期间树被修改需要重试返回 1 */
+static int rb_sync_lookup(RB_SYNC_TREE *tree, const char *key, void **data);
+
+/* 加锁并开始修改 */
+static void rb_sync_write_begin(RB_SYNC_TREE *tree);
+
+/* 结束修改并解锁 */
+static void rb_sync_write_end(RB_SYNC_TREE *tree);
+
+/* 将摘除的结点加入待回收列表，需要持有锁 */
+static void rb_sync_retire(RB_SYNC_TREE *tree, RB_NODE *node);
+
+/* 释放没有读者能够访问到的结点，需要持有锁 */
+static void rb_sync_reclaim(RB_SYNC_TREE *tree);
+
+/* 树增加对结点块的引用 */
+static int rb_block_attach(RB_TREE *tree, RB_BLOCK *block);
+
+/* 释放树对所有结点块的引用 */
+static void rb_block_release(RB_TREE *tree);
+
+/* 将 src 对结点块的引用转移给 dest，dest 已经引用的块直接释放 src 的引用 */
+static void rb_block_move(RB_TREE *dest, RB_TREE *src);
+
+/* 按地址比较结点块，用于 qsort 和 bsearch */
+static int rb_block_compare(const void *a, const void *b);
+
+/* dest 引用 src 引用的所有结点块 */
+static int rb_block_share(RB_TREE *dest, const RB_TREE *src);
+
+/* 设置结点的孩子并更新孩子的父结点 */
+static void rb_node_link(RB_NODE *node, RB_NODE *left, RB_NODE *right);
+
+/* 计算子树的黑高，即从根结点到叶子的路径上黑色结点的数目，哨兵节点为 0 */
+static int rb_node_black_height(const RB_NODE *node);
+
+/* 以结点为根旋转独立的子树，返回新的根结点 */
+static RB_NODE *rb_join_rotate_left(RB_NODE *node);
+static RB_NODE *rb_join_rotate_right(RB_NODE *node);
+
+/* 黑高较高的一侧沿右侧或者左侧向下，找到黑高相同的黑色结点后连接 */
+static RB_NODE *rb_join_right(RB_NODE *left, int left_bh, RB_NODE *node, RB_NODE *right, int right_bh);
+static RB_NODE *rb_join_left(RB_NODE *left, int left_bh, RB_NODE *node, RB_NODE *right, int right_bh);
+
+/**
+ * 以 node 为中间结点连接两颗子树，left 中的键都小于 node，right 中的键都大于 node
+ * 
+ * 时间复杂度为 O(|left_bh - right_bh| + 1)，bh 返回结果的黑高，结果的根结点可能是红色。
+ */
+static RB_NODE *rb_join_node(RB_NODE *left, int left_bh, RB_NODE *node, RB_NODE *right, int right_bh, int *bh);
+
+/* 连接两颗子树，left 中的键都小于 right 中的键 */
+static RB_NODE *rb_join_pair(RB_NODE *left, int left_bh, RB_NODE *right, int right_bh, int *bh);
+
+/* 摘除子树中最大的结点，返回剩余的子树 */
+static RB_NODE *rb_split_last(RB_NODE *tree, int tree_bh, RB_NODE **last, int *bh);
+
+/* 将子树按照 key 拆分为小于 key 和大于 key 的两颗子树，prefix 为 key 的前缀，由调用方计算一次 */
+static void rb_split_node(RB_NODE *tree, int tree_bh, const char *key, uint64_t prefix, RB_SPLIT *split);
+
+/* 释放子树中的所有结点，返回结点数目 */
+static int rb_set_drop(const RB_SET_CTX *ctx, RB_NODE *node);
+
+/**
+ * 并集中 other 远小于 tree 时，将 other 的结点按中序逐个插入 tree
+ * 
+ * 拆分在每一层都要重新连接，开销是一次查找的数倍；other 只有几十个结点时，直接从 tree 的根
+ * 向下查找插入位置并旋转修复更快。tree 是独立的子树，不属于任何 RB_TREE，bh 返回结果的黑高。
+ */
+static RB_NODE *rb_set_insert(
+    const RB_SET_CTX *ctx, RB_NODE *tree, int tree_bh, RB_NODE *other, int *bh, int *dropped);
+
+/* 将子树 other 中的结点逐个插入 tree 描述的子树 */
+static void rb_set_insert_node(const RB_SET_CTX *ctx, RB_TREE *tree, RB_NODE *other, int *dropped);
+
+/* 释放一个结点 */
+static void rb_set_drop_node(const RB_SET_CTX *ctx, RB_NODE *node);
+
+/* 对两颗子树执行集合运算，dropped 返回释放的结点数目 */
+static RB_NODE *rb_set_node(
+    const RB_SET_CTX *ctx, RB_NODE *tree, int tree_bh, RB_NODE *other, int other_bh,
+    int depth, int *bh, int *dropped);
+
+/* 线程入口，执行 RB_SET_TASK 描述的集合运算 */
+static void *rb_set_thread(void *args);
+
+/* 对两颗树执行集合运算，结果保存在 tree 中，other 被销毁 */
+static int rb_set_apply(
+    RB_TREE *tree, RB_TREE *other, int op, void (*drop)(void *key, void *data, void *args), void *args);
+
+#ifndef RBTREE_ORDER_STAT
+/* 不维护子树大小时交替遍历两颗子树计数，返回较小的一颗的结点数目，which 返回它是哪一颗 */
+static int rb_node_count_smaller(const RB_NODE *left, const RB_NODE *right, int *which);
+#endif
+
+/* 将子树按中序分解为单元，grain 为整颗子树作为一个单元的最大结点数，depth 为剩余的分解层数 */
+static int rb_parallel_split(RB_PARALLEL_JOB *job, RB_NODE *node, int grain, int depth);
+
+/* 添加一个单元 */
+static int rb_parallel_add(RB_PARALLEL_JOB *job, RB_NODE *node, int whole);
+
+/* 处理一个单元中的所有结点 */
+static void rb_parallel_unit(RB_PARALLEL_JOB *job, RB_PARALLEL_UNIT *unit, void *acc);
+
+/* 工作线程入口，不断领取单元直到全部处理完 */
+static void *rb_parallel_thread(void *args);
+
+/* 分解树并用 threads 个线程执行任务，workers 返回各线程的状态 */
+static int rb_parallel_run(RB_TREE *tree, int threads, RB_PARALLEL_JOB *job, RB_PARALLEL_WORKER **workers);
 
 /**
- * 声明栈方法
+ * 获取查找 key 的起点
  * 
- * RB_STACK
- * extern int rb_stack_push(RB_STACK *stack, RB_NODE *node);
- * extern int rb_stack_pop(RB_STACK *stack, RB_NODE **ret);
+ * 没有开启 RB_FLAG_FINGER 或者没有最近访问的结点时返回根结点，否则从最近访问的结点向上
+ * 回溯到子树的键范围包含 key 的祖先，从该结点向下查找与从根结点查找的结果相同。
  */
-STACK_DEFINE(rb, RB, RB_NODE *);
+static RB_NODE *rb_finger_search(const RB_TREE *tree, const char *key, uint64_t prefix);
+
+/* 拥有键时返回键在树中的副本，失败返回 NULL */
+static const char *rb_key_own(RB_TREE *tree, const char *key);
+
+/* 从键区域中申请 size 字节 */
+static char *rb_arena_alloc(RB_TREE *tree, size_t size);
+
+/* 扩大去重表 */
+static int rb_intern_grow(RB_TREE *tree);
+
+/* 字符串的 FNV-1a 散列值 */
+static uint64_t rb_key_hash(const char *key);
+
+/* 计算键的前缀 */
+static uint64_t rb_key_prefix(const char *key);
+
+/* 比较键与结点的键，prefix 为键的前缀，返回值与 strcmp 相同 */
+static int rb_key_compare(const char *key, uint64_t prefix, const RB_NODE *node);
+
+/* 布隆过滤器使用的散列值，每次处理 8 个字节 */
+static uint64_t rb_bloom_hash(const char *key);
+
+/* 检查键是否可能在树中，hash 为 rb_bloom_hash 的结果，返回 0 时一定不在树中 */
+static int rb_bloom_test(const RB_TREE *tree, uint64_t hash);
+
+/* 在过滤器中设置键的各位 */
+static void rb_bloom_set(uint64_t *bloom, size_t blocks, uint64_t hash);
+
+/* 插入键后更新过滤器，键数超出容量时扩大并重建 */
+static void rb_bloom_add(RB_TREE *tree, const char *key);
+
+/* 删除或者移出 removed 个键，过期的键超过一半时重建 */
+static void rb_bloom_remove(RB_TREE *tree, int removed);
+
+/* 按当前的键数重新申请并填充过滤器，失败时保留原来的过滤器 */
+static int rb_bloom_rebuild(RB_TREE *tree);
+
+/* 将 other 的键并入 tree 的过滤器，大小相同时按位或，否则重建 */
+static void rb_bloom_merge(RB_TREE *tree, const RB_TREE *other);
+
+/* 拆分后 dest 复制 src 的过滤器，多出的键只增加误判 */
+static void rb_bloom_copy(RB_TREE *dest, const RB_TREE *src);
+
+/* 获取最小的结点，树为空返回 NULL */
+static RB_NODE *rb_node_first(const RB_TREE *tree);
+
+/* 获取最大的结点，树为空返回 NULL */
+static RB_NODE *rb_node_last(const RB_TREE *tree);
+
+/* 获取中序遍历的后继，不存在返回 NULL */
+static RB_NODE *rb_node_next(const RB_NODE *node);
+
+/* 获取中序遍历的前驱，不存在返回 NULL */
+static RB_NODE *rb_node_prev(const RB_NODE *node);
 
 /*===========================================================================*/
 
 RB_TREE *rb_create()
 {
-    RB_NODE *nil = NULL;
+    return rb_create_ex(0);
+}
+
+RB_TREE *rb_create_ex(int flags)
+{
     RB_TREE *tree = malloc(sizeof(RB_TREE));
-    memset(tree, 0, sizeof(sizeof(RB_TREE)));
 
-    nil = malloc(sizeof(RB_NODE));
-    memset(nil, 0, sizeof(RB_NODE));
-    nil->flag = RBTREE_COLOR_BLACK | RBTREE_NIL_NODE;
+    if (!tree) {
+        return NULL;
+    }
+    memset(tree, 0, sizeof(RB_TREE));
+
+    /* 去重的前提是拥有键 */
+    if (flags & RB_FLAG_INTERN_KEYS) {
+        flags |= RB_FLAG_OWN_KEYS;
+    }
 
     tree->root = NULL;
     tree->count = 0;
-    tree->nil = nil;
+    tree->flags = flags;
 
     return tree;
 }
 
 void rb_destroy(RB_TREE *tree)
 {
-    if (tree) {
-        RB_STACK stack;
-        RB_STACK tmp;
-
-        RB_NODE **buf = NULL;
-        RB_NODE *node = NULL;
+    RB_NODE *node = NULL;
 
-        int count = tree->count;
-        if (count <= 0) {
-            return;
-        }
+    if (!tree) {
+        return;
+    }
 
-        /* 后序遍历需要的栈空间是先序和中序的两倍 */
-        buf = malloc(2 * count * sizeof(RB_NODE *));
-        memset(buf, 0, 2 * count * sizeof(RB_NODE *));
+    node = tree->root;
 
-        stack.elems = buf;
-        stack.num = 0;
-        stack.size = count;
+    /* 后序释放结点，释放后将父结点的对应孩子置为哨兵，借助父结点回溯，不需要额外的栈 */
+    while (!rb_node_is_nil(node)) {
+        if (!rb_node_is_nil(node->left)) {
+            node = node->left;
+        } else if (!rb_node_is_nil(node->right)) {
+            node = node->right;
+        } else {
+            RB_NODE *parent = rb_node_get_parent(node);
+
+            if (parent) {
+                if (parent->left == node) {
+                    parent->left = RBTREE_NIL;
+                } else {
+                    parent->right = RBTREE_NIL;
+                }
+            }
 
-        tmp.elems = buf + count;
-        tmp.num = 0;
-        tmp.size = count;
+            rb_node_free(node);
+            node = parent;
+        }
+    }
 
-        node = tree->root;
+    rb_block_release(tree);
+    free(tree->interns);
+    free(tree->bloom);
+    free(tree);
+}
 
-        while ((node && !rb_node_is_nil(node)) || tmp.num > 0) {
-            while (node && !rb_node_is_nil(node)) {
-                /* 将访问到的节点临时保存在 stack 中 */
-                rb_stack_push(&stack, node);
-                rb_stack_push(&tmp, node);
-                node = node->right;
-            }
+RB_TREE *rb_build_sorted(const char **keys, void **data, int count)
+{
+    RB_TREE *tree = NULL;
+    RB_BLOCK *block = NULL;
+    int red = 0;
+    int i = 0;
 
-            if (tmp.num > 0) {
-                /* 弹出压入的结点 */
-                rb_stack_pop(&tmp, &node);
+    if (!keys || count < 0) {
+        return NULL;
+    }
 
-                /* 访问左子树 */
-                node = node->left;
-            }
+    /* 键必须非空并且严格递增 */
+    for (; i < count; i++) {
+        if (!keys[i] || !*keys[i]) {
+            return NULL;
         }
 
-        /* 依次弹出节点并释放 */
-        while (stack.num > 0) {
-            rb_stack_pop(&stack, &node);
-            free(node);
+        if (i > 0 && strcmp(keys[i - 1], keys[i]) >= 0) {
+            return NULL;
         }
+    }
+
+    tree = rb_create();
+    if (!count) {
+        return tree;
+    }
+
+    block = malloc(sizeof(RB_BLOCK) + (size_t)count * sizeof(RB_NODE));
+    if (!block) {
+        free(tree);
+        return NULL;
+    }
+
+    RB_STAT_ADD(tree, allocs, 1);
 
-        free(buf);
-        free(tree->nil);
+    block->ref = 0;
+    if (rb_block_attach(tree, block)) {
+        free(block);
         free(tree);
+        return NULL;
+    }
+
+    /**
+     * 每次取中间元素作为子树的根，左右子树的大小最多相差 1，所以深度小于
+     * red = floor(log2(count + 1)) 的各层都是满的，只有最后一层可能不满。
+     * 将最后一层不满的结点染成红色，其余结点染成黑色，从任意结点到叶子的路径上
+     * 黑色结点的数目都相同，并且红色结点的孩子都是叶子。
+     */
+    while ((2 << red) <= count + 1) {
+        red++;
     }
+
+    tree->root = rb_build_subtree(
+        (RB_NODE *)(block + 1), keys, data, 0, count, 0, red, NULL);
+    tree->count = count;
+    return tree;
 }
 
-int rb_insert(RB_TREE *tree, const char *key, void *data)
+int rb_split(RB_TREE *tree, const char *key, RB_TREE **right)
 {
-    RB_NODE *node = NULL;
-    RB_NODE *target = NULL;
-    RB_NODE *add = NULL;
-
-    int cmp = 0;
+    RB_SPLIT split;
+    RB_TREE *other = NULL;
+    int bh = 0;
+    int count = 0;
+#ifndef RBTREE_ORDER_STAT
+    int which = 0;
+#endif
 
-    if (!tree) {
+    if (!tree || !key || !*key || !right) {
         return -1;
     }
 
-    if (!key || !*key) {
+    other = rb_create_ex(tree->flags);
+    if (!other || rb_block_share(other, tree)) {
+        rb_destroy(other);
         return -1;
     }
 
-    node = tree->root;
+    *right = other;
 
-    /* 搜索红黑树并找到合适的插入位置 */
-    while (node && !rb_node_is_nil(node)) {
-        target = node;
-        cmp = strcmp(key, (const char *)node->key);
+    if (rb_node_is_nil(tree->root)) {
+        return 0;
+    }
 
-        if (!cmp) {
-            /* 结点已存在 */
-            return -1;
-        }
+    rb_split_node(tree->root, rb_node_black_height(tree->root), key, rb_key_prefix(key), &split);
 
-        if (cmp < 0) {
-            /* 搜索左子树 */
-            node = node->left;
-        } else {
-            /* 搜索右子树 */
-            node = node->right;
-        }
+    /* 与 key 相等的结点属于右侧，作为最小的结点连接进去 */
+    if (split.node) {
+        split.right = rb_join_node(RBTREE_NIL, 0, split.node, split.right, split.right_bh, &bh);
     }
 
-    /* 为插入的结点申请内存 */
-    add = malloc(sizeof(RB_NODE));
-    memset(add, 0, sizeof(RB_NODE));
+    rb_node_set_color(split.left, RBTREE_COLOR_BLACK);
+    rb_node_set_color(split.right, RBTREE_COLOR_BLACK);
+    tree->root = split.left;
+    other->root = split.right;
 
-    add->flag = RBTREE_COLOR_RED;
-    add->parent = NULL;
-    add->left = tree->nil;
-    add->right = tree->nil;
-    add->key = (void *)key;
-    add->data = data;
+    /* 最近访问的结点可能已经属于另一颗树 */
+    tree->finger = NULL;
 
-    if (!target) {
-        tree->root = add;
-    } else if (cmp < 0) {
-        target->left = add;
-    } else {
-        target->right = add;
+    /* 过滤器在拆分前包含两侧的键，复制一份给右侧，各自把对方的键计为过期 */
+    rb_bloom_copy(other, tree);
+
+#ifdef RBTREE_ORDER_STAT
+    count = rb_node_size(split.left);
+#else
+    /* 没有子树大小，只能计数，交替遍历使代价与较小的一侧成正比 */
+    count = rb_node_count_smaller(split.left, split.right, &which);
+    if (which) {
+        count = tree->count - count;
     }
+#endif
 
-    add->parent = target;
+    other->count = tree->count - count;
+    tree->count = count;
 
-    if (rb_insert_fixup_tree(tree, add)) {
-        return -1;
+    if (tree->bloom) {
+        rb_bloom_remove(tree, other->count);
+    }
+    if (other->bloom) {
+        rb_bloom_remove(other, tree->count);
     }
-
-    tree->count++;
     return 0;
 }
 
-int rb_delete(RB_TREE *tree, const char *key, void **data)
+int rb_join(RB_TREE *tree, RB_TREE *other)
 {
-    RB_NODE *target = NULL;
-    RB_NODE *tmp = NULL;
-
-    int cmp = 0;
-    unsigned int color = RBTREE_COLOR_RED;
+    RB_NODE *last = NULL;
+    RB_NODE *first = NULL;
+    int bh = 0;
 
-    if (!tree) {
+    if (!tree || !other || tree == other) {
         return -1;
     }
 
-    if (!key || !*key) {
+    last = rb_node_last(tree);
+    first = rb_node_first(other);
+
+    if (last && first && strcmp(last->key, first->key) >= 0) {
         return -1;
     }
 
-    target = tree->root;
+    tree->root = rb_join_pair(
+        tree->root, rb_node_black_height(tree->root),
+        other->root, rb_node_black_height(other->root), &bh);
+    rb_node_set_color(tree->root, RBTREE_COLOR_BLACK);
+    tree->count += other->count;
+    rb_bloom_merge(tree, other);
 
-    /* 搜索红黑树并找到待移除节点 */
-    while (target && !rb_node_is_nil(target)) {
-        cmp = strcmp(key, (const char *)target->key);
+    /* other 的结点都已经属于 tree，只释放树本身 */
+    rb_block_move(tree, other);
+    other->root = NULL;
+    rb_destroy(other);
+    return 0;
+}
 
-        if (!cmp) {
-            /* 结点存在 */
-            break;
-        }
+int rb_union(RB_TREE *tree, RB_TREE *other, void (*drop)(void *key, void *data, void *args), void *args)
+{
+    return rb_set_apply(tree, other, RB_SET_UNION, drop, args);
+}
 
-        if (cmp < 0) {
-            /* 搜索左子树 */
-            target = target->left;
-        } else {
-            /* 搜索右子树 */
-            target = target->right;
-        }
-    }
+int rb_intersection(RB_TREE *tree, RB_TREE *other, void (*drop)(void *key, void *data, void *args), void *args)
+{
+    return rb_set_apply(tree, other, RB_SET_INTERSECTION, drop, args);
+}
+
+int rb_difference(RB_TREE *tree, RB_TREE *other, void (*drop)(void *key, void *data, void *args), void *args)
+{
+    return rb_set_apply(tree, other, RB_SET_DIFFERENCE, drop, args);
+}
+
+int rb_count(const RB_TREE *tree)
+{
+    return tree ? tree->count : 0;
+}
+
+int rb_insert(RB_TREE *tree, const char *key, void *data)
+{
+    RB_NODE *node = NULL;
+
+    if (!tree || !key || !*key) {
+        return -1;
+    }
+
+    /* 键已存在时同样返回 -1 */
+    return rb_node_insert(tree, key, data, &node) ? -1 : 0;
+}
+
+int rb_upsert(RB_TREE *tree, const char *key, void *data, void **old)
+{
+    RB_NODE *node = NULL;
+    int ret = 0;
+
+    if (!tree || !key || !*key) {
+        return -1;
+    }
+
+    ret = rb_node_insert(tree, key, data, &node);
+
+    if (ret == 1) {
+        /* 键已存在，原地替换数据 */
+        if (old) {
+            *old = node->data;
+        }
+        RB_STORE(node->data, data);
+    } else if (!ret && old) {
+        *old = NULL;
+    }
+
+    return ret;
+}
+
+int rb_insert_or_get(RB_TREE *tree, const char *key, void *data, void ***slot)
+{
+    RB_NODE *node = NULL;
+    int ret = 0;
+
+    if (!tree || !key || !*key) {
+        return -1;
+    }
+
+    ret = rb_node_insert(tree, key, data, &node);
+
+    if (ret >= 0 && slot) {
+        *slot = &node->data;
+    }
+
+    return ret;
+}
+
+int rb_delete(RB_TREE *tree, const char *key, void **data)
+{
+    RB_NODE *node = NULL;
+
+    if (!tree || !key || !*key) {
+        return -1;
+    }
+
+    node = rb_node_unlink(tree, key);
+    if (!node) {
+        return -1;
+    }
+
+    if (data) {
+        *data = node->data;
+    }
+
+    rb_node_free(node);
+    return 0;
+}
+
+int rb_find(RB_TREE *tree, const char *key, void **data)
+{
+    RB_NODE *target = NULL;
+    RB_NODE *last = NULL;
+    uint64_t prefix = 0;
+    int compares = 0;
+    int cmp = 0;
+
+    if (!tree) {
+        return -1;
+    }
+
+    if (!key || !*key || !data) {
+        return -1;
+    }
+
+    /* 过滤器确定键不存在时不访问树 */
+    if (tree->bloom && !rb_bloom_test(tree, rb_bloom_hash(key))) {
+        RB_STAT_ADD(tree, lookups, 1);
+        RB_STAT_ADD(tree, bloom_rejects, 1);
+        return -1;
+    }
+
+    prefix = rb_key_prefix(key);
+    target = rb_finger_search(tree, key, prefix);
+
+    /* 搜索红黑树并找到节点 */
+    while (target && !rb_node_is_nil(target)) {
+        last = target;
+        cmp = rb_key_compare(key, prefix, target);
+        compares++;
+
+        if (!cmp) {
+            /* 结点存在 */
+            break;
+        }
+
+        if (cmp < 0) {
+            /* 搜索左子树 */
+            target = target->left;
+        } else {
+            /* 搜索右子树 */
+            target = target->right;
+        }
+    }
+
+    RB_STAT_ADD(tree, lookups, 1);
+    RB_STAT_ADD(tree, compares, compares);
+
+    /* 未找到时记录最后访问的结点，它与 key 在顺序上相邻 */
+    if (tree->flags & RB_FLAG_FINGER) {
+        tree->finger = last;
+    }
 
     if (!target || rb_node_is_nil(target)) {
         return -1;
     }
 
-    /* 记录初始颜色 */
-    color = rb_node_get_color(target);
+    *data = target->data;
+    return 0;
+}
+
+int rb_find_batch(RB_TREE *tree, const char **keys, int count, void **data)
+{
+    RB_NODE *nodes[RBTREE_BATCH_WIDTH];
+    uint64_t prefixes[RBTREE_BATCH_WIDTH];
+    int compares = 0;
+    int rejects = 0;
+    int found = 0;
+    int base = 0;
+
+    if (!tree || !keys || !data || count < 0) {
+        return -1;
+    }
+
+    /**
+     * 每次取出 RBTREE_BATCH_WIDTH 个查找同步推进，每一层依次比较结点中的键前缀并移动到
+     * 孩子结点，同时预取孩子结点。这样一个查找等待内存时，其余查找的访存请求也在进行中，
+     * 缓存未命中的延迟互相重叠。前缀相同时才访问结点的键。
+     */
+    for (; base < count; base += RBTREE_BATCH_WIDTH) {
+        int num = count - base < RBTREE_BATCH_WIDTH ? count - base : RBTREE_BATCH_WIDTH;
+        int active = 0;
+        int i = 0;
+
+        for (; i < num; i++) {
+            data[base + i] = NULL;
+
+            nodes[i] = NULL;
+
+            if (!keys[base + i] || !*keys[base + i] || rb_node_is_nil(tree->root)) {
+                continue;
+            }
+
+            if (tree->bloom && !rb_bloom_test(tree, rb_bloom_hash(keys[base + i]))) {
+                rejects++;
+                continue;
+            }
+
+            nodes[i] = tree->root;
+            prefixes[i] = rb_key_prefix(keys[base + i]);
+            active++;
+        }
+
+        while (active) {
+            for (i = 0; i < num; i++) {
+                RB_NODE *node = nodes[i];
+                int cmp = 0;
+
+                if (!node) {
+                    continue;
+                }
+
+                cmp = rb_key_compare(keys[base + i], prefixes[i], node);
+                compares++;
+
+                if (!cmp) {
+                    data[base + i] = node->data;
+                    node = NULL;
+                    found++;
+                } else {
+                    node = cmp < 0 ? node->left : node->right;
+
+                    if (rb_node_is_nil(node)) {
+                        node = NULL;
+                    } else {
+                        RBTREE_PREFETCH(node);
+                    }
+                }
+
+                if (!node) {
+                    active--;
+                }
+                nodes[i] = node;
+            }
+        }
+    }
+
+    RB_STAT_ADD(tree, lookups, count);
+    RB_STAT_ADD(tree, compares, compares);
+    RB_STAT_ADD(tree, bloom_rejects, rejects);
+    return found;
+}
+
+int rb_iterate(
+    RB_TREE *tree, void (*visit_before)(void *key, void *data, void *args), void *args)
+{
+    RB_NODE *node = NULL;
+
+    if (!tree || !visit_before) {
+        return -1;
+    }
+
+    if (tree->count <= 0) {
+        return -1;
+    }
+
+    /* 借助父结点寻找后继，不需要额外的栈空间 */
+    for (node = rb_node_first(tree); node; node = rb_node_next(node)) {
+        visit_before((void *)node->key, node->data, args);
+    }
+
+    return 0;
+}
+
+int rb_iterate_parallel(
+    RB_TREE *tree, int threads, void (*visit)(void *key, void *data, void *args), void *args)
+{
+    RB_PARALLEL_JOB job;
+    RB_PARALLEL_WORKER *workers = NULL;
+    int ret = 0;
+
+    if (!tree || !visit) {
+        return -1;
+    }
+
+    memset(&job, 0, sizeof(RB_PARALLEL_JOB));
+    job.visit = visit;
+    job.args = args;
+
+    ret = rb_parallel_run(tree, threads, &job, &workers);
+
+    free(workers);
+    free(job.units);
+    return ret;
+}
+
+int rb_reduce_parallel(
+    RB_TREE *tree, int threads, int ordered,
+    void *(*init)(void *args),
+    void (*map)(void *acc, void *key, void *data, void *args),
+    void (*combine)(void *acc, void *other, void *args),
+    void *args, void **result)
+{
+    RB_PARALLEL_JOB job;
+    RB_PARALLEL_WORKER *workers = NULL;
+    void *acc = NULL;
+    int ret = 0;
+    int i = 0;
+
+    if (!tree || !init || !map || !combine || !result) {
+        return -1;
+    }
+
+    memset(&job, 0, sizeof(RB_PARALLEL_JOB));
+    job.init = init;
+    job.map = map;
+    job.combine = combine;
+    job.args = args;
+    job.ordered = ordered;
+
+    ret = rb_parallel_run(tree, threads, &job, &workers);
+
+    if (!ret) {
+        acc = init(args);
 
-    if (rb_node_is_nil(target->left)) {
-        tmp = target->right;
-        rb_node_transplant(tree, target, tmp);
-    } else if (rb_node_is_nil(target->right)) {
-        tmp = target->left;
-        rb_node_transplant(tree, target, tmp);
-    } else {
         /**
-         * 如果待删节点的左子树和右子树均不为 NULL，则找到被删除节点的后继，也就是它右子树的最
-         * 小值和目标节点交换，目标节点的父结点、右子树、左子树分别变成了替换节点的父结点、右
-         * 子树、左子树。
+         * 有序时按单元的中序依次合并，combine 不需要满足交换律；
+         * 否则每个线程只有一个累加器，按线程的顺序合并。
          */
+        if (ordered) {
+            for (; i < job.count; i++) {
+                combine(acc, job.units[i].acc, args);
+            }
+        } else {
+            for (; i < job.threads; i++) {
+                if (workers[i].acc) {
+                    combine(acc, workers[i].acc, args);
+                }
+            }
+        }
 
-        /* 查找 target 后继 */
-        RB_NODE *mini = target->right;
+        *result = acc;
+    }
 
-        while (!rb_node_is_nil(mini->left)) {
-            mini = mini->left;
+    free(workers);
+    free(job.units);
+    return ret;
+}
+
+int rb_stats(const RB_TREE *tree, RB_STATS *stats)
+{
+    const RB_NODE *node = NULL;
+    const RB_BLOCK_REF *ref = NULL;
+    int depth = 0;
+
+    if (!tree || !stats) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(RB_STATS));
+
+#ifdef RBTREE_STAT
+    stats->lookups = __atomic_load_n(&tree->stat.lookups, __ATOMIC_RELAXED);
+    stats->compares = __atomic_load_n(&tree->stat.compares, __ATOMIC_RELAXED);
+    stats->insert_rotations = tree->stat.insert_rotations;
+    stats->delete_rotations = tree->stat.delete_rotations;
+    stats->allocs = tree->stat.allocs;
+    stats->bloom_rejects = __atomic_load_n(&tree->stat.bloom_rejects, __ATOMIC_RELAXED);
+#endif
+
+    stats->count = tree->count;
+    stats->black_height = rb_node_black_height(tree->root);
+
+    /* 结点和块引用占用的内存，不包括键和数据，也不包括结点块中已删除的结点 */
+    stats->bytes = sizeof(RB_TREE) + (size_t)tree->count * sizeof(RB_NODE);
+    for (ref = tree->blocks; ref; ref = ref->next) {
+        stats->bytes += sizeof(RB_BLOCK_REF) + sizeof(RB_BLOCK);
+    }
+    stats->bytes += tree->bloom_blocks * RBTREE_BLOOM_WORDS * sizeof(uint64_t);
+
+    if (rb_node_is_nil(tree->root)) {
+        return 0;
+    }
+
+    /* 借助父结点中序遍历并记录深度，根结点的深度为 0 */
+    for (node = tree->root; !rb_node_is_nil(node->left); node = node->left) {
+        depth++;
+    }
+
+    while (node) {
+        stats->depth[depth]++;
+        if (depth + 1 > stats->height) {
+            stats->height = depth + 1;
+        }
+
+        if (!rb_node_is_nil(node->right)) {
+            node = node->right;
+            depth++;
+
+            for (; !rb_node_is_nil(node->left); node = node->left) {
+                depth++;
+            }
+        } else {
+            const RB_NODE *parent = rb_node_get_parent(node);
+
+            while (parent && node == parent->right) {
+                node = parent;
+                parent = rb_node_get_parent(node);
+                depth--;
+            }
+
+            node = parent;
+            depth--;
+        }
+    }
+
+    return 0;
+}
+
+void rb_stats_reset(RB_TREE *tree)
+{
+#ifdef RBTREE_STAT
+    if (tree) {
+        memset(&tree->stat, 0, sizeof(RB_STATS));
+    }
+#else
+    (void)tree;
+#endif
+}
+
+int rb_rank(RB_TREE *tree, const char *key)
+{
+    RB_NODE *node = NULL;
+    uint64_t prefix = 0;
+    int rank = 0;
+
+    if (!tree || !key) {
+        return -1;
+    }
+
+    prefix = rb_key_prefix(key);
+
+#ifdef RBTREE_ORDER_STAT
+    node = tree->root;
+
+    /* 每次进入右子树时，左子树和当前结点都小于 key */
+    while (!rb_node_is_nil(node)) {
+        int cmp = rb_key_compare(key, prefix, node);
+
+        if (cmp <= 0) {
+            node = node->left;
+        } else {
+            rank += rb_node_size(node->left) + 1;
+            node = node->right;
+        }
+    }
+#else
+    /* 没有维护子树大小，只能按顺序计数 */
+    for (node = rb_node_first(tree); node && rb_key_compare(key, prefix, node) > 0; node = rb_node_next(node)) {
+        rank++;
+    }
+#endif
+
+    return rank;
+}
+
+int rb_select(RB_TREE *tree, int index, const char **key, void **data)
+{
+    RB_NODE *node = NULL;
+
+    if (!tree || index < 0 || index >= tree->count) {
+        return -1;
+    }
+
+#ifdef RBTREE_ORDER_STAT
+    node = tree->root;
+
+    while (!rb_node_is_nil(node)) {
+        int left = rb_node_size(node->left);
+
+        if (index < left) {
+            node = node->left;
+        } else if (index > left) {
+            index -= left + 1;
+            node = node->right;
+        } else {
+            break;
+        }
+    }
+#else
+    for (node = rb_node_first(tree); node && index > 0; node = rb_node_next(node)) {
+        index--;
+    }
+#endif
+
+    if (rb_node_is_nil(node)) {
+        return -1;
+    }
+
+    if (key) {
+        *key = node->key;
+    }
+    if (data) {
+        *data = node->data;
+    }
+    return 0;
+}
+
+int rb_cursor_first(RB_TREE *tree, RB_CURSOR *cursor)
+{
+    if (!tree || !cursor) {
+        return -1;
+    }
+
+    cursor->tree = tree;
+    cursor->node = rb_node_first(tree);
+    return cursor->node ? 0 : -1;
+}
+
+int rb_cursor_last(RB_TREE *tree, RB_CURSOR *cursor)
+{
+    if (!tree || !cursor) {
+        return -1;
+    }
+
+    cursor->tree = tree;
+    cursor->node = rb_node_last(tree);
+    return cursor->node ? 0 : -1;
+}
+
+int rb_cursor_lower_bound(RB_TREE *tree, RB_CURSOR *cursor, const char *key)
+{
+    RB_NODE *node = NULL;
+    RB_NODE *bound = NULL;
+    uint64_t prefix = 0;
+
+    if (!tree || !cursor || !key) {
+        return -1;
+    }
+
+    node = tree->root;
+    prefix = rb_key_prefix(key);
+
+    /* 记录最后一个大于等于 key 的结点 */
+    while (!rb_node_is_nil(node)) {
+        if (rb_key_compare(key, prefix, node) <= 0) {
+            bound = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    cursor->tree = tree;
+    cursor->node = bound;
+    return bound ? 0 : -1;
+}
+
+int rb_cursor_upper_bound(RB_TREE *tree, RB_CURSOR *cursor, const char *key)
+{
+    RB_NODE *node = NULL;
+    RB_NODE *bound = NULL;
+    uint64_t prefix = 0;
+
+    if (!tree || !cursor || !key) {
+        return -1;
+    }
+
+    node = tree->root;
+    prefix = rb_key_prefix(key);
+
+    /* 记录最后一个大于 key 的结点 */
+    while (!rb_node_is_nil(node)) {
+        if (rb_key_compare(key, prefix, node) < 0) {
+            bound = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    cursor->tree = tree;
+    cursor->node = bound;
+    return bound ? 0 : -1;
+}
+
+int rb_cursor_next(RB_CURSOR *cursor)
+{
+    if (!cursor || !cursor->node) {
+        return -1;
+    }
+
+    cursor->node = rb_node_next(cursor->node);
+    return cursor->node ? 0 : -1;
+}
+
+int rb_cursor_prev(RB_CURSOR *cursor)
+{
+    if (!cursor || !cursor->node) {
+        return -1;
+    }
+
+    cursor->node = rb_node_prev(cursor->node);
+    return cursor->node ? 0 : -1;
+}
+
+int rb_cursor_get(const RB_CURSOR *cursor, const char **key, void **data)
+{
+    if (!cursor || !cursor->node) {
+        return -1;
+    }
+
+    if (key) {
+        *key = cursor->node->key;
+    }
+
+    if (data) {
+        *data = cursor->node->data;
+    }
+    return 0;
+}
+
+RB_SYNC_TREE *rb_sync_create()
+{
+    RB_SYNC_TREE *tree = malloc(sizeof(RB_SYNC_TREE));
+
+    if (!tree) {
+        return NULL;
+    }
+    memset(tree, 0, sizeof(RB_SYNC_TREE));
+
+    tree->tree = rb_create();
+    if (!tree->tree) {
+        free(tree);
+        return NULL;
+    }
+
+    pthread_mutex_init(&tree->lock, NULL);
+
+    /* 纪元从 1 开始，0 表示读者槽空闲 */
+    tree->epoch = 1;
+    return tree;
+}
+
+void rb_sync_destroy(RB_SYNC_TREE *tree)
+{
+    int i = 0;
+
+    if (!tree) {
+        return;
+    }
+
+    for (; i < tree->retired_count; i++) {
+        rb_node_free(tree->retired[i].node);
+    }
+
+    rb_destroy(tree->tree);
+    pthread_mutex_destroy(&tree->lock);
+    free(tree->retired);
+    free(tree);
+}
+
+int rb_sync_insert(RB_SYNC_TREE *tree, const char *key, void *data)
+{
+    int ret = 0;
+
+    if (!tree) {
+        return -1;
+    }
+
+    rb_sync_write_begin(tree);
+    ret = rb_insert(tree->tree, key, data);
+    rb_sync_write_end(tree);
+    return ret;
+}
+
+int rb_sync_upsert(RB_SYNC_TREE *tree, const char *key, void *data, void **old)
+{
+    int ret = 0;
+
+    if (!tree) {
+        return -1;
+    }
+
+    rb_sync_write_begin(tree);
+    ret = rb_upsert(tree->tree, key, data, old);
+    rb_sync_write_end(tree);
+    return ret;
+}
+
+int rb_sync_delete(RB_SYNC_TREE *tree, const char *key, void **data)
+{
+    RB_NODE *node = NULL;
+
+    if (!tree || !key || !*key) {
+        return -1;
+    }
+
+    rb_sync_write_begin(tree);
+    node = rb_node_unlink(tree->tree, key);
+
+    if (node) {
+        if (data) {
+            *data = node->data;
+        }
+
+        /* 读者可能仍在访问该结点，推迟释放 */
+        rb_sync_retire(tree, node);
+    }
+
+    rb_sync_write_end(tree);
+    return node ? 0 : -1;
+}
+
+int rb_sync_find(RB_SYNC_TREE *tree, const char *key, void **data)
+{
+    int slot = 0;
+    int ret = 1;
+    int i = 0;
+
+    if (!tree || !key || !*key || !data) {
+        return -1;
+    }
+
+    slot = rb_sync_enter(tree);
+
+    if (slot >= 0) {
+        for (; i < RB_SYNC_RETRY && ret > 0; i++) {
+            ret = rb_sync_lookup(tree, key, data);
+        }
+
+        rb_sync_leave(tree, slot);
+
+        if (ret <= 0) {
+            return ret;
+        }
+    }
+
+    /* 写操作频繁或者读者过多，退化为加锁查找 */
+    pthread_mutex_lock(&tree->lock);
+    ret = rb_find(tree->tree, key, data);
+    pthread_mutex_unlock(&tree->lock);
+    return ret;
+}
+
+void rb_sync_barrier(RB_SYNC_TREE *tree)
+{
+    unsigned long epoch = 0;
+    int i = 0;
+
+    if (!tree) {
+        return;
+    }
+
+    pthread_mutex_lock(&tree->lock);
+
+    /* 此后进入的读者只能看到当前的树，只需要等待已经登记的读者离开 */
+    epoch = __atomic_add_fetch(&tree->epoch, 1, __ATOMIC_SEQ_CST);
+
+    for (; i < RB_SYNC_SLOTS; i++) {
+        unsigned long active = 0;
+
+        while ((active = __atomic_load_n(&tree->slots[i].epoch, __ATOMIC_SEQ_CST)) && active < epoch) {
+            sched_yield();
+        }
+    }
+
+    rb_sync_reclaim(tree);
+    pthread_mutex_unlock(&tree->lock);
+}
+
+/*-------------------------------------------------------*/
+
+int rb_left_rotate(RB_TREE *tree, RB_NODE *node)
+{
+    RB_NODE *y = NULL;
+    RB_NODE *parent = NULL;
+
+    if (!tree || !node) {
+        return -1;
+    }
+
+    y = node->right;
+    RB_STORE(node->right, y->left);
+
+    if (!rb_node_is_nil(y->left)) {
+        rb_node_set_parent(y->left, node);
+    }
+
+    parent = rb_node_get_parent(node);
+    rb_node_set_parent(y, parent);
+
+    /* 处理各种父结点的边界情况 */
+    if (node == tree->root) {
+        RB_STORE(tree->root, y);
+    } else if (node == parent->left) {
+        RB_STORE(parent->left, y);
+    } else if (node == parent->right) {
+        RB_STORE(parent->right, y);
+    }
+
+    RB_STORE(y->left, node);
+    rb_node_set_parent(node, y);
+
+#ifdef RBTREE_ORDER_STAT
+    y->size = node->size;
+    node->size = rb_node_size(node->left) + rb_node_size(node->right) + 1;
+#endif
+    return 0;
+}
+
+int rb_right_rotate(RB_TREE *tree, RB_NODE *node)
+{
+    RB_NODE *x = NULL;
+    RB_NODE *parent = NULL;
+
+    if (!tree || !node) {
+        return -1;
+    }
+
+    x = node->left;
+    RB_STORE(node->left, x->right);
+
+    if (!rb_node_is_nil(x->right)) {
+        rb_node_set_parent(x->right, node);
+    }
+
+    parent = rb_node_get_parent(node);
+    rb_node_set_parent(x, parent);
+
+    /* 处理各种父结点的边界情况 */
+    if (node == tree->root) {
+        RB_STORE(tree->root, x);
+    } else if (node == parent->left) {
+        RB_STORE(parent->left, x);
+    } else if (node == parent->right) {
+        RB_STORE(parent->right, x);
+    }
+
+    RB_STORE(x->right, node);
+    rb_node_set_parent(node, x);
+
+#ifdef RBTREE_ORDER_STAT
+    x->size = node->size;
+    node->size = rb_node_size(node->left) + rb_node_size(node->right) + 1;
+#endif
+    return 0;
+}
+
+int rb_insert_fixup_tree(RB_TREE *tree, RB_NODE *node)
+{
+    RB_NODE *tmp = NULL;
+    RB_NODE *parent = NULL;
+
+    if (!tree || !node || rb_node_is_nil(node)) {
+        return -1;
+    }
+
+    tmp = node;
+
+    while ((parent = rb_node_get_parent(tmp)) && (rb_node_get_color(parent) == RBTREE_COLOR_RED)) {
+        RB_NODE *uncle = RBTREE_NIL;
+
+        /* 父结点是红色，一定不是根结点，所以祖父结点存在 */
+        RB_NODE *grand = rb_node_get_parent(parent);
+
+        /* 判断当前结点的父亲结点是否是祖父的左孩子或者右孩子 */
+        if (parent == grand->left) {
+            uncle = grand->right;
+
+            if (rb_node_get_color(uncle) == RBTREE_COLOR_RED) {
+                rb_node_set_color(uncle, RBTREE_COLOR_BLACK);
+                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
+                rb_node_set_color(grand, RBTREE_COLOR_RED);
+
+                tmp = grand;
+            } else if (tmp == parent->right) {
+                tmp = parent;
+                rb_left_rotate(tree, tmp);
+                RB_STAT_ADD(tree, insert_rotations, 1);
+                parent = rb_node_get_parent(tmp);
+
+                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
+                rb_node_set_color(grand, RBTREE_COLOR_RED);
+                rb_right_rotate(tree, grand);
+                RB_STAT_ADD(tree, insert_rotations, 1);
+            } else {
+                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
+                rb_node_set_color(grand, RBTREE_COLOR_RED);
+                rb_right_rotate(tree, grand);
+                RB_STAT_ADD(tree, insert_rotations, 1);
+            }
+        } else {
+            uncle = grand->left;
+
+            if (rb_node_get_color(uncle) == RBTREE_COLOR_RED) {
+                rb_node_set_color(uncle, RBTREE_COLOR_BLACK);
+                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
+                rb_node_set_color(grand, RBTREE_COLOR_RED);
+
+                tmp = grand;
+            } else if (tmp == parent->left) {
+                tmp = parent;
+                rb_right_rotate(tree, tmp);
+                RB_STAT_ADD(tree, insert_rotations, 1);
+                parent = rb_node_get_parent(tmp);
+
+                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
+                rb_node_set_color(grand, RBTREE_COLOR_RED);
+                rb_left_rotate(tree, grand);
+                RB_STAT_ADD(tree, insert_rotations, 1);
+            } else {
+                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
+                rb_node_set_color(grand, RBTREE_COLOR_RED);
+                rb_left_rotate(tree, grand);
+                RB_STAT_ADD(tree, insert_rotations, 1);
+            }
+        }
+    }
+
+    rb_node_set_color(tree->root, RBTREE_COLOR_BLACK);
+    return 0;
+}
+
+int rb_delete_fixup_tree(RB_TREE *tree, RB_NODE *node, RB_NODE *parent)
+{
+    if (!tree) {
+        return -1;
+    }
+
+    while (node != tree->root && (rb_node_get_color(node) == RBTREE_COLOR_BLACK)) {
+        if (node == parent->left) {
+            RB_NODE *brother = parent->right;
+
+            if (rb_node_get_color(brother) == RBTREE_COLOR_RED) {
+                rb_node_set_color(brother, RBTREE_COLOR_BLACK);
+                rb_node_set_color(parent, RBTREE_COLOR_RED);
+
+                rb_left_rotate(tree, parent);
+                RB_STAT_ADD(tree, delete_rotations, 1);
+                brother = parent->right;
+            }
+
+            if ((rb_node_get_color(brother->left) == RBTREE_COLOR_BLACK) &&
+                (rb_node_get_color(brother->right) == RBTREE_COLOR_BLACK)) {
+                rb_node_set_color(brother, RBTREE_COLOR_RED);
+                node = parent;
+                parent = rb_node_get_parent(node);
+            } else {
+                if (rb_node_get_color(brother->right) == RBTREE_COLOR_BLACK) {
+                    rb_node_set_color(brother->left, RBTREE_COLOR_BLACK);
+                    rb_node_set_color(brother, RBTREE_COLOR_RED);
+
+                    rb_right_rotate(tree, brother);
+                    RB_STAT_ADD(tree, delete_rotations, 1);
+                    brother = parent->right;
+                }
+
+                rb_node_set_color(brother, rb_node_get_color(parent));
+                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
+                rb_node_set_color(brother->right, RBTREE_COLOR_BLACK);
+
+                rb_left_rotate(tree, parent);
+                RB_STAT_ADD(tree, delete_rotations, 1);
+                node = tree->root;
+            }
+        } else {
+            RB_NODE *brother = parent->left;
+
+            if (rb_node_get_color(brother) == RBTREE_COLOR_RED) {
+                rb_node_set_color(brother, RBTREE_COLOR_BLACK);
+                rb_node_set_color(parent, RBTREE_COLOR_RED);
+
+                rb_right_rotate(tree, parent);
+                RB_STAT_ADD(tree, delete_rotations, 1);
+                brother = parent->left;
+            }
+
+            if ((rb_node_get_color(brother->right) == RBTREE_COLOR_BLACK) &&
+                (rb_node_get_color(brother->left) == RBTREE_COLOR_BLACK)) {
+                rb_node_set_color(brother, RBTREE_COLOR_RED);
+                node = parent;
+                parent = rb_node_get_parent(node);
+            } else {
+                if (rb_node_get_color(brother->left) == RBTREE_COLOR_BLACK) {
+                    rb_node_set_color(brother->right, RBTREE_COLOR_BLACK);
+                    rb_node_set_color(brother, RBTREE_COLOR_RED);
+
+                    rb_left_rotate(tree, brother);
+                    RB_STAT_ADD(tree, delete_rotations, 1);
+                    brother = parent->left;
+                }
+
+                rb_node_set_color(brother, rb_node_get_color(parent));
+                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
+                rb_node_set_color(brother->left, RBTREE_COLOR_BLACK);
+
+                rb_right_rotate(tree, parent);
+                RB_STAT_ADD(tree, delete_rotations, 1);
+                node = tree->root;
+            }
+        }
+    }
+
+    rb_node_set_color(node, RBTREE_COLOR_BLACK);
+    return 0;
+}
+
+int rb_node_transplant(RB_TREE *tree, RB_NODE *dest, RB_NODE *src)
+{
+    RB_NODE *parent = NULL;
+
+    if (!tree || !dest || !src) {
+        return -1;
+    }
+
+    parent = rb_node_get_parent(dest);
+
+    if (!parent) {
+        RB_STORE(tree->root, src);
+    } else if (parent->left == dest) {
+        RB_STORE(parent->left, src);
+    } else if (parent->right == dest) {
+        RB_STORE(parent->right, src);
+    }
+
+    /* 哨兵节点是只读的，不记录父结点 */
+    if (!rb_node_is_nil(src)) {
+        rb_node_set_parent(src, parent);
+    }
+    return 0;
+}
+
+void rb_node_set_color(RB_NODE *node, unsigned int color)
+{
+    if (!rb_node_is_nil(node)) {
+        node->parent_color = (node->parent_color & ~(uintptr_t)RBTREE_COLOR_MASK) | color;
+    }
+}
+
+unsigned int rb_node_get_color(const RB_NODE *node)
+{
+    if (node) {
+        return node->parent_color & RBTREE_COLOR_MASK;
+    }
+    return RBTREE_COLOR_BLACK;
+}
+
+RB_NODE *rb_node_get_parent(const RB_NODE *node)
+{
+    return (RB_NODE *)(node->parent_color & ~(uintptr_t)RBTREE_FLAG_MASK);
+}
+
+void rb_node_set_parent(RB_NODE *node, RB_NODE *parent)
+{
+    node->parent_color = (uintptr_t)parent | (node->parent_color & RBTREE_FLAG_MASK);
+}
+
+int rb_node_is_nil(const RB_NODE *node)
+{
+    return !node || node == RBTREE_NIL;
+}
+
+int rb_node_insert(RB_TREE *tree, const char *key, void *data, RB_NODE **node)
+{
+    RB_NODE *target = NULL;
+    RB_NODE *add = NULL;
+    RB_NODE *cur = NULL;
+
+    uint64_t prefix = 0;
+    int compares = 0;
+    int cmp = 0;
+
+    if (!tree) {
+        return -1;
+    }
+
+    if (!key || !*key) {
+        return -1;
+    }
+
+    prefix = rb_key_prefix(key);
+    cur = rb_finger_search(tree, key, prefix);
+
+    /* 搜索红黑树并找到合适的插入位置 */
+    while (cur && !rb_node_is_nil(cur)) {
+        target = cur;
+        cmp = rb_key_compare(key, prefix, cur);
+        compares++;
+
+        if (!cmp) {
+            /* 结点已存在 */
+            RB_STAT_ADD(tree, compares, compares);
+
+            if (tree->flags & RB_FLAG_FINGER) {
+                tree->finger = cur;
+            }
+
+            *node = cur;
+            return 1;
+        }
+
+        if (cmp < 0) {
+            /* 搜索左子树 */
+            cur = cur->left;
+        } else {
+            /* 搜索右子树 */
+            cur = cur->right;
+        }
+    }
+
+    RB_STAT_ADD(tree, compares, compares);
+
+    if (tree->flags & RB_FLAG_OWN_KEYS) {
+        key = rb_key_own(tree, key);
+        if (!key) {
+            return -1;
+        }
+    }
+
+    /* 为插入的结点申请内存 */
+    add = malloc(sizeof(RB_NODE));
+    if (!add) {
+        return -1;
+    }
+    memset(add, 0, sizeof(RB_NODE));
+    RB_STAT_ADD(tree, allocs, 1);
+
+    add->parent_color = (uintptr_t)target | RBTREE_COLOR_RED;
+    add->left = RBTREE_NIL;
+    add->right = RBTREE_NIL;
+    add->prefix = prefix;
+    add->key = key;
+    add->data = data;
+#ifdef RBTREE_ORDER_STAT
+    add->size = 1;
+    rb_node_update_size(target, 1);
+#endif
+
+    /* 结点的内容写完之后再发布 */
+    if (!target) {
+        RB_STORE(tree->root, add);
+    } else if (cmp < 0) {
+        RB_STORE(target->left, add);
+    } else {
+        RB_STORE(target->right, add);
+    }
+
+    if (rb_insert_fixup_tree(tree, add)) {
+        return -1;
+    }
+
+    if (tree->flags & RB_FLAG_FINGER) {
+        tree->finger = add;
+    }
+
+    tree->count++;
+
+    if (tree->flags & RB_FLAG_BLOOM) {
+        rb_bloom_add(tree, key);
+    }
+
+    *node = add;
+    return 0;
+}
+
+RB_NODE *rb_node_unlink(RB_TREE *tree, const char *key)
+{
+    RB_NODE *target = NULL;
+    RB_NODE *tmp = NULL;
+    RB_NODE *parent = NULL;
+
+    uint64_t prefix = 0;
+    int compares = 0;
+    int cmp = 0;
+    unsigned int color = RBTREE_COLOR_RED;
+
+    if (!tree || !key || !*key) {
+        return NULL;
+    }
+
+    if (tree->bloom && !rb_bloom_test(tree, rb_bloom_hash(key))) {
+        return NULL;
+    }
+
+    prefix = rb_key_prefix(key);
+    target = rb_finger_search(tree, key, prefix);
+
+    /* 搜索红黑树并找到待移除节点 */
+    while (target && !rb_node_is_nil(target)) {
+        cmp = rb_key_compare(key, prefix, target);
+        compares++;
+
+        if (!cmp) {
+            /* 结点存在 */
+            break;
+        }
+
+        if (cmp < 0) {
+            /* 搜索左子树 */
+            target = target->left;
+        } else {
+            /* 搜索右子树 */
+            target = target->right;
+        }
+    }
+
+    RB_STAT_ADD(tree, compares, compares);
+
+    if (!target || rb_node_is_nil(target)) {
+        return NULL;
+    }
+
+    /* 被删除结点的后继或者前驱作为新的起点，结点只会重新链接，不会移动，摘除后仍然有效 */
+    if (tree->flags & RB_FLAG_FINGER) {
+        tree->finger = rb_node_next(target);
+
+        if (!tree->finger) {
+            tree->finger = rb_node_prev(target);
+        }
+    }
+
+    /* 记录初始颜色 */
+    color = rb_node_get_color(target);
+
+#ifdef RBTREE_ORDER_STAT
+    /**
+     * 实际从树中摘除的位置是 target 或者它的后继，先将该位置以上各结点的子树大小减一，
+     * 后继替换 target 时继承 target 的子树大小。
+     */
+    if (rb_node_is_nil(target->left) || rb_node_is_nil(target->right)) {
+        rb_node_update_size(rb_node_get_parent(target), -1);
+    } else {
+        RB_NODE *succ = rb_node_next(target);
+        rb_node_update_size(rb_node_get_parent(succ), -1);
+    }
+#endif
+
+    if (rb_node_is_nil(target->left)) {
+        tmp = target->right;
+        parent = rb_node_get_parent(target);
+        rb_node_transplant(tree, target, tmp);
+    } else if (rb_node_is_nil(target->right)) {
+        tmp = target->left;
+        parent = rb_node_get_parent(target);
+        rb_node_transplant(tree, target, tmp);
+    } else {
+        /**
+         * 如果待删节点的左子树和右子树均不为 NULL，则找到被删除节点的后继，也就是它右子树的最
+         * 小值和目标节点交换，目标节点的父结点、右子树、左子树分别变成了替换节点的父结点、右
+         * 子树、左子树。
+         */
+
+        /* 查找 target 后继 */
+        RB_NODE *mini = target->right;
+
+        while (!rb_node_is_nil(mini->left)) {
+            mini = mini->left;
+        }
+
+        color = rb_node_get_color(mini);
+
+        /* mini 已经是待删节点的后继，说明它没有左子树，所以直接用它的右子树替换掉它 */
+        tmp = mini->right;
+
+        if (rb_node_get_parent(mini) == target) {
+            parent = mini;
+        } else {
+            /* 用后继的右子树替换后继 */
+            parent = rb_node_get_parent(mini);
+            rb_node_transplant(tree, mini, tmp);
+            RB_STORE(mini->right, target->right);
+            rb_node_set_parent(mini->right, mini);
+        }
+
+        /* 用后继替换待删除节点 */
+        rb_node_transplant(tree, target, mini);
+
+        RB_STORE(mini->left, target->left);
+        rb_node_set_parent(mini->left, mini);
+        rb_node_set_color(mini, rb_node_get_color(target));
+#ifdef RBTREE_ORDER_STAT
+        mini->size = target->size;
+#endif
+    }
+
+    /* 被删节点为黑色，可能会影响红黑树的性质，所以需要重新调整至平衡 */
+    if (color == RBTREE_COLOR_BLACK) {
+        rb_delete_fixup_tree(tree, tmp, parent);
+    }
+
+    tree->count--;
+
+    if (tree->bloom) {
+        rb_bloom_remove(tree, 1);
+    }
+
+    return target;
+}
+
+#ifdef RBTREE_ORDER_STAT
+int rb_node_size(const RB_NODE *node)
+{
+    return rb_node_is_nil(node) ? 0 : node->size;
+}
+
+void rb_node_update_size(RB_NODE *node, int delta)
+{
+    for (; node; node = rb_node_get_parent(node)) {
+        node->size += delta;
+    }
+}
+#endif
+
+int rb_parallel_split(RB_PARALLEL_JOB *job, RB_NODE *node, int grain, int depth)
+{
+    if (rb_node_is_nil(node)) {
+        return 0;
+    }
+
+#ifdef RBTREE_ORDER_STAT
+    /* 按子树大小分解，每个单元的结点数不超过 grain */
+    (void)depth;
+
+    if (node->size <= grain) {
+        return rb_parallel_add(job, node, 1);
+    }
+#else
+    /* 没有子树大小，按深度分解，红黑树近似平衡，同一层的子树大小相差不大 */
+    (void)grain;
+
+    if (depth <= 0) {
+        return rb_parallel_add(job, node, 1);
+    }
+#endif
+
+    if (rb_parallel_split(job, node->left, grain, depth - 1) ||
+        rb_parallel_add(job, node, 0) ||
+        rb_parallel_split(job, node->right, grain, depth - 1)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int rb_parallel_add(RB_PARALLEL_JOB *job, RB_NODE *node, int whole)
+{
+    if (job->count >= job->size) {
+        int size = job->size ? job->size * 2 : RB_PARALLEL_UNITS * 16;
+        RB_PARALLEL_UNIT *units = realloc(job->units, size * sizeof(RB_PARALLEL_UNIT));
+
+        if (!units) {
+            return -1;
+        }
+
+        job->units = units;
+        job->size = size;
+    }
+
+    job->units[job->count].node = node;
+    job->units[job->count].whole = whole;
+    job->units[job->count].acc = NULL;
+    job->count++;
+    return 0;
+}
+
+void rb_parallel_unit(RB_PARALLEL_JOB *job, RB_PARALLEL_UNIT *unit, void *acc)
+{
+    RB_NODE *node = unit->node;
+    RB_NODE *last = unit->node;
+
+    /* 整颗子树从最左侧的结点开始借助父结点访问后继，直到最右侧的结点 */
+    if (unit->whole) {
+        while (!rb_node_is_nil(node->left)) {
+            node = node->left;
+        }
+        while (!rb_node_is_nil(last->right)) {
+            last = last->right;
+        }
+    }
+
+    for (;;) {
+        if (job->visit) {
+            job->visit((void *)node->key, node->data, job->args);
+        } else {
+            job->map(acc, (void *)node->key, node->data, job->args);
+        }
+
+        if (node == last) {
+            break;
+        }
+        node = rb_node_next(node);
+    }
+}
+
+void *rb_parallel_thread(void *args)
+{
+    RB_PARALLEL_WORKER *worker = args;
+    RB_PARALLEL_JOB *job = worker->job;
+    int index = 0;
+
+    while ((index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        RB_PARALLEL_UNIT *unit = job->units + index;
+
+        if (job->visit) {
+            rb_parallel_unit(job, unit, NULL);
+        } else if (job->ordered) {
+            unit->acc = job->init(job->args);
+            rb_parallel_unit(job, unit, unit->acc);
+        } else {
+            /* 线程的累加器在领取到第一个单元时才创建 */
+            if (!worker->acc) {
+                worker->acc = job->init(job->args);
+            }
+            rb_parallel_unit(job, unit, worker->acc);
+        }
+    }
+
+    return NULL;
+}
+
+int rb_parallel_run(RB_TREE *tree, int threads, RB_PARALLEL_JOB *job, RB_PARALLEL_WORKER **workers)
+{
+    RB_PARALLEL_WORKER *list = NULL;
+    int target = 0;
+    int depth = 0;
+    int i = 0;
+
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads <= 0) {
+        threads = 1;
+    }
+    if (threads > RB_PARALLEL_MAX_THREADS) {
+        threads = RB_PARALLEL_MAX_THREADS;
+    }
+
+    /* 每个线程分到多个单元，先完成的线程继续领取，避免个别较大的子树拖慢整体 */
+    target = threads * RB_PARALLEL_UNITS;
+    while ((1 << depth) < target) {
+        depth++;
+    }
+
+    if (rb_parallel_split(job, tree->root, tree->count / target + 1, depth)) {
+        return -1;
+    }
+
+    list = malloc(threads * sizeof(RB_PARALLEL_WORKER));
+    if (!list) {
+        return -1;
+    }
+    memset(list, 0, threads * sizeof(RB_PARALLEL_WORKER));
+
+    /* 当前线程也作为第一个工作线程，创建失败的线程由其它线程分担 */
+    for (; i < threads; i++) {
+        list[i].job = job;
+
+        if (i > 0 && pthread_create(&list[i].thread, NULL, rb_parallel_thread, list + i)) {
+            list[i].job = NULL;
+        }
+    }
+
+    job->threads = threads;
+    rb_parallel_thread(list);
+
+    for (i = 1; i < threads; i++) {
+        if (list[i].job) {
+            pthread_join(list[i].thread, NULL);
+        }
+    }
+
+    *workers = list;
+    return 0;
+}
+
+int rb_block_attach(RB_TREE *tree, RB_BLOCK *block)
+{
+    RB_BLOCK_REF *ref = malloc(sizeof(RB_BLOCK_REF));
+
+    if (!ref) {
+        return -1;
+    }
+
+    __atomic_add_fetch(&block->ref, 1, __ATOMIC_RELAXED);
+
+    ref->block = block;
+    ref->next = tree->blocks;
+    tree->blocks = ref;
+    return 0;
+}
+
+void rb_block_release(RB_TREE *tree)
+{
+    RB_BLOCK_REF *ref = NULL;
+
+    while ((ref = tree->blocks)) {
+        tree->blocks = ref->next;
+
+        if (!__atomic_sub_fetch(&ref->block->ref, 1, __ATOMIC_ACQ_REL)) {
+            free(ref->block);
+        }
+        free(ref);
+    }
+}
+
+void rb_block_move(RB_TREE *dest, RB_TREE *src)
+{
+    RB_BLOCK_REF *ref = NULL;
+    RB_BLOCK **owned = NULL;
+    size_t count = 0;
+
+    if (!src->blocks) {
+        return;
+    }
+
+    /**
+     * 拆分后两颗树引用同样的块，再连接或者做集合运算时不去重，每次拆分再合并引用都会翻倍。
+     * 排序 dest 引用的块，src 中重复的引用直接释放；内存不足时不去重，只是多占用引用。
+     */
+    for (ref = dest->blocks; ref; ref = ref->next) {
+        count++;
+    }
+
+    owned = count ? malloc(count * sizeof(RB_BLOCK *)) : NULL;
+    if (owned) {
+        count = 0;
+        for (ref = dest->blocks; ref; ref = ref->next) {
+            owned[count++] = ref->block;
+        }
+        qsort(owned, count, sizeof(RB_BLOCK *), rb_block_compare);
+    }
+
+    while ((ref = src->blocks)) {
+        src->blocks = ref->next;
+
+        if (owned && bsearch(&ref->block, owned, count, sizeof(RB_BLOCK *), rb_block_compare)) {
+            /* dest 仍然持有引用，计数不会减到 0 */
+            __atomic_sub_fetch(&ref->block->ref, 1, __ATOMIC_ACQ_REL);
+            free(ref);
+            continue;
+        }
+
+        ref->next = dest->blocks;
+        dest->blocks = ref;
+    }
+
+    free(owned);
+}
+
+int rb_block_compare(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(RB_BLOCK *const *)a;
+    uintptr_t y = (uintptr_t)*(RB_BLOCK *const *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int rb_block_share(RB_TREE *dest, const RB_TREE *src)
+{
+    RB_BLOCK_REF *ref = src->blocks;
+
+    for (; ref; ref = ref->next) {
+        if (rb_block_attach(dest, ref->block)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void rb_node_link(RB_NODE *node, RB_NODE *left, RB_NODE *right)
+{
+    node->left = left;
+    node->right = right;
+
+    if (!rb_node_is_nil(left)) {
+        rb_node_set_parent(left, node);
+    }
+    if (!rb_node_is_nil(right)) {
+        rb_node_set_parent(right, node);
+    }
+
+#ifdef RBTREE_ORDER_STAT
+    node->size = rb_node_size(left) + rb_node_size(right) + 1;
+#endif
+}
+
+int rb_node_black_height(const RB_NODE *node)
+{
+    int bh = 0;
+
+    for (; !rb_node_is_nil(node); node = node->left) {
+        bh += rb_node_get_color(node) == RBTREE_COLOR_BLACK;
+    }
+
+    return bh;
+}
+
+RB_NODE *rb_join_rotate_left(RB_NODE *node)
+{
+    RB_NODE *x = node->right;
+
+    rb_node_link(node, node->left, x->left);
+    rb_node_link(x, node, x->right);
+    return x;
+}
+
+RB_NODE *rb_join_rotate_right(RB_NODE *node)
+{
+    RB_NODE *x = node->left;
+
+    rb_node_link(node, x->right, node->right);
+    rb_node_link(x, x->left, node);
+    return x;
+}
+
+RB_NODE *rb_join_right(RB_NODE *left, int left_bh, RB_NODE *node, RB_NODE *right, int right_bh)
+{
+    RB_NODE *child = NULL;
+    int black = rb_node_get_color(left) == RBTREE_COLOR_BLACK;
+
+    /* 找到黑高相同的黑色结点，用红色的 node 代替它，黑高保持不变 */
+    if (black && left_bh == right_bh) {
+        rb_node_set_color(node, RBTREE_COLOR_RED);
+        rb_node_link(node, left, right);
+        return node;
+    }
+
+    child = rb_join_right(left->right, left_bh - black, node, right, right_bh);
+    rb_node_link(left, left->left, child);
+
+    /**
+     * 连续两个红色结点只可能出现在右侧，在黑色结点处将下层的红色结点染黑并左旋，
+     * 子树的黑高不变，上移的红色结点可能继续与上层的红色结点冲突，由上层处理。
+     */
+    if (black && rb_node_get_color(left->right) == RBTREE_COLOR_RED &&
+        rb_node_get_color(left->right->right) == RBTREE_COLOR_RED) {
+        rb_node_set_color(left->right->right, RBTREE_COLOR_BLACK);
+        return rb_join_rotate_left(left);
+    }
+
+    return left;
+}
+
+RB_NODE *rb_join_left(RB_NODE *left, int left_bh, RB_NODE *node, RB_NODE *right, int right_bh)
+{
+    RB_NODE *child = NULL;
+    int black = rb_node_get_color(right) == RBTREE_COLOR_BLACK;
+
+    if (black && left_bh == right_bh) {
+        rb_node_set_color(node, RBTREE_COLOR_RED);
+        rb_node_link(node, left, right);
+        return node;
+    }
+
+    child = rb_join_left(left, left_bh, node, right->left, right_bh - black);
+    rb_node_link(right, child, right->right);
+
+    if (black && rb_node_get_color(right->left) == RBTREE_COLOR_RED &&
+        rb_node_get_color(right->left->left) == RBTREE_COLOR_RED) {
+        rb_node_set_color(right->left->left, RBTREE_COLOR_BLACK);
+        return rb_join_rotate_right(right);
+    }
+
+    return right;
+}
+
+RB_NODE *rb_join_node(RB_NODE *left, int left_bh, RB_NODE *node, RB_NODE *right, int right_bh, int *bh)
+{
+    RB_NODE *tree = NULL;
+
+    if (left_bh > right_bh) {
+        tree = rb_join_right(left, left_bh, node, right, right_bh);
+        *bh = left_bh;
+
+        /* 根结点与右孩子都是红色时将根结点染黑，黑高加一 */
+        if (rb_node_get_color(tree) == RBTREE_COLOR_RED &&
+            rb_node_get_color(tree->right) == RBTREE_COLOR_RED) {
+            rb_node_set_color(tree, RBTREE_COLOR_BLACK);
+            (*bh)++;
+        }
+    } else if (left_bh < right_bh) {
+        tree = rb_join_left(left, left_bh, node, right, right_bh);
+        *bh = right_bh;
+
+        if (rb_node_get_color(tree) == RBTREE_COLOR_RED &&
+            rb_node_get_color(tree->left) == RBTREE_COLOR_RED) {
+            rb_node_set_color(tree, RBTREE_COLOR_BLACK);
+            (*bh)++;
+        }
+    } else {
+        /* 黑高相同，两侧的根结点都是黑色时 node 可以是红色 */
+        tree = node;
+        rb_node_link(node, left, right);
+
+        if (rb_node_get_color(left) == RBTREE_COLOR_BLACK &&
+            rb_node_get_color(right) == RBTREE_COLOR_BLACK) {
+            rb_node_set_color(node, RBTREE_COLOR_RED);
+            *bh = left_bh;
+        } else {
+            rb_node_set_color(node, RBTREE_COLOR_BLACK);
+            *bh = left_bh + 1;
+        }
+    }
+
+    rb_node_set_parent(tree, NULL);
+    return tree;
+}
+
+RB_NODE *rb_join_pair(RB_NODE *left, int left_bh, RB_NODE *right, int right_bh, int *bh)
+{
+    RB_NODE *last = NULL;
+    int rest_bh = 0;
+
+    if (rb_node_is_nil(left)) {
+        if (!rb_node_is_nil(right)) {
+            rb_node_set_parent(right, NULL);
+        }
+
+        *bh = right_bh;
+        return right;
+    }
+
+    /* 取出左侧最大的结点作为中间结点 */
+    left = rb_split_last(left, left_bh, &last, &rest_bh);
+    return rb_join_node(left, rest_bh, last, right, right_bh, bh);
+}
+
+RB_NODE *rb_split_last(RB_NODE *tree, int tree_bh, RB_NODE **last, int *bh)
+{
+    RB_NODE *rest = NULL;
+    int black = rb_node_get_color(tree) == RBTREE_COLOR_BLACK;
+    int rest_bh = 0;
+
+    if (rb_node_is_nil(tree->right)) {
+        *last = tree;
+        *bh = tree_bh - black;
+
+        if (!rb_node_is_nil(tree->left)) {
+            rb_node_set_parent(tree->left, NULL);
+        }
+        return tree->left;
+    }
+
+    rest = rb_split_last(tree->right, tree_bh - black, last, &rest_bh);
+    return rb_join_node(tree->left, tree_bh - black, tree, rest, rest_bh, bh);
+}
+
+void rb_split_node(RB_NODE *tree, int tree_bh, const char *key, uint64_t prefix, RB_SPLIT *split)
+{
+    RB_NODE *left = NULL;
+    RB_NODE *right = NULL;
+    int bh = 0;
+    int cmp = 0;
+
+    if (rb_node_is_nil(tree)) {
+        split->left = RBTREE_NIL;
+        split->left_bh = 0;
+        split->node = NULL;
+        split->right = RBTREE_NIL;
+        split->right_bh = 0;
+        return;
+    }
+
+    /* 孩子的黑高 */
+    bh = tree_bh - (rb_node_get_color(tree) == RBTREE_COLOR_BLACK);
+    left = tree->left;
+    right = tree->right;
+    cmp = rb_key_compare(key, prefix, tree);
+
+    if (!cmp) {
+        split->left = left;
+        split->left_bh = bh;
+        split->node = tree;
+        split->right = right;
+        split->right_bh = bh;
+
+        if (!rb_node_is_nil(left)) {
+            rb_node_set_parent(left, NULL);
+        }
+        if (!rb_node_is_nil(right)) {
+            rb_node_set_parent(right, NULL);
+        }
+    } else if (cmp < 0) {
+        /* 拆分左子树，右半部分与当前结点和右子树连接 */
+        rb_split_node(left, bh, key, prefix, split);
+        split->right = rb_join_node(split->right, split->right_bh, tree, right, bh, &split->right_bh);
+    } else {
+        rb_split_node(right, bh, key, prefix, split);
+        split->left = rb_join_node(left, bh, tree, split->left, split->left_bh, &split->left_bh);
+    }
+}
+
+int rb_set_drop(const RB_SET_CTX *ctx, RB_NODE *node)
+{
+    int count = 0;
+
+    if (rb_node_is_nil(node)) {
+        return 0;
+    }
+
+    count += rb_set_drop(ctx, node->left);
+    count += rb_set_drop(ctx, node->right);
+    rb_set_drop_node(ctx, node);
+    return count + 1;
+}
+
+void rb_set_drop_node(const RB_SET_CTX *ctx, RB_NODE *node)
+{
+    if (ctx->drop) {
+        ctx->drop((void *)node->key, node->data, ctx->args);
+    }
+
+    rb_node_free(node);
+}
+
+RB_NODE *rb_set_node(
+    const RB_SET_CTX *ctx, RB_NODE *tree, int tree_bh, RB_NODE *other, int other_bh,
+    int depth, int *bh, int *dropped)
+{
+    RB_SPLIT split;
+    RB_SET_TASK task;
+    RB_NODE *left = NULL;
+    RB_NODE *right = NULL;
+    RB_NODE *node = NULL;
+    pthread_t thread;
+    int other_left_bh = 0;
+    int right_bh = 0;
+    int parallel = 0;
+
+    /* 一侧为空时直接得到结果 */
+    if (rb_node_is_nil(other)) {
+        if (ctx->op == RB_SET_INTERSECTION) {
+            *dropped += rb_set_drop(ctx, tree);
+            *bh = 0;
+            return RBTREE_NIL;
+        }
+
+        *bh = tree_bh;
+        return tree;
+    }
+
+    if (rb_node_is_nil(tree)) {
+        if (ctx->op == RB_SET_UNION) {
+            *bh = other_bh;
+            return other;
+        }
+
+        *dropped += rb_set_drop(ctx, other);
+        *bh = 0;
+        return RBTREE_NIL;
+    }
+
+    if (ctx->op == RB_SET_UNION && other_bh <= RB_SET_INSERT_BH && tree_bh >= other_bh + RB_SET_INSERT_GAP) {
+        return rb_set_insert(ctx, tree, tree_bh, other, bh, dropped);
+    }
+
+    /* 以 other 的根结点拆分 tree，两侧分别递归，other 通常是较小的一颗 */
+    node = other;
+    other_left_bh = other_bh - (rb_node_get_color(other) == RBTREE_COLOR_BLACK);
+    rb_split_node(tree, tree_bh, node->key, node->prefix, &split);
+
+    memset(&task, 0, sizeof(RB_SET_TASK));
+    task.ctx = ctx;
+    task.tree = split.left;
+    task.tree_bh = split.left_bh;
+    task.other = node->left;
+    task.other_bh = other_left_bh;
+    task.depth = depth + 1;
+
+    /* 两侧互不相交，子树足够大时左侧交给新线程 */
+    if (depth < RB_SET_PARALLEL_DEPTH && other_left_bh >= RB_SET_PARALLEL_BH) {
+        parallel = !pthread_create(&thread, NULL, rb_set_thread, &task);
+    }
+
+    if (!parallel) {
+        rb_set_thread(&task);
+    }
+
+    right = rb_set_node(ctx, split.right, split.right_bh, node->right, other_left_bh,
+        depth + 1, &right_bh, dropped);
+
+    if (parallel) {
+        pthread_join(thread, NULL);
+    }
+
+    left = task.result;
+    *dropped += task.dropped;
+
+    switch (ctx->op) {
+    case RB_SET_UNION:
+        /* 两侧都有的键保留 other 中的数据 */
+        if (split.node) {
+            rb_set_drop_node(ctx, split.node);
+            (*dropped)++;
+        }
+        return rb_join_node(left, task.bh, node, right, right_bh, bh);
+
+    case RB_SET_INTERSECTION:
+        /* 两侧都有的键保留 tree 中的数据 */
+        rb_set_drop_node(ctx, node);
+        (*dropped)++;
+
+        if (split.node) {
+            return rb_join_node(left, task.bh, split.node, right, right_bh, bh);
+        }
+        return rb_join_pair(left, task.bh, right, right_bh, bh);
+
+    default:
+        rb_set_drop_node(ctx, node);
+        (*dropped)++;
+
+        if (split.node) {
+            rb_set_drop_node(ctx, split.node);
+            (*dropped)++;
+        }
+        return rb_join_pair(left, task.bh, right, right_bh, bh);
+    }
+}
+
+RB_NODE *rb_set_insert(
+    const RB_SET_CTX *ctx, RB_NODE *tree, int tree_bh, RB_NODE *other, int *bh, int *dropped)
+{
+    RB_TREE sub;
+
+    /*
+     * 拆分得到的子树的根结点仍然记录着原来的父结点，替换和旋转根结点时会改写原来的父结点，
+     * 所以先断开；插入修复要求红色结点的父结点不是根结点，所以再将红色的根结点染黑
+     */
+    memset(&sub, 0, sizeof(RB_TREE));
+    rb_node_set_parent(tree, NULL);
+    rb_node_set_color(tree, RBTREE_COLOR_BLACK);
+    sub.root = tree;
+
+    rb_set_insert_node(ctx, &sub, other, dropped);
+
+    *bh = rb_node_black_height(sub.root);
+    return sub.root;
+}
+
+void rb_set_insert_node(const RB_SET_CTX *ctx, RB_TREE *tree, RB_NODE *other, int *dropped)
+{
+    RB_NODE *left = NULL;
+    RB_NODE *right = NULL;
+    RB_NODE *target = NULL;
+    RB_NODE *cur = NULL;
+    int cmp = 0;
+
+    if (rb_node_is_nil(other)) {
+        return;
+    }
+
+    /* 先取出孩子，other 插入之后它的孩子指针会被改写 */
+    left = other->left;
+    right = other->right;
+
+    rb_set_insert_node(ctx, tree, left, dropped);
+
+    /* 左子树插入时的旋转可能改变根结点，插入之后再取 */
+    cur = tree->root;
+
+    while (!rb_node_is_nil(cur)) {
+        target = cur;
+        cmp = rb_key_compare(other->key, other->prefix, cur);
+
+        if (!cmp) {
+            break;
+        }
+        cur = cmp < 0 ? cur->left : cur->right;
+    }
+
+    if (!rb_node_is_nil(cur)) {
+        /* 两侧都有的键保留 other 中的数据，other 原样占据 cur 的位置 */
+        rb_node_transplant(tree, cur, other);
+        rb_node_link(other, cur->left, cur->right);
+        rb_node_set_color(other, rb_node_get_color(cur));
+
+        rb_set_drop_node(ctx, cur);
+        (*dropped)++;
+    } else {
+        /* 保留结点的标志位，成块申请的结点不能单独释放 */
+        rb_node_set_parent(other, target);
+        rb_node_set_color(other, RBTREE_COLOR_RED);
+        other->left = RBTREE_NIL;
+        other->right = RBTREE_NIL;
+#ifdef RBTREE_ORDER_STAT
+        other->size = 1;
+        rb_node_update_size(target, 1);
+#endif
+
+        if (cmp < 0) {
+            RB_STORE(target->left, other);
+        } else {
+            RB_STORE(target->right, other);
+        }
+        rb_insert_fixup_tree(tree, other);
+    }
+
+    rb_set_insert_node(ctx, tree, right, dropped);
+}
+
+void *rb_set_thread(void *args)
+{
+    RB_SET_TASK *task = args;
+
+    task->result = rb_set_node(task->ctx, task->tree, task->tree_bh, task->other, task->other_bh,
+        task->depth, &task->bh, &task->dropped);
+    return NULL;
+}
+
+int rb_set_apply(
+    RB_TREE *tree, RB_TREE *other, int op, void (*drop)(void *key, void *data, void *args), void *args)
+{
+    RB_SET_CTX ctx;
+    int dropped = 0;
+    int bh = 0;
+
+    if (!tree || !other || tree == other) {
+        return -1;
+    }
+
+    ctx.op = op;
+    ctx.drop = drop;
+    ctx.args = args;
+
+    tree->root = rb_set_node(
+        &ctx, tree->root, rb_node_black_height(tree->root),
+        other->root, rb_node_black_height(other->root), 0, &bh, &dropped);
+
+    if (rb_node_is_nil(tree->root)) {
+        tree->root = NULL;
+    } else {
+        rb_node_set_parent(tree->root, NULL);
+        rb_node_set_color(tree->root, RBTREE_COLOR_BLACK);
+    }
+
+    tree->count += other->count - dropped;
+
+    /* 最近访问的结点可能已经被 drop 释放 */
+    tree->finger = NULL;
+
+    /* 并集中被丢弃的是重复的键，计为过期只会提前重建 */
+    rb_bloom_merge(tree, other);
+    if (tree->bloom) {
+        rb_bloom_remove(tree, dropped);
+    }
+
+    /* other 的结点或者已经释放，或者已经属于 tree */
+    rb_block_move(tree, other);
+    other->root = NULL;
+    rb_destroy(other);
+    return 0;
+}
+
+#ifndef RBTREE_ORDER_STAT
+int rb_node_count_smaller(const RB_NODE *left, const RB_NODE *right, int *which)
+{
+    const RB_NODE *nodes[2];
+    int count = 0;
+    int i = 0;
+
+    nodes[0] = left;
+    nodes[1] = right;
+
+    /* 从两颗子树的最小结点开始，每轮各前进一步，先到达末尾的较小 */
+    for (; i < 2; i++) {
+        if (rb_node_is_nil(nodes[i])) {
+            *which = i;
+            return 0;
+        }
+
+        while (!rb_node_is_nil(nodes[i]->left)) {
+            nodes[i] = nodes[i]->left;
+        }
+    }
+
+    for (;;) {
+        count++;
+
+        for (i = 0; i < 2; i++) {
+            nodes[i] = rb_node_next(nodes[i]);
+
+            if (!nodes[i]) {
+                *which = i;
+                return count;
+            }
+        }
+    }
+}
+#endif
+
+void rb_node_free(RB_NODE *node)
+{
+    if (!(node->parent_color & RBTREE_NODE_BLOCK)) {
+        free(node);
+    }
+}
+
+RB_NODE *rb_build_subtree(
+    RB_NODE *nodes, const char **keys, void **data,
+    int begin, int end, int depth, int red, RB_NODE *parent)
+{
+    RB_NODE *node = NULL;
+    int mid = 0;
+
+    if (begin >= end) {
+        return RBTREE_NIL;
+    }
+
+    /* 结点在块中的位置与键在数组中的位置相同，中序遍历时按地址顺序访问 */
+    mid = begin + (end - begin) / 2;
+    node = nodes + mid;
+
+    node->parent_color = (uintptr_t)parent | RBTREE_NODE_BLOCK |
+        (depth == red ? RBTREE_COLOR_RED : RBTREE_COLOR_BLACK);
+    node->prefix = rb_key_prefix(keys[mid]);
+    node->key = keys[mid];
+    node->data = data ? data[mid] : NULL;
+#ifdef RBTREE_ORDER_STAT
+    node->size = end - begin;
+#endif
+
+    node->left = rb_build_subtree(nodes, keys, data, begin, mid, depth + 1, red, node);
+    node->right = rb_build_subtree(nodes, keys, data, mid + 1, end, depth + 1, red, node);
+    return node;
+}
+
+int rb_sync_enter(RB_SYNC_TREE *tree)
+{
+    unsigned long epoch = __atomic_load_n(&tree->epoch, __ATOMIC_SEQ_CST);
+    unsigned long long hash = (uintptr_t)&epoch >> 12;
+    int start = 0;
+    int i = 0;
+
+    /* 不同线程的栈地址不同，以此为起点寻找空闲的槽，减少线程之间的冲突 */
+    start = (int)((hash * 0x9E3779B97F4A7C15ULL) >> 58) % RB_SYNC_SLOTS;
+
+    for (; i < RB_SYNC_SLOTS; i++) {
+        int index = (start + i) % RB_SYNC_SLOTS;
+        unsigned long idle = 0;
+
+        /* 登记完成后才开始访问树，写者回收结点时一定能看到这次登记 */
+        if (__atomic_compare_exchange_n(&tree->slots[index].epoch, &idle, epoch,
+                0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+void rb_sync_leave(RB_SYNC_TREE *tree, int slot)
+{
+    __atomic_store_n(&tree->slots[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+int rb_sync_lookup(RB_SYNC_TREE *tree, const char *key, void **data)
+{
+    RB_NODE *node = NULL;
+    void *value = NULL;
+    unsigned long seq = 0;
+    uint64_t prefix = 0;
+    int ret = 1;
+    int i = 0;
+
+    prefix = rb_key_prefix(key);
+    seq = __atomic_load_n(&tree->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        /* 写者正在修改 */
+        sched_yield();
+        return 1;
+    }
+
+    /**
+     * 读到的结点可能正在被修改，但因为延迟回收一定不会被释放。不一致的树可能导致
+     * 查找出现环路，所以限制访问的结点数，结果只有在 seq 没有变化时才有效。
+     * 
+     * 指针和数据以 acquire 语义读取，与写者的 RB_STORE 配对：读到任何一个本次修改写入的值，
+     * 之后读取的 seq 一定已经变化，同时保证之后的读取不会被提前到它之前。
+     */
+    node = __atomic_load_n(&tree->tree->root, __ATOMIC_ACQUIRE);
+
+    for (; i < RB_SYNC_MAX_STEPS; i++) {
+        const char *current = NULL;
+        uint64_t other = 0;
+        int cmp = 0;
+
+        if (rb_node_is_nil(node)) {
+            ret = -1;
+            break;
+        }
+
+        current = __atomic_load_n(&node->key, __ATOMIC_RELAXED);
+        if (!current) {
+            break;
         }
 
-        color = rb_node_get_color(mini);
-
-        /* mini 已经是待删节点的后继，说明它没有左子树，所以直接用它的右子树替换掉它 */
-        tmp = mini->right;
+        /* 结点的前缀和键在发布之前写入，之后不再改变，与 rb_key_compare 相同 */
+        other = __atomic_load_n(&node->prefix, __ATOMIC_RELAXED);
 
-        if (mini->parent == target) {
-            tmp->parent = mini;
+        if (prefix != other) {
+            cmp = prefix < other ? -1 : 1;
+        } else if (!(prefix & 0xff)) {
+            cmp = 0;
         } else {
-            /* 用后继的右子树替换后继 */
-            rb_node_transplant(tree, mini, tmp);
-            mini->right = target->right;
-            mini->right->parent = mini;
+            cmp = strcmp(key + RBTREE_KEY_PREFIX, current + RBTREE_KEY_PREFIX);
         }
 
-        /* 用后继替换待删除节点 */
-        rb_node_transplant(tree, target, mini);
+        if (!cmp) {
+            value = __atomic_load_n(&node->data, __ATOMIC_ACQUIRE);
+            ret = 0;
+            break;
+        }
 
-        mini->left = target->left;
-        mini->left->parent = mini;
-        rb_node_set_color(mini, target->flag & RBTREE_COLOR_MASK);
+        node = __atomic_load_n(cmp < 0 ? &node->left : &node->right, __ATOMIC_ACQUIRE);
     }
 
-    /* 被删节点为黑色，可能会影响红黑树的性质，所以需要重新调整至平衡 */
-    if (color == RBTREE_COLOR_BLACK) {
-        rb_delete_fixup_tree(tree, tmp);
+    if (__atomic_load_n(&tree->seq, __ATOMIC_RELAXED) != seq) {
+        return 1;
     }
 
-    tree->count--;
-
-    if (data) {
-        *data = target->data;
+    if (!ret) {
+        *data = value;
     }
+    return ret;
+}
 
-    free(target);
-    return 0;
+void rb_sync_write_begin(RB_SYNC_TREE *tree)
+{
+    pthread_mutex_lock(&tree->lock);
+
+    /* 之后的修改都经过 RB_STORE，不会先于 seq 变为奇数被读者看到 */
+    __atomic_store_n(&tree->seq, tree->seq + 1, __ATOMIC_RELAXED);
 }
 
-int rb_find(RB_TREE *tree, const char *key, void **data)
+void rb_sync_write_end(RB_SYNC_TREE *tree)
 {
-    RB_NODE *target = NULL;
-    int cmp = 0;
+    __atomic_store_n(&tree->seq, tree->seq + 1, __ATOMIC_RELEASE);
 
-    if (!tree) {
-        return -1;
-    }
+    pthread_mutex_unlock(&tree->lock);
+}
 
-    if (!key || !*key || !data) {
-        return -1;
+void rb_sync_retire(RB_SYNC_TREE *tree, RB_NODE *node)
+{
+    /* 列表已满时先尝试回收，仍然超过一半说明有读者长时间未离开，扩大列表 */
+    if (tree->retired_count >= tree->retired_size) {
+        rb_sync_reclaim(tree);
     }
 
-    target = tree->root;
-
-    /* 搜索红黑树并找到节点 */
-    while (target && !rb_node_is_nil(target)) {
-        cmp = strcmp(key, (const char *)target->key);
+    if (!tree->retired_size || tree->retired_count >= tree->retired_size / 2) {
+        int size = tree->retired_size ? tree->retired_size * 2 : RB_SYNC_RECLAIM;
+        RB_SYNC_RETIRED *retired = realloc(tree->retired, size * sizeof(RB_SYNC_RETIRED));
 
-        if (!cmp) {
-            /* 结点存在 */
-            break;
+        if (retired) {
+            tree->retired = retired;
+            tree->retired_size = size;
         }
+    }
 
-        if (cmp < 0) {
-            /* 搜索左子树 */
-            target = target->left;
-        } else {
-            /* 搜索右子树 */
-            target = target->right;
+    if (tree->retired_count >= tree->retired_size) {
+        /* 无法记录，只能等待所有读者离开后直接释放 */
+        int i = 0;
+
+        __atomic_add_fetch(&tree->epoch, 1, __ATOMIC_SEQ_CST);
+        for (; i < RB_SYNC_SLOTS; i++) {
+            while (__atomic_load_n(&tree->slots[i].epoch, __ATOMIC_SEQ_CST)) {
+                sched_yield();
+            }
         }
-    }
 
-    if (!target || rb_node_is_nil(target)) {
-        return -1;
+        rb_node_free(node);
+        return;
     }
 
-    *data = target->data;
-    return 0;
+    tree->retired[tree->retired_count].node = node;
+    tree->retired[tree->retired_count].epoch = __atomic_fetch_add(&tree->epoch, 1, __ATOMIC_SEQ_CST);
+    tree->retired_count++;
 }
 
-int rb_iterate(
-    RB_TREE *tree, void (*visit_before)(void *key, void *data, void *args), void *args)
-{    
-    RB_STACK stack;
-    RB_NODE **nodes = NULL;
-    RB_NODE *node = NULL;
+void rb_sync_reclaim(RB_SYNC_TREE *tree)
+{
+    unsigned long min = __atomic_load_n(&tree->epoch, __ATOMIC_SEQ_CST);
     int count = 0;
+    int i = 0;
 
-    if (!tree || !visit_before) {
-        return -1;
+    /* 找出仍在查找的读者中最早的纪元 */
+    for (; i < RB_SYNC_SLOTS; i++) {
+        unsigned long active = __atomic_load_n(&tree->slots[i].epoch, __ATOMIC_SEQ_CST);
+
+        if (active && active < min) {
+            min = active;
+        }
     }
 
-    count = tree->count;
-    if (count <= 0) {
-        return -1;
+    /* 在所有读者进入之前摘除的结点都可以释放 */
+    for (i = 0; i < tree->retired_count; i++) {
+        if (tree->retired[i].epoch < min) {
+            rb_node_free(tree->retired[i].node);
+        } else {
+            tree->retired[count++] = tree->retired[i];
+        }
     }
 
-    nodes = malloc(count * sizeof(RB_NODE *));
-    memset(nodes, 0, count * sizeof(RB_NODE *));
+    tree->retired_count = count;
+}
+
+RB_NODE *rb_finger_search(const RB_TREE *tree, const char *key, uint64_t prefix)
+{
+    RB_NODE *node = tree->finger;
+    RB_NODE *bound = tree->finger;
+    RB_NODE *parent = NULL;
+    int cmp = 0;
 
-    stack.elems = nodes;
-    stack.num = 0;
-    stack.size = count;
+    if (!node) {
+        return tree->root;
+    }
 
-    node = tree->root;
+    cmp = rb_key_compare(key, prefix, node);
+    if (!cmp) {
+        return node;
+    }
 
-    while ((node && !rb_node_is_nil(node)) || stack.num > 0) {
-        /* 遇到一个节点直接压栈，然后访问左子树 */
-        while (node && !rb_node_is_nil(node)) {
-            rb_stack_push(&stack, node);
-            node = node->left;
+    /**
+     * 以 key 大于 node 为例：node 是右孩子时父结点更小，继续向上；node 是左孩子时，
+     * node 的右子树恰好包含 node 与父结点之间的所有键，key 小于父结点时停止，否则继续向上。
+     * 
+     * bound 是最后一个比较过并且确定 key 在其右侧的结点，从停止处向下查找时会沿着右孩子
+     * 回到 bound，因此直接从 bound 开始。回溯只访问父结点，比较次数与 key 和最近访问的
+     * 结点之间的键数的对数成正比。
+     */
+    while ((parent = rb_node_get_parent(node))) {
+        int pcmp = 0;
+
+        if ((cmp > 0) == (node == parent->right)) {
+            node = parent;
+            continue;
         }
 
-        /* 左子树没有左儿子时，访问该节点的右儿子的左子树，以此类推 */
-        if (stack.num > 0) {
-            /* 弹出压入的结点 */
-            rb_stack_pop(&stack, &node);
-            visit_before((void *)node->key, node->data, args);
+        pcmp = rb_key_compare(key, prefix, parent);
+        if (!pcmp) {
+            return parent;
+        }
 
-            /* 访问节点右子树 */
-            node = node->right;
+        if ((pcmp > 0) != (cmp > 0)) {
+            break;
         }
+
+        node = parent;
+        bound = parent;
     }
 
-    free(nodes);
-    return 0;
+    return bound;
 }
 
-/*-------------------------------------------------------*/
-
-int rb_left_rotate(RB_TREE *tree, RB_NODE *node)
+const char *rb_key_own(RB_TREE *tree, const char *key)
 {
-    RB_NODE *y = NULL;
-
-    if (!tree || !node) {
-        return -1;
-    }
+    size_t len = strlen(key) + 1;
+    size_t index = 0;
+    char *copy = NULL;
+
+    if (tree->flags & RB_FLAG_INTERN_KEYS) {
+        /* 负载超过一半时扩大，线性探测总能找到空位 */
+        if (tree->intern_count * 2 >= tree->intern_size && rb_intern_grow(tree)) {
+            return NULL;
+        }
 
-    y = node->right;
-    node->right = y->left;
+        index = rb_key_hash(key) & (tree->intern_size - 1);
 
-    if (!rb_node_is_nil(y->left)) {
-        y->left->parent = node;
+        for (; tree->interns[index]; index = (index + 1) & (tree->intern_size - 1)) {
+            if (!strcmp(tree->interns[index], key)) {
+                /* 以前复制过的键，删除后重新插入时不再占用新的空间 */
+                return tree->interns[index];
+            }
+        }
     }
 
-    y->parent = node->parent;
+    copy = rb_arena_alloc(tree, len);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, key, len);
 
-    /* 处理各种父结点的边界情况 */
-    if (node == tree->root) {
-        tree->root = y;
-    } else if (node == node->parent->left) {
-        node->parent->left = y;
-    } else if (node == node->parent->right) {
-        node->parent->right = y;
+    if (tree->flags & RB_FLAG_INTERN_KEYS) {
+        tree->interns[index] = copy;
+        tree->intern_count++;
     }
 
-    y->left = node;
-    node->parent = y;
-    return 0;
+    return copy;
 }
 
-int rb_right_rotate(RB_TREE *tree, RB_NODE *node)
+char *rb_arena_alloc(RB_TREE *tree, size_t size)
 {
-    RB_NODE *x = NULL;
+    RB_BLOCK *block = NULL;
+    size_t chunk = RBTREE_ARENA_CHUNK - sizeof(RB_BLOCK);
+    char *ptr = NULL;
+
+    if (size <= tree->arena_left) {
+        ptr = tree->arena;
+        tree->arena += size;
+        tree->arena_left -= size;
+        return ptr;
+    }
 
-    if (!tree || !node) {
-        return -1;
+    /* 长键单独成块，不丢弃当前块剩余的空间 */
+    if (size > chunk / 8) {
+        chunk = size;
     }
 
-    x = node->left;
-    node->left = x->right;
+    block = malloc(sizeof(RB_BLOCK) + chunk);
+    if (!block) {
+        return NULL;
+    }
+    RB_STAT_ADD(tree, allocs, 1);
 
-    if (!rb_node_is_nil(x->right)) {
-        x->right->parent = node;
+    block->ref = 0;
+    if (rb_block_attach(tree, block)) {
+        free(block);
+        return NULL;
     }
 
-    x->parent = node->parent;
+    ptr = (char *)(block + 1);
 
-    /* 处理各种父结点的边界情况 */
-    if (node == tree->root) {
-        tree->root = x;
-    } else if (node == node->parent->left) {
-        node->parent->left = x;
-    } else if (node == node->parent->right) {
-        node->parent->right = x;
+    if (chunk > size) {
+        tree->arena = ptr + size;
+        tree->arena_left = chunk - size;
     }
 
-    x->right = node;
-    node->parent = x;
-    return 0;
+    return ptr;
 }
 
-int rb_insert_fixup_tree(RB_TREE *tree, RB_NODE *node)
+int rb_intern_grow(RB_TREE *tree)
 {
-    RB_NODE *tmp = NULL;
+    size_t size = tree->intern_size ? tree->intern_size * 2 : RBTREE_INTERN_SIZE;
+    const char **interns = malloc(size * sizeof(char *));
+    size_t i = 0;
 
-    if (!tree || !node || rb_node_is_nil(node)) {
+    if (!interns) {
         return -1;
     }
+    memset(interns, 0, size * sizeof(char *));
 
-    tmp = node;
+    for (; i < tree->intern_size; i++) {
+        const char *key = tree->interns[i];
+        size_t index = 0;
 
-    while (tmp->parent && (rb_node_get_color(tmp->parent) == RBTREE_COLOR_RED)) {
-        RB_NODE *uncle = tree->nil;
-        RB_NODE *parent = tmp->parent;
+        if (!key) {
+            continue;
+        }
 
-        /* 判断当前结点的父亲结点是否是祖父的左孩子或者右孩子 */
-        if (parent == parent->parent->left) {
-            uncle = parent->parent->right;
+        index = rb_key_hash(key) & (size - 1);
+        while (interns[index]) {
+            index = (index + 1) & (size - 1);
+        }
+        interns[index] = key;
+    }
 
-            if (uncle && (rb_node_get_color(uncle) == RBTREE_COLOR_RED)) {
-                rb_node_set_color(uncle, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent->parent, RBTREE_COLOR_RED);
+    free(tree->interns);
+    tree->interns = interns;
+    tree->intern_size = size;
+    return 0;
+}
 
-                tmp = parent->parent;
-                parent = tmp->parent;
-            } else if (tmp == parent->right) {
-                tmp = parent;
-                rb_left_rotate(tree, tmp);
-                parent = tmp->parent;
+uint64_t rb_key_hash(const char *key)
+{
+    uint64_t hash = 14695981039346656037ULL;
 
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent->parent, RBTREE_COLOR_RED);
-                rb_right_rotate(tree, parent->parent);
-            } else if (tmp == parent->left) {
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent->parent, RBTREE_COLOR_RED);
-                rb_right_rotate(tree, parent->parent);
-            }
-        } else {
-            uncle = parent->parent->left;
+    for (; *key; key++) {
+        hash ^= (unsigned char)*key;
+        hash *= 1099511628211ULL;
+    }
 
-            if (uncle && (rb_node_get_color(uncle) == RBTREE_COLOR_RED)) {
-                rb_node_set_color(uncle, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent->parent, RBTREE_COLOR_RED);
+    return hash;
+}
 
-                tmp = parent->parent;
-                parent = tmp->parent;
-            } else if (tmp == parent->left) {
-                tmp = parent;
-                rb_right_rotate(tree, tmp);
-                parent = tmp->parent;
+uint64_t rb_key_prefix(const char *key)
+{
+    uint64_t prefix = 0;
+    int i = 0;
 
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent->parent, RBTREE_COLOR_RED);
-                rb_left_rotate(tree, parent->parent);
-            } else if (tmp == parent->right) {
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent->parent, RBTREE_COLOR_RED);
-                rb_left_rotate(tree, parent->parent);
-            }
+    /* 高位在前，整数的大小关系与按无符号字节逐个比较的结果相同，键结束后补 0 */
+    for (; i < RBTREE_KEY_PREFIX; i++) {
+        prefix <<= 8;
+
+        if (*key) {
+            prefix |= (unsigned char)*key++;
         }
     }
 
-    rb_node_set_color(tree->root, RBTREE_COLOR_BLACK);
-    return 0;
+    return prefix;
 }
 
-int rb_delete_fixup_tree(RB_TREE *tree, RB_NODE *node)
+int rb_key_compare(const char *key, uint64_t prefix, const RB_NODE *node)
 {
-    if (!tree) {
-        return -1;
+    if (prefix != node->prefix) {
+        return prefix < node->prefix ? -1 : 1;
     }
 
-    while (node != tree->root && (rb_node_get_color(node) == RBTREE_COLOR_BLACK)) {
-        RB_NODE *parent = node->parent;
+    /* 前缀相同并且最后一个字节为 0，说明两个键都在前缀内结束，二者相等 */
+    if (!(prefix & 0xff)) {
+        return 0;
+    }
 
-        if (node == parent->left) {
-            RB_NODE *brother = parent->right;
+    return strcmp(key + RBTREE_KEY_PREFIX, node->key + RBTREE_KEY_PREFIX);
+}
 
-            if (rb_node_get_color(brother) == RBTREE_COLOR_RED) {
-                rb_node_set_color(brother, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent, RBTREE_COLOR_RED);
+uint64_t rb_bloom_hash(const char *key)
+{
+    size_t len = strlen(key);
+    uint64_t hash = len * 0x9E3779B97F4A7C15ULL;
+    uint64_t word = 0;
+
+    for (; len >= 8; len -= 8, key += 8) {
+        memcpy(&word, key, 8);
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+    }
 
-                rb_left_rotate(tree, parent);
-                parent = node->parent;
-                brother = parent->right;
-            }
+    word = 0;
+    memcpy(&word, key, len);
+    hash = (hash ^ word) * 0x94D049BB133111EBULL;
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    return hash ^ (hash >> 32);
+}
 
-            if ((rb_node_get_color(brother->left) == RBTREE_COLOR_BLACK) &&
-                (rb_node_get_color(brother->right) == RBTREE_COLOR_BLACK)) {
-                rb_node_set_color(brother, RBTREE_COLOR_RED);
-                node = parent;
-            } else if (rb_node_get_color(brother->right) == RBTREE_COLOR_BLACK) {
-                rb_node_set_color(brother->left, RBTREE_COLOR_BLACK);
-                rb_node_set_color(brother, RBTREE_COLOR_RED);
+int rb_bloom_test(const RB_TREE *tree, uint64_t hash)
+{
+    /* 低位选择块，bits 的高 48 位每 6 位给出块内一个字中的位置 */
+    const uint64_t *block = tree->bloom + (hash & (tree->bloom_blocks - 1)) * RBTREE_BLOOM_WORDS;
+    uint64_t bits = hash * 0x9E3779B97F4A7C15ULL;
+
+#if defined(__AVX2__)
+    /* 一次计算 4 个字的掩码，两次 vptest 检查整块 */
+    __m256i six = _mm256_set1_epi64x(63);
+    __m256i one = _mm256_set1_epi64x(1);
+    __m256i all = _mm256_set1_epi64x((long long)bits);
+    __m256i low = _mm256_and_si256(_mm256_srlv_epi64(all, _mm256_set_epi64x(34, 28, 22, 16)), six);
+    __m256i high = _mm256_and_si256(_mm256_srlv_epi64(all, _mm256_set_epi64x(58, 52, 46, 40)), six);
+
+    return _mm256_testc_si256(_mm256_load_si256((const __m256i *)block), _mm256_sllv_epi64(one, low)) &
+        _mm256_testc_si256(_mm256_load_si256((const __m256i *)(block + 4)), _mm256_sllv_epi64(one, high));
+#else
+    uint64_t miss = 0;
+    int i = 0;
+
+    /* 不提前返回，8 次检查没有分支，编译器可以展开并向量化 */
+    for (; i < RBTREE_BLOOM_WORDS; i++) {
+        miss |= ~block[i] & (1ULL << ((bits >> (16 + 6 * i)) & 63));
+    }
 
-                rb_right_rotate(tree, brother);
-                parent = node->parent;
-                brother = parent->right;
+    return !miss;
+#endif
+}
 
-                rb_node_set_color(brother, parent->flag & RBTREE_COLOR_MASK);
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(brother->right, RBTREE_COLOR_BLACK);
+void rb_bloom_set(uint64_t *bloom, size_t blocks, uint64_t hash)
+{
+    uint64_t *block = bloom + (hash & (blocks - 1)) * RBTREE_BLOOM_WORDS;
+    uint64_t bits = hash * 0x9E3779B97F4A7C15ULL;
+    int i = 0;
 
-                rb_left_rotate(tree, parent);
-                node = tree->root;
-            } else {
-                rb_node_set_color(brother, parent->flag & RBTREE_COLOR_MASK);
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(brother->right, RBTREE_COLOR_BLACK);
+    for (; i < RBTREE_BLOOM_WORDS; i++) {
+        block[i] |= 1ULL << ((bits >> (16 + 6 * i)) & 63);
+    }
+}
 
-                rb_left_rotate(tree, parent);
-                node = tree->root;
-            }
-        } else {
-            RB_NODE *brother = parent->left;
+void rb_bloom_add(RB_TREE *tree, const char *key)
+{
+    /* 扩大失败时继续使用原来的过滤器，只是误判率升高 */
+    if ((size_t)tree->count > tree->bloom_blocks * RBTREE_BLOOM_KEYS && !rb_bloom_rebuild(tree)) {
+        return;
+    }
 
-            if (rb_node_get_color(brother) == RBTREE_COLOR_RED) {
-                rb_node_set_color(brother, RBTREE_COLOR_BLACK);
-                rb_node_set_color(parent, RBTREE_COLOR_RED);
+    if (tree->bloom) {
+        rb_bloom_set(tree->bloom, tree->bloom_blocks, rb_bloom_hash(key));
+    }
+}
 
-                rb_right_rotate(tree, parent);
-                parent = node->parent;
-                brother = parent->left;
-            }
+void rb_bloom_remove(RB_TREE *tree, int removed)
+{
+    tree->bloom_stale += removed;
 
-            if ((rb_node_get_color(brother->right) == RBTREE_COLOR_BLACK) &&
-                (rb_node_get_color(brother->left) == RBTREE_COLOR_BLACK)) {
-                rb_node_set_color(brother, RBTREE_COLOR_RED);
-                node = parent;
-            } else if (rb_node_get_color(brother->left) == RBTREE_COLOR_BLACK) {
-                rb_node_set_color(brother->right, RBTREE_COLOR_BLACK);
-                rb_node_set_color(brother, RBTREE_COLOR_RED);
+    /* 每次重建之前至少删除了一半的键，重建的代价分摊到每次删除为 O(1) */
+    if (tree->bloom && tree->bloom_stale > tree->count / 2 + RBTREE_BLOOM_KEYS) {
+        rb_bloom_rebuild(tree);
+    }
+}
 
-                rb_left_rotate(tree, brother);
-                parent = node->parent;
-                brother = parent->left;
+int rb_bloom_rebuild(RB_TREE *tree)
+{
+    RB_NODE *node = NULL;
+    uint64_t *bloom = NULL;
+    size_t blocks = 1;
+    size_t size = 0;
 
-                rb_node_set_color(brother, parent->flag & RBTREE_COLOR_MASK);
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(brother->left, RBTREE_COLOR_BLACK);
+    /* 块数向上取整到 2 的幂，扩大时容量至少翻倍，每个键平均占 16 到 32 位 */
+    while (blocks * RBTREE_BLOOM_KEYS < (size_t)tree->count) {
+        blocks *= 2;
+    }
 
-                rb_right_rotate(tree, parent);
-                node = tree->root;
-            } else {
-                rb_node_set_color(brother, parent->flag & RBTREE_COLOR_MASK);
-                rb_node_set_color(parent, RBTREE_COLOR_BLACK);
-                rb_node_set_color(brother->left, RBTREE_COLOR_BLACK);
+    size = blocks * RBTREE_BLOOM_WORDS * sizeof(uint64_t);
+    bloom = aligned_alloc(RBTREE_BLOOM_WORDS * sizeof(uint64_t), size);
+    if (!bloom) {
+        return -1;
+    }
+    memset(bloom, 0, size);
+    RB_STAT_ADD(tree, allocs, 1);
 
-                rb_right_rotate(tree, parent);
-                node = tree->root;
-            }
-        }
+    for (node = rb_node_first(tree); node; node = rb_node_next(node)) {
+        rb_bloom_set(bloom, blocks, rb_bloom_hash(node->key));
     }
 
-    rb_node_set_color(node, RBTREE_COLOR_BLACK);
+    free(tree->bloom);
+    tree->bloom = bloom;
+    tree->bloom_blocks = blocks;
+    tree->bloom_stale = 0;
     return 0;
 }
 
-int rb_node_transplant(RB_TREE *tree, RB_NODE *dest, RB_NODE *src)
+void rb_bloom_merge(RB_TREE *tree, const RB_TREE *other)
 {
-    if (!tree || !dest || !src) {
-        return -1;
+    size_t i = 0;
+
+    if (!(tree->flags & RB_FLAG_BLOOM)) {
+        return;
     }
 
-    if (!dest->parent) {
-        tree->root = src;
-    } else if (dest->parent->left == dest) {
-        dest->parent->left = src;
-    } else if (dest->parent->right == dest) {
-        dest->parent->right = src;
+    if (!tree->bloom || !other->bloom || tree->bloom_blocks != other->bloom_blocks ||
+        (size_t)tree->count > tree->bloom_blocks * RBTREE_BLOOM_KEYS) {
+        rb_bloom_rebuild(tree);
+        return;
     }
 
-    src->parent = dest->parent;
-    return 0;
+    for (; i < tree->bloom_blocks * RBTREE_BLOOM_WORDS; i++) {
+        tree->bloom[i] |= other->bloom[i];
+    }
+    tree->bloom_stale += other->bloom_stale;
 }
 
-void rb_node_set_color(RB_NODE *node, unsigned int color)
+void rb_bloom_copy(RB_TREE *dest, const RB_TREE *src)
 {
-    if (node) {
-        node->flag = node->flag & (~RBTREE_COLOR_MASK);
-        node->flag |= color;
+    size_t size = src->bloom_blocks * RBTREE_BLOOM_WORDS * sizeof(uint64_t);
+
+    if (!src->bloom) {
+        return;
+    }
+
+    dest->bloom = aligned_alloc(RBTREE_BLOOM_WORDS * sizeof(uint64_t), size);
+    if (!dest->bloom) {
+        /* 没有过滤器时不过滤，下一次插入时重建 */
+        return;
     }
+    RB_STAT_ADD(dest, allocs, 1);
+
+    memcpy(dest->bloom, src->bloom, size);
+    dest->bloom_blocks = src->bloom_blocks;
 }
 
-unsigned int rb_node_get_color(RB_NODE *node)
+RB_NODE *rb_node_first(const RB_TREE *tree)
 {
-    if (node) {
-        return node->flag & RBTREE_COLOR_MASK;
+    RB_NODE *node = tree->root;
+
+    if (rb_node_is_nil(node)) {
+        return NULL;
     }
-    return RBTREE_COLOR_BLACK;
+
+    while (!rb_node_is_nil(node->left)) {
+        node = node->left;
+    }
+    return node;
 }
 
-int rb_node_is_nil(RB_NODE *node)
+RB_NODE *rb_node_last(const RB_TREE *tree)
 {
-    if (!node || (node->flag & RBTREE_NIL_NODE)) {
-        return 1;
+    RB_NODE *node = tree->root;
+
+    if (rb_node_is_nil(node)) {
+        return NULL;
     }
-    return 0;
+
+    while (!rb_node_is_nil(node->right)) {
+        node = node->right;
+    }
+    return node;
 }
 
-/*===========================================================================*/
+RB_NODE *rb_node_next(const RB_NODE *node)
+{
+    RB_NODE *parent = NULL;
+
+    /* 有右子树时，后继是右子树的最小结点 */
+    if (!rb_node_is_nil(node->right)) {
+        node = node->right;
+        while (!rb_node_is_nil(node->left)) {
+            node = node->left;
+        }
+        return (RB_NODE *)node;
+    }
+
+    /* 否则向上找到第一个以左子树包含当前结点的祖先 */
+    parent = rb_node_get_parent(node);
+    while (parent && node == parent->right) {
+        node = parent;
+        parent = rb_node_get_parent(node);
+    }
+    return parent;
+}
 
-STACK_IMPLEMENT(rb, RB, RB_NODE *);
+RB_NODE *rb_node_prev(const RB_NODE *node)
+{
+    RB_NODE *parent = NULL;
+
+    /* 有左子树时，前驱是左子树的最大结点 */
+    if (!rb_node_is_nil(node->left)) {
+        node = node->left;
+        while (!rb_node_is_nil(node->right)) {
+            node = node->right;
+        }
+        return (RB_NODE *)node;
+    }
+
+    /* 否则向上找到第一个以右子树包含当前结点的祖先 */
+    parent = rb_node_get_parent(node);
+    while (parent && node == parent->left) {
+        node = parent;
+        parent = rb_node_get_parent(node);
+    }
+    return parent;
+}
 
 /*===========================================================================*/
@@ -1,6 +1,8 @@
 #ifndef __RBTREE_H__
 #define __RBTREE_H__
 
+#include <stddef.h>
+
 /**
  * 红黑树在每个结点上增加一个存储单元来表示节点的颜色，可以是 RED 或者 BLACK,
  * 通过对任何一条从根到叶子的简单路径上各个结点的颜色进行约束，红黑树确保没有
@@ -21,23 +23,266 @@
 
 typedef struct rb_node_st RB_NODE;
 typedef struct rb_tree_st RB_TREE;
+typedef struct rb_sync_tree_st RB_SYNC_TREE;
+
+/* 树的最大高度，键的数目不超过 INT_MAX 时红黑树的高度不超过 2 * log2(n + 1) < 64 */
+#define RB_STATS_MAX_DEPTH 64
+
+/**
+ * 红黑树的统计信息
+ * 
+ * 结构信息总是可用；计数器只有在编译时定义 RBTREE_STAT 才会累加，否则始终为 0，
+ * 不定义时热路径上没有任何额外开销。
+ */
+typedef struct rb_stats_st
+{
+    int count;
+
+    /* 从根结点到最深结点的结点数，空树为 0 */
+    int height;
+
+    /* 根结点的黑高，不计哨兵 */
+    int black_height;
+
+    /* depth[i] 为深度为 i 的结点数，根结点的深度为 0 */
+    int depth[RB_STATS_MAX_DEPTH];
+
+    /* 树、结点和布隆过滤器占用的字节数，不包括键和数据 */
+    size_t bytes;
+
+    /* rb_find 和 rb_find_batch 查找的键数 */
+    unsigned long long lookups;
+
+    /* 查找、插入和删除时键的比较次数 */
+    unsigned long long compares;
+
+    /* 插入和删除后调整时的旋转次数 */
+    unsigned long long insert_rotations;
+    unsigned long long delete_rotations;
+
+    /* 申请结点和结点块的次数 */
+    unsigned long long allocs;
+
+    /* 被布隆过滤器直接判定为不存在、没有访问树的查找次数 */
+    unsigned long long bloom_rejects;
+} RB_STATS;
+
+/**
+ * 红黑树游标，指向树中的一个结点，可以直接定义在栈上，移动游标不需要申请内存
+ * 
+ * 插入或者删除数据后，除了指向被删除结点的游标，其余游标仍然有效。
+ */
+typedef struct rb_cursor_st
+{
+    RB_TREE *tree;
+    RB_NODE *node;
+} RB_CURSOR;
+
+#define RB_FLAG_OWN_KEYS    0x0001  /* 树拥有键：插入时复制键，调用方可以立即释放自己的键 */
+#define RB_FLAG_INTERN_KEYS 0x0002  /* 拥有键并且去重：复制过的键再次插入时使用已有的副本 */
+#define RB_FLAG_FINGER      0x0004  /* 从最近访问的结点开始查找，适合键基本有序的访问模式 */
+#define RB_FLAG_BLOOM       0x0008  /* 查找前先检查布隆过滤器，适合大多数查找都未命中的场景 */
 
 /* 创建一颗红黑树 */
 RB_TREE *rb_create();
 
+/**
+ * 按 RB_FLAG_* 创建红黑树，flags 为 0 时与 rb_create 相同
+ * 
+ * 拥有键时键的副本依次存放在树的键区域中，按 64KB 的块申请，销毁树时整块释放，不需要为每个键
+ * 单独调用 strdup，插入顺序相近的键在内存中也相邻。被删除的键在销毁树之前不会释放，键频繁
+ * 删除再插入时使用 RB_FLAG_INTERN_KEYS 避免区域不断增长。rb_split 得到的树与原树的标记相同，
+ * 拆分与连接后各自引用的键区域在所有引用它的树销毁后才释放。
+ * 
+ * 树返回的键（游标、遍历、集合运算的 drop）都是树中的副本，调用方不能释放。
+ * 
+ * RB_FLAG_FINGER 时树记录 rb_insert、rb_find 和 rb_delete 最近访问的结点，下一次操作从
+ * 该结点沿父结点向上回溯再向下查找，相邻的键之间相距 d 个键时时间复杂度为 O(log d)。
+ * 此时 rb_find 也会修改树，不能在多个线程中同时查找同一颗树。
+ * 
+ * RB_FLAG_BLOOM 时树维护一个分块布隆过滤器，每块 64 字节正好一条缓存行，每个键只落在一块中，
+ * 每个键占 16 到 32 位。rb_find、rb_find_batch 和 rb_delete 先检查过滤器，键一定不存在时只计算
+ * 一次散列值并读取一条缓存行就返回，不访问树；编译时开启 AVX2 时用向量指令检查整块。
+ * 插入时更新过滤器，键数超出容量时按两倍扩大并重建；删除不能清除位，过期的键超过一半时按
+ * 当前的键数重建，重建的代价分摊到每次插入和删除为 O(1)。rb_split 复制过滤器，rb_join 和
+ * 集合运算在两颗树的过滤器大小相同时按位合并，否则重建，时间复杂度变为 O(n)。
+ */
+RB_TREE *rb_create_ex(int flags);
+
 /* 销毁红黑树 */
 void rb_destroy(RB_TREE *tree);
 
+/**
+ * 由严格递增的有序数组直接构建红黑树，时间复杂度为 O(n)
+ * 
+ * keys 和 data 各有 count 个元素，data 为 NULL 时所有数据均为 NULL；所有结点在一块连续
+ * 的内存中申请，被删除的结点在销毁树时才随整块内存释放。键为空或者不是严格递增时返回 NULL。
+ */
+RB_TREE *rb_build_sorted(const char **keys, void **data, int count);
+
+/**
+ * 拆分与连接，时间复杂度为 O(log n)
+ * 
+ * rb_split -- 将 tree 中大于等于 key 的键移动到新创建的 right 中，tree 保留小于 key 的键。
+ *     没有定义 RBTREE_ORDER_STAT 时还需要 O(min(|tree|, |right|)) 的时间统计两侧的键数。
+ * rb_join -- 将 other 中的键全部移动到 tree 中并销毁 other，要求 tree 中的键都小于
+ *     other 中的键，否则返回 -1，两颗树保持不变。
+ */
+int rb_split(RB_TREE *tree, const char *key, RB_TREE **right);
+int rb_join(RB_TREE *tree, RB_TREE *other);
+
+/**
+ * 基于拆分与连接的集合运算，结果保存在 tree 中，other 被销毁，结点直接移动而不重新申请
+ * 
+ * rb_union -- 并集，两侧都有的键保留 other 中的数据
+ * rb_intersection -- 交集，保留 tree 中的数据
+ * rb_difference -- 差集，tree 中不在 other 中的键
+ * 
+ * 不在结果中的键和数据交给 drop 处理，drop 可以为 NULL。以 other 的每个结点拆分 tree，
+ * 时间复杂度为 O(m log(n / m + 1))，m 为较小的一颗的大小，other 较小时效率最高。
+ * 规模较大时递归的前几层在多个线程中并行执行，drop 可能被多个线程同时调用。
+ */
+int rb_union(RB_TREE *tree, RB_TREE *other, void (*drop)(void *key, void *data, void *args), void *args);
+int rb_intersection(RB_TREE *tree, RB_TREE *other, void (*drop)(void *key, void *data, void *args), void *args);
+int rb_difference(RB_TREE *tree, RB_TREE *other, void (*drop)(void *key, void *data, void *args), void *args);
+
+/* 获取树中键的数目 */
+int rb_count(const RB_TREE *tree);
+
 /* 插入数据 */
 int rb_insert(RB_TREE *tree, const char *key, void *data);
 
+/**
+ * 插入或者更新数据，只搜索一次
+ * 
+ * 键不存在时插入并返回 0，键已存在时用 data 替换原有数据并返回 1，出错返回 -1。
+ * old 不为 NULL 时返回被替换的数据，插入时为 NULL。键已存在时树中保留原来的键地址。
+ */
+int rb_upsert(RB_TREE *tree, const char *key, void *data, void **old);
+
+/**
+ * 键不存在时插入 data 并返回 0，已存在时不做修改并返回 1，出错返回 -1
+ * 
+ * slot 不为 NULL 时返回结点中数据的地址，可以直接原地修改，在该结点被删除之前一直有效。
+ */
+int rb_insert_or_get(RB_TREE *tree, const char *key, void *data, void ***slot);
+
 /* 删除数据，data 不为 NULL，返回移除的数据地址 */
 int rb_delete(RB_TREE *tree, const char *key, void **data);
 
 /* 查找数据 */
 int rb_find(RB_TREE *tree, const char *key, void **data);
 
+/**
+ * 批量查找 count 个键，返回找到的键的数目，出错返回 -1
+ * 
+ * data[i] 为 keys[i] 对应的数据，键不存在时为 NULL。多个查找交替推进并预取下一层结点，
+ * 树远大于缓存时吞吐量明显高于逐个调用 rb_find。
+ */
+int rb_find_batch(RB_TREE *tree, const char **keys, int count, void **data);
+
 /* 遍历红黑树 */
 int rb_iterate(RB_TREE *tree, void (*visit_before)(void *key, void *data, void *args), void *args);
 
+/**
+ * 并行遍历
+ * 
+ * 将树按中序分解为若干颗子树，由 threads 个线程领取并遍历，threads 不大于 0 时使用
+ * 所有在线的处理器。定义 RBTREE_ORDER_STAT 时按子树大小分解，否则按深度分解。
+ * 
+ * rb_iterate_parallel -- visit 被多个线程同时调用，同一颗子树内按键的顺序访问，
+ *     子树之间没有顺序。
+ * rb_reduce_parallel -- 并行的 map-reduce，init 创建一个空的累加器，map 将一个键
+ *     累加到累加器中，combine 将 other 合并到 acc 中并释放 other，result 返回最终的
+ *     累加器。ordered 为 0 时每个线程使用一个累加器，combine 需要满足交换律；
+ *     ordered 不为 0 时每颗子树使用一个累加器，并按键的顺序合并，可以用于有序输出，
+ *     例如 map 向缓冲区追加、combine 拼接缓冲区。
+ * 
+ * 遍历期间不能修改树。
+ */
+int rb_iterate_parallel(
+    RB_TREE *tree, int threads, void (*visit)(void *key, void *data, void *args), void *args);
+int rb_reduce_parallel(
+    RB_TREE *tree, int threads, int ordered,
+    void *(*init)(void *args),
+    void (*map)(void *acc, void *key, void *data, void *args),
+    void (*combine)(void *acc, void *other, void *args),
+    void *args, void **result);
+
+/**
+ * 获取统计信息，时间复杂度为 O(n)
+ * 
+ * 遍历期间不能修改树。rb_stats_reset 清零计数器，不影响结构信息。
+ */
+int rb_stats(const RB_TREE *tree, RB_STATS *stats);
+void rb_stats_reset(RB_TREE *tree);
+
+/**
+ * 顺序统计
+ * 
+ * rb_rank -- 返回树中小于 key 的键的数目，出错返回 -1
+ * rb_select -- 获取从 0 开始第 index 小的键和数据，key 和 data 可以为 NULL，越界返回 -1
+ * 
+ * 编译时定义 RBTREE_ORDER_STAT 会在每个结点上维护子树大小，两个操作的时间复杂度为
+ * O(log n)，否则按顺序遍历，时间复杂度为 O(n)。例如第 99 百分位的键：
+ * 
+ *     rb_select(tree, (int)(rb_count(tree) * 0.99), &key, NULL);
+ */
+int rb_rank(RB_TREE *tree, const char *key);
+int rb_select(RB_TREE *tree, int index, const char **key, void **data);
+
+/**
+ * 游标定位，成功返回 0，不存在满足条件的结点返回 -1，此时游标无效
+ * 
+ * rb_cursor_first -- 定位到最小的键
+ * rb_cursor_last -- 定位到最大的键
+ * rb_cursor_lower_bound -- 定位到第一个大于等于 key 的键
+ * rb_cursor_upper_bound -- 定位到第一个大于 key 的键
+ * 
+ * 例如遍历区间 [a, b) 内的所有键：
+ * 
+ *     for (ret = rb_cursor_lower_bound(tree, &cursor, a); !ret; ret = rb_cursor_next(&cursor)) {
+ *         rb_cursor_get(&cursor, &key, &data);
+ *         if (strcmp(key, b) >= 0) {
+ *             break;
+ *         }
+ *         ...
+ *     }
+ */
+int rb_cursor_first(RB_TREE *tree, RB_CURSOR *cursor);
+int rb_cursor_last(RB_TREE *tree, RB_CURSOR *cursor);
+int rb_cursor_lower_bound(RB_TREE *tree, RB_CURSOR *cursor, const char *key);
+int rb_cursor_upper_bound(RB_TREE *tree, RB_CURSOR *cursor, const char *key);
+
+/* 游标移动到后继或者前驱，成功返回 0，已经到达末尾返回 -1，此时游标无效 */
+int rb_cursor_next(RB_CURSOR *cursor);
+int rb_cursor_prev(RB_CURSOR *cursor);
+
+/* 获取游标指向的键和数据，key 和 data 可以为 NULL，游标无效返回 -1 */
+int rb_cursor_get(const RB_CURSOR *cursor, const char **key, void **data);
+
+/**
+ * 支持并发读的红黑树
+ * 
+ * rb_sync_find 不加锁，可以与其它查找以及一个写者同时进行；写操作之间由一把互斥锁串行化。
+ * 查找期间树被修改时重新查找，连续失败 RB_SYNC_RETRY 次后加锁查找，因此写操作频繁时
+ * 查找仍然能够完成。
+ * 
+ * 被删除的结点在没有读者能访问到之后才释放。但键和数据的内存由调用方管理，查找可能
+ * 仍在读取刚被删除的键，释放被删除的键之前需要调用 rb_sync_barrier 等待此前开始的查找结束。
+ */
+RB_SYNC_TREE *rb_sync_create();
+void rb_sync_destroy(RB_SYNC_TREE *tree);
+
+/* 写操作，返回值与 rb_insert、rb_upsert 和 rb_delete 相同 */
+int rb_sync_insert(RB_SYNC_TREE *tree, const char *key, void *data);
+int rb_sync_upsert(RB_SYNC_TREE *tree, const char *key, void *data, void **old);
+int rb_sync_delete(RB_SYNC_TREE *tree, const char *key, void **data);
+
+/* 无锁查找，返回值与 rb_find 相同 */
+int rb_sync_find(RB_SYNC_TREE *tree, const char *key, void **data);
+
+/* 等待调用前开始的所有查找结束，并释放已删除的结点 */
+void rb_sync_barrier(RB_SYNC_TREE *tree);
+
 #endif /* __RBTREE_H__ */
@@ -0,0 +1,480 @@
+#ifndef __RBTREE_TPL_H__
+#define __RBTREE_TPL_H__
+
+/**
+ * 红黑树模板
+ *
+ * 与 rbtree.h 中以字符串为键、void * 为值的红黑树不同，模板在编译期按照键类型、值类型和
+ * 比较函数生成专用的红黑树，键和值直接存放在结点中，比较函数在查找路径上被内联展开，
+ * 整数键的比较不再需要函数调用和字符串比较。
+ *
+ * 用法：
+ *
+ *     // 头文件中声明
+ *     RB_DEFINE(imap, IMAP, long, void *)
+ *
+ *     // 源文件中实现，比较函数返回负数、0、正数分别表示小于、等于、大于
+ *     RB_IMPLEMENT(imap, IMAP, long, void *, RB_COMPARE_NUM)
+ *
+ *     IMAP_RBTREE tree;
+ *     imap_rbtree_init(&tree);
+ *     imap_rbtree_insert(&tree, 42, data);
+ *     imap_rbtree_find(&tree, 42, &data);
+ *     imap_rbtree_clear(&tree);
+ *
+ * 结点的叶子用 NULL 表示，颜色存放在父结点地址的最低位。
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define RB_TPL_RED   0x00000000      /* 定义红色 */
+#define RB_TPL_BLACK 0x00000001      /* 定义黑色 */
+
+/* 数值类型的比较函数，不产生分支 */
+#define RB_COMPARE_NUM(a, b) (((a) > (b)) - ((a) < (b)))
+
+/* 结点的父结点和颜色，空结点视为黑色 */
+#define RB_TPL_PARENT(node) ((void *)((node)->parent_color & ~(uintptr_t)1))
+#define RB_TPL_COLOR(node) ((node) ? (unsigned int)((node)->parent_color & 1) : RB_TPL_BLACK)
+
+#define RB_TPL_SET_PARENT(node, parent) \
+    ((node)->parent_color = (uintptr_t)(parent) | ((node)->parent_color & 1))
+
+#define RB_TPL_SET_COLOR(node, color) \
+    ((node)->parent_color = ((node)->parent_color & ~(uintptr_t)1) | (color))
+
+/**
+ * 红黑树模板，第一个参数是命名空间，第二个参数是类型前缀，第三个参数是键类型，第四个参数是
+ * 值类型
+ */
+#define RB_DEFINE(ns, nscp, ktype, vtype) \
+    typedef struct ns##_rbnode_st nscp##_RBNODE; \
+    \
+    struct ns##_rbnode_st { \
+        uintptr_t parent_color; \
+        nscp##_RBNODE *left; \
+        nscp##_RBNODE *right; \
+        ktype key; \
+        vtype value; \
+    }; \
+    \
+    typedef struct ns##_rbtree_st { \
+        nscp##_RBNODE *root; \
+        int count; \
+    } nscp##_RBTREE; \
+    \
+    extern void ns##_rbtree_init(nscp##_RBTREE *tree); \
+    extern void ns##_rbtree_clear(nscp##_RBTREE *tree); \
+    extern int ns##_rbtree_insert(nscp##_RBTREE *tree, ktype key, vtype value); \
+    extern int ns##_rbtree_delete(nscp##_RBTREE *tree, ktype key, vtype *value); \
+    extern int ns##_rbtree_find(const nscp##_RBTREE *tree, ktype key, vtype *value); \
+    extern int ns##_rbtree_iterate( \
+        nscp##_RBTREE *tree, void (*visit)(ktype key, vtype *value, void *args), void *args);
+
+/* 红黑树实现，第五个参数是比较函数或者函数式宏 */
+#define RB_IMPLEMENT(ns, nscp, ktype, vtype, cmp) \
+    static void ns##_rbtree_rotate_left(nscp##_RBTREE *tree, nscp##_RBNODE *node) { \
+        nscp##_RBNODE *y = node->right; \
+        nscp##_RBNODE *parent = RB_TPL_PARENT(node); \
+        \
+        node->right = y->left; \
+        if (y->left) { \
+            RB_TPL_SET_PARENT(y->left, node); \
+        } \
+        \
+        RB_TPL_SET_PARENT(y, parent); \
+        if (!parent) { \
+            tree->root = y; \
+        } else if (parent->left == node) { \
+            parent->left = y; \
+        } else { \
+            parent->right = y; \
+        } \
+        \
+        y->left = node; \
+        RB_TPL_SET_PARENT(node, y); \
+    } \
+    \
+    static void ns##_rbtree_rotate_right(nscp##_RBTREE *tree, nscp##_RBNODE *node) { \
+        nscp##_RBNODE *x = node->left; \
+        nscp##_RBNODE *parent = RB_TPL_PARENT(node); \
+        \
+        node->left = x->right; \
+        if (x->right) { \
+            RB_TPL_SET_PARENT(x->right, node); \
+        } \
+        \
+        RB_TPL_SET_PARENT(x, parent); \
+        if (!parent) { \
+            tree->root = x; \
+        } else if (parent->left == node) { \
+            parent->left = x; \
+        } else { \
+            parent->right = x; \
+        } \
+        \
+        x->right = node; \
+        RB_TPL_SET_PARENT(node, x); \
+    } \
+    \
+    static void ns##_rbtree_insert_fixup(nscp##_RBTREE *tree, nscp##_RBNODE *node) { \
+        nscp##_RBNODE *parent = NULL; \
+        \
+        while ((parent = RB_TPL_PARENT(node)) && RB_TPL_COLOR(parent) == RB_TPL_RED) { \
+            nscp##_RBNODE *grand = RB_TPL_PARENT(parent); \
+            nscp##_RBNODE *uncle = NULL; \
+            \
+            if (parent == grand->left) { \
+                uncle = grand->right; \
+                \
+                if (RB_TPL_COLOR(uncle) == RB_TPL_RED) { \
+                    RB_TPL_SET_COLOR(uncle, RB_TPL_BLACK); \
+                    RB_TPL_SET_COLOR(parent, RB_TPL_BLACK); \
+                    RB_TPL_SET_COLOR(grand, RB_TPL_RED); \
+                    node = grand; \
+                    continue; \
+                } \
+                \
+                if (node == parent->right) { \
+                    ns##_rbtree_rotate_left(tree, parent); \
+                    node = parent; \
+                    parent = RB_TPL_PARENT(node); \
+                } \
+                \
+                RB_TPL_SET_COLOR(parent, RB_TPL_BLACK); \
+                RB_TPL_SET_COLOR(grand, RB_TPL_RED); \
+                ns##_rbtree_rotate_right(tree, grand); \
+            } else { \
+                uncle = grand->left; \
+                \
+                if (RB_TPL_COLOR(uncle) == RB_TPL_RED) { \
+                    RB_TPL_SET_COLOR(uncle, RB_TPL_BLACK); \
+                    RB_TPL_SET_COLOR(parent, RB_TPL_BLACK); \
+                    RB_TPL_SET_COLOR(grand, RB_TPL_RED); \
+                    node = grand; \
+                    continue; \
+                } \
+                \
+                if (node == parent->left) { \
+                    ns##_rbtree_rotate_right(tree, parent); \
+                    node = parent; \
+                    parent = RB_TPL_PARENT(node); \
+                } \
+                \
+                RB_TPL_SET_COLOR(parent, RB_TPL_BLACK); \
+                RB_TPL_SET_COLOR(grand, RB_TPL_RED); \
+                ns##_rbtree_rotate_left(tree, grand); \
+            } \
+        } \
+        \
+        RB_TPL_SET_COLOR(tree->root, RB_TPL_BLACK); \
+    } \
+    \
+    static void ns##_rbtree_delete_fixup( \
+        nscp##_RBTREE *tree, nscp##_RBNODE *node, nscp##_RBNODE *parent) { \
+        while (node != tree->root && RB_TPL_COLOR(node) == RB_TPL_BLACK) { \
+            nscp##_RBNODE *brother = NULL; \
+            \
+            if (node == parent->left) { \
+                brother = parent->right; \
+                \
+                if (RB_TPL_COLOR(brother) == RB_TPL_RED) { \
+                    RB_TPL_SET_COLOR(brother, RB_TPL_BLACK); \
+                    RB_TPL_SET_COLOR(parent, RB_TPL_RED); \
+                    ns##_rbtree_rotate_left(tree, parent); \
+                    brother = parent->right; \
+                } \
+                \
+                if (RB_TPL_COLOR(brother->left) == RB_TPL_BLACK && \
+                    RB_TPL_COLOR(brother->right) == RB_TPL_BLACK) { \
+                    RB_TPL_SET_COLOR(brother, RB_TPL_RED); \
+                    node = parent; \
+                    parent = RB_TPL_PARENT(node); \
+                    continue; \
+                } \
+                \
+                if (RB_TPL_COLOR(brother->right) == RB_TPL_BLACK) { \
+                    RB_TPL_SET_COLOR(brother->left, RB_TPL_BLACK); \
+                    RB_TPL_SET_COLOR(brother, RB_TPL_RED); \
+                    ns##_rbtree_rotate_right(tree, brother); \
+                    brother = parent->right; \
+                } \
+                \
+                RB_TPL_SET_COLOR(brother, RB_TPL_COLOR(parent)); \
+                RB_TPL_SET_COLOR(parent, RB_TPL_BLACK); \
+                RB_TPL_SET_COLOR(brother->right, RB_TPL_BLACK); \
+                ns##_rbtree_rotate_left(tree, parent); \
+            } else { \
+                brother = parent->left; \
+                \
+                if (RB_TPL_COLOR(brother) == RB_TPL_RED) { \
+                    RB_TPL_SET_COLOR(brother, RB_TPL_BLACK); \
+                    RB_TPL_SET_COLOR(parent, RB_TPL_RED); \
+                    ns##_rbtree_rotate_right(tree, parent); \
+                    brother = parent->left; \
+                } \
+                \
+                if (RB_TPL_COLOR(brother->left) == RB_TPL_BLACK && \
+                    RB_TPL_COLOR(brother->right) == RB_TPL_BLACK) { \
+                    RB_TPL_SET_COLOR(brother, RB_TPL_RED); \
+                    node = parent; \
+                    parent = RB_TPL_PARENT(node); \
+                    continue; \
+                } \
+                \
+                if (RB_TPL_COLOR(brother->left) == RB_TPL_BLACK) { \
+                    RB_TPL_SET_COLOR(brother->right, RB_TPL_BLACK); \
+                    RB_TPL_SET_COLOR(brother, RB_TPL_RED); \
+                    ns##_rbtree_rotate_left(tree, brother); \
+                    brother = parent->left; \
+                } \
+                \
+                RB_TPL_SET_COLOR(brother, RB_TPL_COLOR(parent)); \
+                RB_TPL_SET_COLOR(parent, RB_TPL_BLACK); \
+                RB_TPL_SET_COLOR(brother->left, RB_TPL_BLACK); \
+                ns##_rbtree_rotate_right(tree, parent); \
+            } \
+            \
+            node = tree->root; \
+        } \
+        \
+        if (node) { \
+            RB_TPL_SET_COLOR(node, RB_TPL_BLACK); \
+        } \
+    } \
+    \
+    void ns##_rbtree_init(nscp##_RBTREE *tree) { \
+        if (tree) { \
+            tree->root = NULL; \
+            tree->count = 0; \
+        } \
+    } \
+    \
+    void ns##_rbtree_clear(nscp##_RBTREE *tree) { \
+        nscp##_RBNODE *node = NULL; \
+        \
+        if (!tree) { \
+            return; \
+        } \
+        \
+        /* 后序释放结点，释放后将父结点的对应孩子置空，不需要额外的栈 */ \
+        node = tree->root; \
+        while (node) { \
+            if (node->left) { \
+                node = node->left; \
+            } else if (node->right) { \
+                node = node->right; \
+            } else { \
+                nscp##_RBNODE *parent = RB_TPL_PARENT(node); \
+                \
+                if (parent) { \
+                    if (parent->left == node) { \
+                        parent->left = NULL; \
+                    } else { \
+                        parent->right = NULL; \
+                    } \
+                } \
+                \
+                free(node); \
+                node = parent; \
+            } \
+        } \
+        \
+        tree->root = NULL; \
+        tree->count = 0; \
+    } \
+    \
+    int ns##_rbtree_insert(nscp##_RBTREE *tree, ktype key, vtype value) { \
+        nscp##_RBNODE *parent = NULL; \
+        nscp##_RBNODE **link = NULL; \
+        nscp##_RBNODE *add = NULL; \
+        \
+        if (!tree) { \
+            return -1; \
+        } \
+        \
+        link = &tree->root; \
+        while (*link) { \
+            int ret = 0; \
+            \
+            parent = *link; \
+            ret = cmp(key, parent->key); \
+            \
+            if (!ret) { \
+                return -1; \
+            } \
+            link = (ret < 0) ? &parent->left : &parent->right; \
+        } \
+        \
+        add = malloc(sizeof(nscp##_RBNODE)); \
+        if (!add) { \
+            return -1; \
+        } \
+        \
+        add->parent_color = (uintptr_t)parent | RB_TPL_RED; \
+        add->left = NULL; \
+        add->right = NULL; \
+        add->key = key; \
+        add->value = value; \
+        \
+        *link = add; \
+        tree->count++; \
+        \
+        ns##_rbtree_insert_fixup(tree, add); \
+        return 0; \
+    } \
+    \
+    int ns##_rbtree_delete(nscp##_RBTREE *tree, ktype key, vtype *value) { \
+        nscp##_RBNODE *target = NULL; \
+        nscp##_RBNODE *child = NULL; \
+        nscp##_RBNODE *parent = NULL; \
+        unsigned int color = RB_TPL_RED; \
+        \
+        if (!tree) { \
+            return -1; \
+        } \
+        \
+        target = tree->root; \
+        while (target) { \
+            int ret = cmp(key, target->key); \
+            \
+            if (!ret) { \
+                break; \
+            } \
+            target = (ret < 0) ? target->left : target->right; \
+        } \
+        \
+        if (!target) { \
+            return -1; \
+        } \
+        \
+        if (!target->left || !target->right) { \
+            /* 最多只有一个孩子，直接用孩子替换 */ \
+            child = target->left ? target->left : target->right; \
+            parent = RB_TPL_PARENT(target); \
+            color = RB_TPL_COLOR(target); \
+            \
+            if (child) { \
+                RB_TPL_SET_PARENT(child, parent); \
+            } \
+            \
+            if (!parent) { \
+                tree->root = child; \
+            } else if (parent->left == target) { \
+                parent->left = child; \
+            } else { \
+                parent->right = child; \
+            } \
+        } else { \
+            /* 用后继替换待删除节点，后继一定没有左孩子 */ \
+            nscp##_RBNODE *mini = target->right; \
+            nscp##_RBNODE *up = RB_TPL_PARENT(target); \
+            \
+            while (mini->left) { \
+                mini = mini->left; \
+            } \
+            \
+            color = RB_TPL_COLOR(mini); \
+            child = mini->right; \
+            parent = RB_TPL_PARENT(mini); \
+            \
+            if (parent == target) { \
+                parent = mini; \
+            } else { \
+                parent->left = child; \
+                if (child) { \
+                    RB_TPL_SET_PARENT(child, parent); \
+                } \
+                mini->right = target->right; \
+                RB_TPL_SET_PARENT(mini->right, mini); \
+            } \
+            \
+            mini->left = target->left; \
+            RB_TPL_SET_PARENT(mini->left, mini); \
+            \
+            /* 后继继承待删除节点的父结点和颜色 */ \
+            mini->parent_color = target->parent_color; \
+            if (!up) { \
+                tree->root = mini; \
+            } else if (up->left == target) { \
+                up->left = mini; \
+            } else { \
+                up->right = mini; \
+            } \
+        } \
+        \
+        if (color == RB_TPL_BLACK) { \
+            ns##_rbtree_delete_fixup(tree, child, parent); \
+        } \
+        \
+        if (value) { \
+            *value = target->value; \
+        } \
+        \
+        free(target); \
+        tree->count--; \
+        return 0; \
+    } \
+    \
+    int ns##_rbtree_find(const nscp##_RBTREE *tree, ktype key, vtype *value) { \
+        const nscp##_RBNODE *node = NULL; \
+        \
+        if (!tree) { \
+            return -1; \
+        } \
+        \
+        node = tree->root; \
+        while (node) { \
+            int ret = cmp(key, node->key); \
+            \
+            if (!ret) { \
+                if (value) { \
+                    *value = node->value; \
+                } \
+                return 0; \
+            } \
+            node = (ret < 0) ? node->left : node->right; \
+        } \
+        \
+        return -1; \
+    } \
+    \
+    int ns##_rbtree_iterate( \
+        nscp##_RBTREE *tree, void (*visit)(ktype key, vtype *value, void *args), void *args) { \
+        nscp##_RBNODE *node = NULL; \
+        \
+        if (!tree || !visit) { \
+            return -1; \
+        } \
+        \
+        node = tree->root; \
+        while (node && node->left) { \
+            node = node->left; \
+        } \
+        \
+        /* 借助父结点中序遍历，不需要额外的栈 */ \
+        while (node) { \
+            visit(node->key, &node->value, args); \
+            \
+            if (node->right) { \
+                node = node->right; \
+                while (node->left) { \
+                    node = node->left; \
+                } \
+            } else { \
+                nscp##_RBNODE *parent = RB_TPL_PARENT(node); \
+                \
+                while (parent && node == parent->right) { \
+                    node = parent; \
+                    parent = RB_TPL_PARENT(node); \
+                } \
+                node = parent; \
+            } \
+        } \
+        \
+        return 0; \
+    }
+
+#endif /* __RBTREE_TPL_H__ */
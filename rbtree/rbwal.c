@@ -0,0 +1,774 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "rbtree.h"
+#include "rbwal.h"
+
+/*===========================================================================*/
+
+#define RB_WAL_PUT    1     /* 插入或者替换 */
+#define RB_WAL_DELETE 2     /* 删除 */
+
+/* 记录头：校验和与记录体的大小 */
+#define RB_WAL_HEADER_SIZE 8
+
+/* 记录体的固定部分：类型、键的长度和值的长度 */
+#define RB_WAL_BODY_SIZE 9
+
+/* 检查点文件的后缀 */
+#define RB_WAL_CHECKPOINT_SUFFIX ".ckpt"
+
+/* 检查点临时文件的后缀，写完并同步后才重命名 */
+#define RB_WAL_TEMP_SUFFIX ".tmp"
+
+/* 树中保存的值 */
+typedef struct rb_wal_value_st
+{
+    size_t size;
+    char data[];
+} RB_WAL_VALUE;
+
+/* 等待写入日志的记录 */
+typedef struct rb_wal_buffer_st
+{
+    char *data;
+    size_t len;
+    size_t size;
+} RB_WAL_BUFFER;
+
+/* 带预写日志的红黑树 */
+struct rb_wal_st
+{
+    RB_TREE *tree;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    int fd;
+    char *path;
+    char *checkpoint_path;
+
+    /**
+     * 两个缓冲区交替使用，领导者写入其中一个时，其余线程向另一个追加记录，
+     * pending 为正在追加的缓冲区下标。
+     */
+    RB_WAL_BUFFER buffers[2];
+    int pending;
+
+    /* 最后一条追加的记录序号，以及已经持久化的最后一条记录序号 */
+    uint64_t lsn;
+    uint64_t synced;
+
+    /* 是否有领导者正在写入 */
+    int syncing;
+
+    /* 是否正在执行检查点 */
+    int checkpointing;
+
+    /* 写日志或者同步失败后不再接受修改 */
+    int error;
+
+    /* 日志文件的大小，以及自动执行检查点的大小 */
+    size_t log_size;
+    size_t checkpoint_size;
+
+    /* 日志达到该大小时自动执行检查点，失败后推迟 checkpoint_size，避免每次修改都重试 */
+    size_t checkpoint_next;
+};
+
+/* 记录追加到检查点文件时的上下文 */
+typedef struct rb_wal_dump_st
+{
+    FILE *fp;
+    int error;
+} RB_WAL_DUMP;
+
+/* 计算 CRC32 校验和 */
+static uint32_t rb_wal_crc32(const void *data, size_t len);
+
+/* 生成 CRC32 查找表 */
+static void rb_wal_crc32_init();
+
+/* 拼接路径和后缀 */
+static char *rb_wal_path(const char *path, const char *suffix);
+
+/* 将记录编码到 out 中，out 为 NULL 时只返回编码后的大小 */
+static size_t rb_wal_encode(char *out, int type, const char *key, const void *value, size_t size);
+
+/* 向当前缓冲区追加一条记录，返回记录序号，失败返回 0 */
+static uint64_t rb_wal_append(RB_WAL *wal, int type, const char *key, const void *value, size_t size);
+
+/* 将一条记录应用到树中 */
+static int rb_wal_apply(RB_WAL *wal, int type, const char *key, const void *value, size_t size);
+
+/* 修改操作的公共部分，exist 为 -1 时要求键不存在，为 1 时要求键存在 */
+static int rb_wal_modify(
+    RB_WAL *wal, int type, int exist, const char *key, const void *value, size_t size);
+
+/* 等待 lsn 及之前的记录持久化，需要持有锁，等待期间可能成为领导者 */
+static int rb_wal_commit(RB_WAL *wal, uint64_t lsn);
+
+/* 执行检查点，需要持有锁 */
+static int rb_wal_checkpoint_locked(RB_WAL *wal);
+
+/* 将一个键写入检查点文件 */
+static void rb_wal_dump(void *key, void *data, void *args);
+
+/**
+ * 读取并应用文件中的记录，end 返回最后一条完整记录的结束位置
+ *
+ * strict 为 1 时不完整的记录视为错误，用于检查点文件；文件不存在时返回 0。
+ */
+static int rb_wal_load(RB_WAL *wal, const char *path, int strict, off_t *end);
+
+/* 完整写入 */
+static int rb_wal_write(int fd, const char *data, size_t len);
+
+/* 同步文件所在的目录，使重命名持久化 */
+static int rb_wal_sync_dir(const char *path);
+
+/* 释放树中的值 */
+static void rb_wal_free_value(void *key, void *data, void *args);
+
+static uint32_t rb_wal_crc_table[256];
+static pthread_once_t rb_wal_crc_once = PTHREAD_ONCE_INIT;
+
+/*===========================================================================*/
+
+RB_WAL *rb_wal_open(const char *path, size_t checkpoint_size)
+{
+    RB_WAL *wal = NULL;
+    struct stat st;
+    off_t end = 0;
+
+    if (!path) {
+        return NULL;
+    }
+
+    pthread_once(&rb_wal_crc_once, rb_wal_crc32_init);
+
+    wal = malloc(sizeof(RB_WAL));
+    if (!wal) {
+        return NULL;
+    }
+    memset(wal, 0, sizeof(RB_WAL));
+
+    wal->fd = -1;
+    wal->checkpoint_size = checkpoint_size ? checkpoint_size : RB_WAL_CHECKPOINT_SIZE;
+    wal->checkpoint_next = wal->checkpoint_size;
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->cond, NULL);
+
+    wal->tree = rb_create_ex(RB_FLAG_OWN_KEYS);
+    wal->path = rb_wal_path(path, "");
+    wal->checkpoint_path = rb_wal_path(path, RB_WAL_CHECKPOINT_SUFFIX);
+
+    if (!wal->tree || !wal->path || !wal->checkpoint_path) {
+        goto failed;
+    }
+
+    /* 先恢复检查点，再重放检查点之后的日志 */
+    if (rb_wal_load(wal, wal->checkpoint_path, 1, &end)) {
+        goto failed;
+    }
+
+    wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (wal->fd < 0 || rb_wal_load(wal, path, 0, &end) || fstat(wal->fd, &st)) {
+        goto failed;
+    }
+
+    /* 截断末尾不完整的记录，之后追加的记录紧跟在最后一条完整记录之后 */
+    if (st.st_size > end && (ftruncate(wal->fd, end) || fdatasync(wal->fd))) {
+        goto failed;
+    }
+
+    wal->log_size = (size_t)end;
+    return wal;
+
+failed:
+    rb_wal_close(wal);
+    return NULL;
+}
+
+void rb_wal_close(RB_WAL *wal)
+{
+    if (!wal) {
+        return;
+    }
+
+    if (wal->fd >= 0) {
+        pthread_mutex_lock(&wal->lock);
+        rb_wal_commit(wal, wal->lsn);
+        pthread_mutex_unlock(&wal->lock);
+
+        close(wal->fd);
+    }
+
+    if (wal->tree) {
+        rb_iterate(wal->tree, rb_wal_free_value, NULL);
+        rb_destroy(wal->tree);
+    }
+
+    pthread_cond_destroy(&wal->cond);
+    pthread_mutex_destroy(&wal->lock);
+
+    free(wal->buffers[0].data);
+    free(wal->buffers[1].data);
+    free(wal->path);
+    free(wal->checkpoint_path);
+    free(wal);
+}
+
+int rb_wal_insert(RB_WAL *wal, const char *key, const void *value, size_t size)
+{
+    return rb_wal_modify(wal, RB_WAL_PUT, -1, key, value, size);
+}
+
+int rb_wal_upsert(RB_WAL *wal, const char *key, const void *value, size_t size)
+{
+    return rb_wal_modify(wal, RB_WAL_PUT, 0, key, value, size);
+}
+
+int rb_wal_delete(RB_WAL *wal, const char *key)
+{
+    return rb_wal_modify(wal, RB_WAL_DELETE, 1, key, NULL, 0);
+}
+
+int rb_wal_find(RB_WAL *wal, const char *key, void *value, size_t *size)
+{
+    RB_WAL_VALUE *data = NULL;
+    int ret = 0;
+
+    if (!wal || !key || !*key || !size) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+
+    ret = rb_find(wal->tree, key, (void **)&data);
+    if (!ret) {
+        if (value) {
+            memcpy(value, data->data, data->size < *size ? data->size : *size);
+        }
+        *size = data->size;
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+    return ret;
+}
+
+int rb_wal_count(RB_WAL *wal)
+{
+    int count = 0;
+
+    if (!wal) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    count = rb_count(wal->tree);
+    pthread_mutex_unlock(&wal->lock);
+    return count;
+}
+
+int rb_wal_iterate(
+    RB_WAL *wal, void (*visit)(const char *key, const void *value, size_t size, void *args), void *args)
+{
+    RB_CURSOR cursor;
+    int ret = 0;
+
+    if (!wal || !visit) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+
+    for (ret = rb_cursor_first(wal->tree, &cursor); !ret; ret = rb_cursor_next(&cursor)) {
+        const char *key = NULL;
+        RB_WAL_VALUE *data = NULL;
+
+        rb_cursor_get(&cursor, &key, (void **)&data);
+        visit(key, data->data, data->size, args);
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+    return 0;
+}
+
+int rb_wal_checkpoint(RB_WAL *wal)
+{
+    int ret = 0;
+
+    if (!wal) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    ret = rb_wal_checkpoint_locked(wal);
+    pthread_mutex_unlock(&wal->lock);
+    return ret;
+}
+
+/*-------------------------------------------------------*/
+
+uint32_t rb_wal_crc32(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint32_t crc = 0xFFFFFFFFu;
+
+    for (; len; len--) {
+        crc = rb_wal_crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void rb_wal_crc32_init()
+{
+    uint32_t i = 0;
+
+    for (; i < 256; i++) {
+        uint32_t crc = i;
+        int j = 0;
+
+        for (; j < 8; j++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+
+        rb_wal_crc_table[i] = crc;
+    }
+}
+
+char *rb_wal_path(const char *path, const char *suffix)
+{
+    size_t len = strlen(path);
+    char *full = malloc(len + strlen(suffix) + 1);
+
+    if (!full) {
+        return NULL;
+    }
+
+    memcpy(full, path, len);
+    strcpy(full + len, suffix);
+    return full;
+}
+
+size_t rb_wal_encode(char *out, int type, const char *key, const void *value, size_t size)
+{
+    uint32_t key_len = (uint32_t)strlen(key);
+    uint32_t value_len = (uint32_t)size;
+    uint32_t body = RB_WAL_BODY_SIZE + key_len + value_len;
+    uint32_t crc = 0;
+    unsigned char kind = (unsigned char)type;
+    char *p = out + RB_WAL_HEADER_SIZE;
+
+    if (!out) {
+        return RB_WAL_HEADER_SIZE + body;
+    }
+
+    /* 记录格式：crc、记录体大小 | 类型、键长、值长、键、值，crc 覆盖整个记录体 */
+    memcpy(p, &kind, 1);
+    memcpy(p + 1, &key_len, 4);
+    memcpy(p + 5, &value_len, 4);
+    memcpy(p + RB_WAL_BODY_SIZE, key, key_len);
+    if (value_len) {
+        memcpy(p + RB_WAL_BODY_SIZE + key_len, value, value_len);
+    }
+
+    crc = rb_wal_crc32(p, body);
+    memcpy(out, &crc, 4);
+    memcpy(out + 4, &body, 4);
+    return RB_WAL_HEADER_SIZE + body;
+}
+
+uint64_t rb_wal_append(RB_WAL *wal, int type, const char *key, const void *value, size_t size)
+{
+    RB_WAL_BUFFER *buffer = wal->buffers + wal->pending;
+    size_t len = rb_wal_encode(NULL, type, key, value, size);
+
+    if (buffer->len + len > buffer->size) {
+        size_t grow = buffer->size ? buffer->size : 4096;
+        char *data = NULL;
+
+        while (grow < buffer->len + len) {
+            grow *= 2;
+        }
+
+        data = realloc(buffer->data, grow);
+        if (!data) {
+            return 0;
+        }
+
+        buffer->data = data;
+        buffer->size = grow;
+    }
+
+    buffer->len += rb_wal_encode(buffer->data + buffer->len, type, key, value, size);
+    return ++wal->lsn;
+}
+
+int rb_wal_apply(RB_WAL *wal, int type, const char *key, const void *value, size_t size)
+{
+    RB_WAL_VALUE *data = NULL;
+    void *old = NULL;
+
+    if (type == RB_WAL_DELETE) {
+        if (rb_delete(wal->tree, key, &old)) {
+            return -1;
+        }
+
+        free(old);
+        return 0;
+    }
+
+    data = malloc(sizeof(RB_WAL_VALUE) + size);
+    if (!data) {
+        return -1;
+    }
+
+    data->size = size;
+    if (size) {
+        memcpy(data->data, value, size);
+    }
+
+    if (rb_upsert(wal->tree, key, data, &old) < 0) {
+        free(data);
+        return -1;
+    }
+
+    free(old);
+    return 0;
+}
+
+int rb_wal_modify(
+    RB_WAL *wal, int type, int exist, const char *key, const void *value, size_t size)
+{
+    uint64_t lsn = 0;
+    void *old = NULL;
+    int ret = 0;
+
+    if (!wal || !key || !*key || (size && !value) || size > UINT32_MAX || strlen(key) > UINT32_MAX) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+
+    if (wal->error) {
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+
+    /* 不满足条件的操作不写日志 */
+    if (exist && (!rb_find(wal->tree, key, &old)) != (exist > 0)) {
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+
+    /**
+     * 先追加记录再修改树，日志中的记录与树的修改顺序相同。其它线程可能在持久化之前看到
+     * 修改，但本次调用在持久化之后才返回。插入也记录为 PUT，重放只依赖每个键的最后一条
+     * 记录，从任何检查点开始重放都得到相同的结果。
+     */
+    lsn = rb_wal_append(wal, type, key, value, size);
+    if (!lsn || rb_wal_apply(wal, type, key, value, size)) {
+        /* 记录可能已经进入缓冲区，与树不再一致 */
+        wal->error = 1;
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+
+    ret = rb_wal_commit(wal, lsn);
+
+    /**
+     * 修改已经持久化，检查点只用来缩短日志，它的结果不影响本次修改的返回值。失败或者没能
+     * 截断日志时，日志再增长 checkpoint_size 之后才重试。
+     */
+    if (!ret && !wal->checkpointing && wal->log_size >= wal->checkpoint_next) {
+        rb_wal_checkpoint_locked(wal);
+        wal->checkpoint_next = wal->log_size + wal->checkpoint_size;
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+    return ret;
+}
+
+int rb_wal_commit(RB_WAL *wal, uint64_t lsn)
+{
+    while (!wal->error && wal->synced < lsn) {
+        RB_WAL_BUFFER *buffer = NULL;
+        uint64_t target = 0;
+        int ret = 0;
+
+        if (wal->syncing) {
+            /* 领导者正在写入之前的记录，等待它完成后再检查 */
+            pthread_cond_wait(&wal->cond, &wal->lock);
+            continue;
+        }
+
+        /* 成为领导者，带走当前缓冲区中的所有记录，其它线程继续向另一个缓冲区追加 */
+        buffer = wal->buffers + wal->pending;
+        wal->pending ^= 1;
+        target = wal->lsn;
+        wal->syncing = 1;
+
+        pthread_mutex_unlock(&wal->lock);
+        ret = rb_wal_write(wal->fd, buffer->data, buffer->len) || fdatasync(wal->fd);
+        pthread_mutex_lock(&wal->lock);
+
+        wal->log_size += buffer->len;
+        buffer->len = 0;
+        wal->syncing = 0;
+
+        if (ret) {
+            wal->error = 1;
+        } else {
+            wal->synced = target;
+        }
+
+        pthread_cond_broadcast(&wal->cond);
+    }
+
+    return wal->error ? -1 : 0;
+}
+
+int rb_wal_checkpoint_locked(RB_WAL *wal)
+{
+    RB_WAL_DUMP dump;
+    char *temp = NULL;
+    int ret = -1;
+
+    if (wal->checkpointing) {
+        return 0;
+    }
+
+    wal->checkpointing = 1;
+
+    /* 等待已经追加的记录持久化，之后持有锁期间不会有新的记录 */
+    if (rb_wal_commit(wal, wal->lsn)) {
+        wal->checkpointing = 0;
+        return -1;
+    }
+
+    temp = rb_wal_path(wal->checkpoint_path, RB_WAL_TEMP_SUFFIX);
+    if (!temp) {
+        wal->checkpointing = 0;
+        return -1;
+    }
+
+    dump.fp = fopen(temp, "wb");
+    dump.error = !dump.fp;
+
+    if (!dump.error) {
+        rb_iterate(wal->tree, rb_wal_dump, &dump);
+
+        dump.error |= fflush(dump.fp) != 0;
+        dump.error |= fsync(fileno(dump.fp)) != 0;
+        dump.error |= fclose(dump.fp) != 0;
+    }
+
+    /**
+     * 重命名之后检查点才生效，在截断日志之前崩溃时日志中的记录会在检查点之上重放一次，
+     * 结果不变。截断失败时日志已经与检查点重复，不影响正确性，下次检查点重试。
+     */
+    if (!dump.error && !rename(temp, wal->checkpoint_path) && !rb_wal_sync_dir(wal->checkpoint_path)) {
+        if (!ftruncate(wal->fd, 0) && !fdatasync(wal->fd)) {
+            wal->log_size = 0;
+            wal->checkpoint_next = wal->checkpoint_size;
+        }
+        ret = 0;
+    } else {
+        unlink(temp);
+    }
+
+    free(temp);
+    wal->checkpointing = 0;
+    return ret;
+}
+
+void rb_wal_dump(void *key, void *data, void *args)
+{
+    RB_WAL_DUMP *dump = args;
+    RB_WAL_VALUE *value = data;
+    char stack[256];
+    char *record = stack;
+    size_t len = 0;
+
+    if (dump->error) {
+        return;
+    }
+
+    len = rb_wal_encode(NULL, RB_WAL_PUT, key, value->data, value->size);
+    if (len > sizeof(stack)) {
+        record = malloc(len);
+        if (!record) {
+            dump->error = 1;
+            return;
+        }
+    }
+
+    rb_wal_encode(record, RB_WAL_PUT, key, value->data, value->size);
+    if (fwrite(record, 1, len, dump->fp) != len) {
+        dump->error = 1;
+    }
+
+    if (record != stack) {
+        free(record);
+    }
+}
+
+int rb_wal_load(RB_WAL *wal, const char *path, int strict, off_t *end)
+{
+    FILE *fp = fopen(path, "rb");
+    char *body = NULL;
+    size_t size = 0;
+    int ret = 0;
+
+    *end = 0;
+
+    if (!fp) {
+        /* 文件不存在时视为空 */
+        return 0;
+    }
+
+    for (;;) {
+        char header[RB_WAL_HEADER_SIZE];
+        uint32_t crc = 0;
+        uint32_t len = 0;
+        uint32_t key_len = 0;
+        uint32_t value_len = 0;
+        unsigned char type = 0;
+        char *key = NULL;
+        size_t got = fread(header, 1, RB_WAL_HEADER_SIZE, fp);
+
+        if (!got) {
+            break;
+        }
+
+        memcpy(&crc, header, 4);
+        memcpy(&len, header + 4, 4);
+
+        if (got < RB_WAL_HEADER_SIZE || len < RB_WAL_BODY_SIZE) {
+            ret = strict ? -1 : 0;
+            break;
+        }
+
+        if (len > size) {
+            char *grow = realloc(body, len);
+
+            if (!grow) {
+                ret = -1;
+                break;
+            }
+
+            body = grow;
+            size = len;
+        }
+
+        /* 不完整或者校验和错误的记录是崩溃时正在写入的最后一批，其后没有有效的记录 */
+        if (fread(body, 1, len, fp) != len || rb_wal_crc32(body, len) != crc) {
+            ret = strict ? -1 : 0;
+            break;
+        }
+
+        memcpy(&type, body, 1);
+        memcpy(&key_len, body + 1, 4);
+        memcpy(&value_len, body + 5, 4);
+
+        if ((uint64_t)RB_WAL_BODY_SIZE + key_len + value_len != len || !key_len ||
+            (type != RB_WAL_PUT && type != RB_WAL_DELETE)) {
+            ret = strict ? -1 : 0;
+            break;
+        }
+
+        /* 键在记录中没有结尾的 0，复制一份 */
+        key = malloc(key_len + 1);
+        if (!key) {
+            ret = -1;
+            break;
+        }
+        memcpy(key, body + RB_WAL_BODY_SIZE, key_len);
+        key[key_len] = 0;
+
+        /* 键不能包含 0，否则无法作为字符串 */
+        if (strlen(key) != key_len) {
+            free(key);
+            ret = strict ? -1 : 0;
+            break;
+        }
+
+        /* 删除不存在的键说明该记录已经包含在检查点中，忽略即可 */
+        if (rb_wal_apply(wal, type, key, body + RB_WAL_BODY_SIZE + key_len, value_len) &&
+            type == RB_WAL_PUT) {
+            free(key);
+            ret = -1;
+            break;
+        }
+
+        free(key);
+        *end += RB_WAL_HEADER_SIZE + len;
+    }
+
+    free(body);
+    fclose(fp);
+    return ret;
+}
+
+int rb_wal_write(int fd, const char *data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, data, len);
+
+        if (n < 0) {
+            return -1;
+        }
+
+        data += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+int rb_wal_sync_dir(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    char *dir = NULL;
+    int fd = -1;
+    int ret = 0;
+
+    if (!slash) {
+        dir = rb_wal_path(".", "");
+    } else {
+        dir = malloc(slash - path + 2);
+        if (dir) {
+            memcpy(dir, path, slash - path + 1);
+            dir[slash - path + 1] = 0;
+        }
+    }
+
+    if (!dir) {
+        return -1;
+    }
+
+    fd = open(dir, O_RDONLY);
+    free(dir);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    ret = fsync(fd) ? -1 : 0;
+    close(fd);
+    return ret;
+}
+
+void rb_wal_free_value(void *key, void *data, void *args)
+{
+    free(data);
+}
@@ -0,0 +1,67 @@
+#ifndef __RBWAL_H__
+#define __RBWAL_H__
+
+#include <stddef.h>
+
+/**
+ * 带预写日志的红黑树
+ *
+ * 每个修改先追加到日志文件，持久化之后才返回，进程崩溃后重新打开时由检查点和日志恢复出
+ * 崩溃前所有已经返回的修改：
+ *
+ * 1.组提交 -- 多个线程同时写入时，记录先追加到内存缓冲区，其中一个线程作为领导者将缓冲区
+ *   一次写入并 fdatasync，其余线程等待它完成，一次 fdatasync 覆盖同一批的所有修改；
+ * 2.检查点 -- 日志超过一定大小时将整颗树写入临时文件，同步后重命名为 path.ckpt，再截断日志，
+ *   也可以调用 rb_wal_checkpoint 主动执行；
+ * 3.恢复 -- 打开时先加载检查点，再依次重放日志，日志末尾不完整或者校验和错误的记录说明
+ *   写入时崩溃，该记录对应的操作没有返回过，直接截断。
+ *
+ * 每条记录带有 CRC32 校验和，记录按主机字节序保存。键和值都复制到树中，值的内存由日志管理。
+ */
+typedef struct rb_wal_st RB_WAL;
+
+/* 日志达到该大小时自动执行检查点 */
+#define RB_WAL_CHECKPOINT_SIZE (64 * 1024 * 1024)
+
+/**
+ * 打开日志文件 path 并恢复树，检查点保存在 path.ckpt 中
+ *
+ * checkpoint_size 为自动执行检查点的日志大小，为 0 时使用 RB_WAL_CHECKPOINT_SIZE。
+ * 检查点文件损坏时返回 NULL。
+ */
+RB_WAL *rb_wal_open(const char *path, size_t checkpoint_size);
+
+/* 等待所有修改持久化后关闭，不执行检查点 */
+void rb_wal_close(RB_WAL *wal);
+
+/**
+ * 修改操作，持久化之后才返回，可以在多个线程中同时调用
+ *
+ * rb_wal_insert -- 键已存在时返回 -1，不写日志
+ * rb_wal_upsert -- 键不存在时插入，已存在时替换值
+ * rb_wal_delete -- 键不存在时返回 -1，不写日志
+ *
+ * 写日志或者同步失败后日志进入错误状态，之后的修改都返回 -1。
+ */
+int rb_wal_insert(RB_WAL *wal, const char *key, const void *value, size_t size);
+int rb_wal_upsert(RB_WAL *wal, const char *key, const void *value, size_t size);
+int rb_wal_delete(RB_WAL *wal, const char *key);
+
+/**
+ * 查找键，将值复制到 value 中，最多复制 *size 字节，size 返回值的实际大小
+ *
+ * value 可以为 NULL，此时只获取值的大小。
+ */
+int rb_wal_find(RB_WAL *wal, const char *key, void *value, size_t *size);
+
+/* 获取键的数目 */
+int rb_wal_count(RB_WAL *wal);
+
+/* 按键的顺序遍历，遍历期间持有锁，visit 中不能调用日志的其它函数 */
+int rb_wal_iterate(
+    RB_WAL *wal, void (*visit)(const char *key, const void *value, size_t size, void *args), void *args);
+
+/* 执行检查点，期间阻塞所有修改 */
+int rb_wal_checkpoint(RB_WAL *wal);
+
+#endif /* __RBWAL_H__ */
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "rbtree.h"
+
+/**
+ * 并发读写测试：
+ *
+ * 1.一个写者随机插入、替换和删除 count 个键中的一个，每隔一段时间调用 rb_sync_barrier；
+ * 2.多个读者同时用 rb_sync_find 随机查找，找到的数据必须是写者为该键写入过的值；
+ * 3.写者结束后等待读者退出，输出各读者找到的次数。
+ *
+ * 用 make tsan 以 ThreadSanitizer 编译运行，无锁查找与写者之间存在数据竞争时报告并以非零值退出。
+ *
+ * 用法：./sync_test [count] [rounds]
+ */
+
+#define SYNC_TEST_COUNT   2000
+#define SYNC_TEST_ROUNDS  200000
+#define SYNC_TEST_READERS 4
+
+/* 键的格式为 key 加上 7 位十进制数，加上结尾的 0 */
+#define SYNC_TEST_KEY_SIZE 11
+
+/* 每隔多少次写操作等待一次读者，回收被删除的结点 */
+#define SYNC_TEST_BARRIER 10000
+
+static RB_SYNC_TREE *sync_tree = NULL;
+static char *sync_keys = NULL;
+static int sync_count = SYNC_TEST_COUNT;
+static int sync_stop = 0;
+
+/* 每个读者独立的 xorshift 伪随机数 */
+static unsigned int sync_random(unsigned int *state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void *sync_reader(void *args)
+{
+    unsigned int state = (unsigned int)(size_t)args;
+    long found = 0;
+
+    while (!__atomic_load_n(&sync_stop, __ATOMIC_RELAXED)) {
+        char *key = sync_keys + (size_t)(sync_random(&state) % sync_count) * SYNC_TEST_KEY_SIZE;
+        void *data = NULL;
+
+        if (rb_sync_find(sync_tree, key, &data)) {
+            continue;
+        }
+
+        /* 插入时数据为键本身，替换时为键的第二个字符 */
+        if (data != key && data != key + 1) {
+            fprintf(stderr, "键 %s 的数据错误\n", key);
+            abort();
+        }
+        found++;
+    }
+    return (void *)found;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = SYNC_TEST_ROUNDS;
+
+    pthread_t readers[SYNC_TEST_READERS];
+    unsigned int state = 1;
+    void *found = NULL;
+    int i = 0;
+
+    if (argc > 1) {
+        sync_count = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        rounds = atoi(argv[2]);
+    }
+
+    if (sync_count <= 0 || rounds < 0) {
+        fprintf(stderr, "用法：%s [count] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    sync_keys = malloc((size_t)sync_count * SYNC_TEST_KEY_SIZE);
+    sync_tree = rb_sync_create();
+    if (!sync_keys || !sync_tree) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+
+    /* 键在键空间中打乱分布，插入和删除会引起旋转 */
+    for (; i < sync_count; i++) {
+        snprintf(sync_keys + (size_t)i * SYNC_TEST_KEY_SIZE, SYNC_TEST_KEY_SIZE,
+            "key%07u", (unsigned int)(i * 7919u % 10000000u));
+    }
+
+    for (i = 0; i < SYNC_TEST_READERS; i++) {
+        pthread_create(&readers[i], NULL, sync_reader, (void *)(size_t)(i + 1));
+    }
+
+    for (i = 0; i < rounds; i++) {
+        unsigned int r = sync_random(&state);
+        char *key = sync_keys + (size_t)(r % sync_count) * SYNC_TEST_KEY_SIZE;
+
+        switch ((r >> 24) % 3) {
+        case 0:
+            rb_sync_insert(sync_tree, key, key);
+            break;
+        case 1:
+            rb_sync_upsert(sync_tree, key, key + 1, NULL);
+            break;
+        default:
+            rb_sync_delete(sync_tree, key, NULL);
+            break;
+        }
+
+        if (i % SYNC_TEST_BARRIER == 0) {
+            rb_sync_barrier(sync_tree);
+        }
+    }
+
+    __atomic_store_n(&sync_stop, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i < SYNC_TEST_READERS; i++) {
+        pthread_join(readers[i], &found);
+        printf("读者 %d 找到 %ld 次\n", i, (long)found);
+    }
+
+    rb_sync_destroy(sync_tree);
+    free(sync_keys);
+    return 0;
+}